@@ -0,0 +1,82 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/SharedState.hpp>
+#include <kuzco/Journal.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// the latency overhead of journaled commits per sync policy
+// "commit" is the time a transaction commit takes (it's done under the transaction lock)
+// "durable" additionally includes waiting for the record to become durable (after the lock)
+
+namespace {
+
+struct Counters {
+    std::vector<int64_t> values = std::vector<int64_t>(100);
+};
+
+using namespace std::chrono;
+
+void run(const char* name, kuzco::JournalConfig config, int commits) {
+    auto path = std::filesystem::temp_directory_path() / "kuzco-bench-journal.kzj";
+    std::filesystem::remove(path);
+
+    nanoseconds commitTime{}, durableTime{};
+    kuzco::JournalMetrics m;
+    {
+        kuzco::Journal journal(path, config);
+        kuzco::SharedState<Counters> state({});
+        state.setJournal(&journal);
+
+        for (int i = 0; i < commits; ++i) {
+            auto start = steady_clock::now();
+            uint64_t lsn;
+            {
+                auto t = state.transaction();
+                t->values[size_t(i) % 100] += i;
+                t.journal(std::to_string(i));
+                t.commit();
+                lsn = t.lsn();
+            }
+            auto committed = steady_clock::now();
+            journal.waitDurable(lsn);
+            auto durable = steady_clock::now();
+            commitTime += committed - start;
+            durableTime += durable - start;
+        }
+        m = journal.metrics();
+    }
+    std::filesystem::remove(path);
+
+    std::printf("%-22s %8d %12.0f ns %12.0f ns %12.0f ns %8llu\n", name, commits,
+        double(commitTime.count()) / commits,
+        double(durableTime.count()) / commits,
+        double(m.maxAppendTime.count()),
+        (unsigned long long)m.syncs);
+}
+
+}
+
+int main() {
+    std::printf("%-22s %8s %15s %15s %15s %8s\n", "policy", "commits", "commit", "durable", "max append", "syncs");
+
+    kuzco::JournalConfig config;
+
+    config.sync = kuzco::JournalSync::None;
+    run("none", config, 20'000);
+
+    config.sync = kuzco::JournalSync::EveryCommit;
+    run("every commit", config, 1'000);
+
+    config.sync = kuzco::JournalSync::Batched;
+    config.maxDelay = microseconds(100);
+    run("batched 100us", config, 5'000);
+    config.maxDelay = milliseconds(2);
+    run("batched 2ms", config, 1'000);
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/NodeStdVector.hpp>
+#include <kuzco/SlabNodeVector.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// iterate over the elements of a NodeStdVector and a SlabNodeVector of the same data
+
+namespace {
+
+struct Employee {
+    std::string name;
+    double salary = 0;
+    int age = 0;
+};
+
+volatile double sink;
+
+template <typename F>
+void measure(const char* name, size_t size, F f) {
+    const int iters = 10;
+    auto start = std::chrono::steady_clock::now();
+    double sum = 0;
+    for (int i = 0; i < iters; ++i) {
+        sum += f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    sink = sum;
+    auto ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / iters;
+    std::printf("%-16s %10zu %8.2f ns/element\n", name, size, ns / double(size));
+}
+
+}
+
+int main() {
+    const size_t sizes[] = {1'000, 100'000, 1'000'000};
+    for (auto size : sizes) {
+        std::vector<Employee> src(size);
+        for (size_t i = 0; i < size; ++i) {
+            src[i].salary = double(i);
+        }
+
+        kuzco::NodeStdVector<Employee> nodes;
+        nodes.reserve(size);
+        std::vector<std::string> noise; // interleave other allocations as a real state would
+        for (auto& e : src) {
+            nodes.push_back(e);
+            noise.emplace_back(64, 'x');
+        }
+
+        kuzco::SlabNodeVector<Employee> slab(src.begin(), src.end());
+
+        measure("NodeStdVector", size, [&]() {
+            double sum = 0;
+            for (auto& n : nodes) sum += n.r().salary;
+            return sum;
+        });
+        measure("SlabNodeVector", size, [&]() {
+            double sum = 0;
+            for (auto& e : slab) sum += e.salary;
+            return sum;
+        });
+    }
+    return 0;
+}
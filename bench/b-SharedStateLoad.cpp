@@ -0,0 +1,369 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/SharedState.hpp>
+#include <kuzco/Reclaimer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// a load generator for SharedState: readers and writers hammer a state for a while and the
+// latencies of the operations are recorded in histograms
+// * detach: loading a snapshot
+// * release: dropping a snapshot (which destroys the old state if it was the last ref)
+// * acquire: waiting for the transaction lock
+// * commit: committing a transaction (which includes publishing and dropping the stored snapshot)
+//
+// usage: kuzco-bench-SharedStateLoad [key=value...]
+//   readers=4 writers=1   number of threads
+//   size=10000            number of items in the state
+//   shape=point           mutation: point (one item), bulk (1/16 of the items), replace (all new)
+//   reads=8               items read per detach
+//   hold=0                snapshots each reader holds on to (pinning old versions)
+//   writeDelay=0          microseconds between the transactions of a writer
+//   reclaimer=0           with 1, released states are destroyed by a Reclaimer
+//   ms=1000               duration of a run
+//   scale=0               with 1, run with 1, 2, 4... readers up to the given number and print
+//                         the throughput scaling instead of the histograms
+
+namespace {
+
+using namespace std::chrono;
+
+// log-linear buckets as in HDR histograms: 32 sub-buckets per power of two (~3% precision)
+class Histogram {
+public:
+    void record(nanoseconds d) {
+        auto v = uint64_t(std::max(d.count(), nanoseconds::rep(0)));
+        ++m_counts[index(v)];
+        ++m_total;
+        m_sum += v;
+        m_max = std::max(m_max, v);
+    }
+
+    void merge(const Histogram& other) {
+        for (size_t i = 0; i < m_counts.size(); ++i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    uint64_t count() const { return m_total; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_total ? double(m_sum) / double(m_total) : 0; }
+
+    // the highest value which is equivalent to the value at the percentile
+    uint64_t percentile(double p) const {
+        if (!m_total) return 0;
+        auto target = std::max(uint64_t(1), uint64_t(p / 100 * double(m_total) + 0.5));
+        uint64_t cur = 0;
+        for (size_t i = 0; i < m_counts.size(); ++i) {
+            cur += m_counts[i];
+            if (cur >= target) {
+                return std::min(m_max, i + 1 < m_counts.size() ? lowest(i + 1) - 1 : m_max);
+            }
+        }
+        return m_max;
+    }
+
+private:
+    static constexpr int SubBits = 5;
+    static constexpr uint64_t Sub = 1 << SubBits;
+
+    static size_t index(uint64_t v) {
+        if (v < Sub) return size_t(v);
+        int shift = 63 - std::countl_zero(v) - SubBits;
+        return size_t(uint64_t(shift + 1) * Sub + ((v >> shift) - Sub));
+    }
+    static uint64_t lowest(size_t i) {
+        if (i < Sub) return i;
+        auto shift = i / Sub - 1;
+        return (i % Sub + Sub) << shift;
+    }
+
+    std::vector<uint64_t> m_counts = std::vector<uint64_t>((64 - SubBits + 1) * Sub);
+    uint64_t m_total = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_max = 0;
+};
+
+struct Item {
+    int64_t values[4] = {};
+};
+
+struct Data {
+    std::vector<kuzco::Node<Item>> items;
+};
+
+}
+
+template <>
+struct kuzco::ReclaimTraits<Data> {
+    static void children(const Data& d, ReclaimSink& sink) {
+        ReclaimTraits<std::vector<Node<Item>>>::children(d.items, sink);
+    }
+};
+
+namespace {
+
+enum class Shape { Point, Bulk, Replace };
+
+struct Config {
+    int readers = 4;
+    int writers = 1;
+    size_t size = 10'000;
+    Shape shape = Shape::Point;
+    int reads = 8;
+    size_t hold = 0;
+    int writeDelay = 0;
+    bool reclaimer = false;
+    int ms = 1000;
+    bool scale = false;
+};
+
+struct Result {
+    Histogram detach, release, acquire, commit;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    double seconds = 0;
+    kuzco::ReclaimerMetrics reclaim;
+};
+
+// filled by a thread in a local object and moved to the results when it's done, so that threads
+// don't write to neighboring memory (false sharing would skew the measured latencies)
+struct ThreadResult {
+    Histogram a, b;
+    uint64_t ops = 0;
+};
+
+volatile int64_t sink;
+
+void mutate(Data& data, Shape shape, std::minstd_rand& rng) {
+    auto size = data.items.size();
+    switch (shape) {
+    case Shape::Point:
+        ++data.items[rng() % size]->values[0];
+        break;
+    case Shape::Bulk:
+        for (size_t i = 0; i < size / 16; ++i) {
+            ++data.items[rng() % size]->values[1];
+        }
+        break;
+    case Shape::Replace:
+        for (auto& item : data.items) {
+            item = kuzco::Node<Item>(item.r());
+        }
+        break;
+    }
+}
+
+Result run(const Config& cfg) {
+    Data initial;
+    initial.items.reserve(cfg.size);
+    for (size_t i = 0; i < cfg.size; ++i) {
+        initial.items.emplace_back();
+    }
+
+    std::optional<kuzco::Reclaimer> reclaimer;
+    Result ret;
+    {
+        kuzco::SharedState<Data> state(std::move(initial));
+        if (cfg.reclaimer) {
+            reclaimer.emplace();
+            state.setReclaimer(&*reclaimer);
+        }
+
+        std::atomic_bool start = false, stop = false;
+        std::vector<ThreadResult> readerResults(size_t(cfg.readers)), writerResults(size_t(cfg.writers));
+        std::vector<std::thread> threads;
+
+        for (int i = 0; i < cfg.readers; ++i) {
+            threads.emplace_back([&, i]() {
+                ThreadResult res;
+                std::minstd_rand rng(unsigned(i) + 1);
+                std::vector<kuzco::Detached<Data>> held;
+                while (!start) std::this_thread::yield();
+                while (!stop) {
+                    auto t0 = steady_clock::now();
+                    auto d = state.detach();
+                    auto t1 = steady_clock::now();
+                    res.a.record(t1 - t0);
+
+                    int64_t sum = 0;
+                    for (int r = 0; r < cfg.reads; ++r) {
+                        sum += d->items[rng() % d->items.size()]->values[0];
+                    }
+                    sink = sum;
+
+                    if (cfg.hold) {
+                        held.push_back(std::move(d));
+                        if (held.size() <= cfg.hold) {
+                            ++res.ops;
+                            continue;
+                        }
+                        d = std::move(held.front());
+                        held.erase(held.begin());
+                    }
+
+                    auto t2 = steady_clock::now();
+                    d.reset();
+                    auto t3 = steady_clock::now();
+                    res.b.record(t3 - t2);
+                    ++res.ops;
+                }
+                readerResults[size_t(i)] = std::move(res);
+            });
+        }
+
+        for (int i = 0; i < cfg.writers; ++i) {
+            threads.emplace_back([&, i]() {
+                ThreadResult res;
+                std::minstd_rand rng(unsigned(i) + 1001);
+                while (!start) std::this_thread::yield();
+                while (!stop) {
+                    auto t0 = steady_clock::now();
+                    auto t = state.transaction();
+                    auto t1 = steady_clock::now();
+                    res.a.record(t1 - t0);
+
+                    mutate(t.cow(), cfg.shape, rng);
+
+                    auto t2 = steady_clock::now();
+                    t.commit();
+                    auto t3 = steady_clock::now();
+                    res.b.record(t3 - t2);
+                    ++res.ops;
+
+                    if (cfg.writeDelay) {
+                        std::this_thread::sleep_for(microseconds(cfg.writeDelay));
+                    }
+                }
+                writerResults[size_t(i)] = std::move(res);
+            });
+        }
+
+        auto begin = steady_clock::now();
+        start = true;
+        std::this_thread::sleep_for(milliseconds(cfg.ms));
+        stop = true;
+        for (auto& t : threads) {
+            t.join();
+        }
+        ret.seconds = duration<double>(steady_clock::now() - begin).count();
+
+        for (auto& r : readerResults) {
+            ret.detach.merge(r.a);
+            ret.release.merge(r.b);
+            ret.reads += r.ops;
+        }
+        for (auto& r : writerResults) {
+            ret.acquire.merge(r.a);
+            ret.commit.merge(r.b);
+            ret.writes += r.ops;
+        }
+    }
+
+    if (reclaimer) {
+        reclaimer->waitIdle();
+        ret.reclaim = reclaimer->metrics();
+    }
+    return ret;
+}
+
+void printHistogram(const char* name, const Histogram& h) {
+    std::printf("%-10s %12llu %10.0f %10llu %10llu %10llu %12llu\n", name,
+        (unsigned long long)h.count(), h.mean(),
+        (unsigned long long)h.percentile(50),
+        (unsigned long long)h.percentile(99),
+        (unsigned long long)h.percentile(99.9),
+        (unsigned long long)h.max());
+}
+
+void printDetails(const Config& cfg, const Result& r) {
+    std::printf("readers: %d, writers: %d, size: %zu, reads/s: %.0f, writes/s: %.0f\n",
+        cfg.readers, cfg.writers, cfg.size, double(r.reads) / r.seconds, double(r.writes) / r.seconds);
+    std::printf("%-10s %12s %10s %10s %10s %10s %12s\n", "ns", "count", "mean", "p50", "p99", "p999", "max");
+    printHistogram("detach", r.detach);
+    printHistogram("release", r.release);
+    printHistogram("acquire", r.acquire);
+    printHistogram("commit", r.commit);
+    if (cfg.reclaimer) {
+        std::printf("reclaimed objects: %llu, bytes: %llu, peak queue: %zu\n",
+            (unsigned long long)r.reclaim.reclaimedObjects,
+            (unsigned long long)r.reclaim.reclaimedBytes,
+            r.reclaim.peakQueueDepth);
+    }
+}
+
+void printScaling(Config cfg) {
+    std::printf("%8s %14s %14s %12s %12s %12s\n", "readers", "reads/s", "writes/s", "detach p99", "release p99", "commit p99");
+    auto maxReaders = cfg.readers;
+    for (int readers = 1; readers <= maxReaders; readers *= 2) {
+        cfg.readers = readers;
+        auto r = run(cfg);
+        std::printf("%8d %14.0f %14.0f %12llu %12llu %12llu\n", readers,
+            double(r.reads) / r.seconds, double(r.writes) / r.seconds,
+            (unsigned long long)r.detach.percentile(99),
+            (unsigned long long)r.release.percentile(99),
+            (unsigned long long)r.commit.percentile(99));
+    }
+}
+
+bool parse(Config& cfg, std::string_view arg) {
+    auto eq = arg.find('=');
+    if (eq == std::string_view::npos) return false;
+    auto key = arg.substr(0, eq);
+    auto value = std::string(arg.substr(eq + 1));
+    auto num = [&]() { return std::atoll(value.c_str()); };
+
+    if (key == "readers") cfg.readers = int(num());
+    else if (key == "writers") cfg.writers = int(num());
+    else if (key == "size") cfg.size = std::max(size_t(1), size_t(num()));
+    else if (key == "reads") cfg.reads = int(num());
+    else if (key == "hold") cfg.hold = size_t(num());
+    else if (key == "writeDelay") cfg.writeDelay = int(num());
+    else if (key == "reclaimer") cfg.reclaimer = num() != 0;
+    else if (key == "ms") cfg.ms = int(num());
+    else if (key == "scale") cfg.scale = num() != 0;
+    else if (key == "shape") {
+        if (value == "point") cfg.shape = Shape::Point;
+        else if (value == "bulk") cfg.shape = Shape::Bulk;
+        else if (value == "replace") cfg.shape = Shape::Replace;
+        else return false;
+    }
+    else return false;
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Config cfg;
+    for (int i = 1; i < argc; ++i) {
+        if (!parse(cfg, argv[i])) {
+            std::fprintf(stderr, "unknown argument: %s (see the top of b-SharedStateLoad.cpp)\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (cfg.scale) {
+        printScaling(cfg);
+    }
+    else {
+        printDetails(cfg, run(cfg));
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/StdVector.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <string_view>
+
+// measure the copy-on-write rebuilds of shared vectors
+// trivially copyable types go through the bulk copy path,
+// while NonTrivialInt is a baseline which is copied element by element
+
+namespace {
+
+struct Pod {
+    int32_t a;
+    float b;
+    int64_t c;
+};
+
+struct NonTrivialInt {
+    NonTrivialInt() = default;
+    NonTrivialInt(const NonTrivialInt& other) : v(other.v) {}
+    NonTrivialInt& operator=(const NonTrivialInt& other) { v = other.v; return *this; }
+    int v = 0;
+};
+
+template <typename T>
+using Vec = kuzco::StdVector<T>;
+
+volatile size_t sink;
+
+template <typename T, typename Op>
+void run(std::string_view opName, std::string_view typeName, size_t size, Op op) {
+    Vec<T> src;
+    src.resize(size);
+
+    const size_t iters = std::max(size_t(3), size_t(50'000'000) / size);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; ++i) {
+        auto copy = src; // shared, so op will do a CoW rebuild
+        op(copy);
+        sink = copy.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / double(iters);
+    auto gbps = double(size * sizeof(T)) / ns;
+    std::printf("%-10.*s %-14.*s %10zu %14.0f ns %8.2f GB/s\n",
+        int(opName.size()), opName.data(), int(typeName.size()), typeName.data(), size, ns, gbps);
+}
+
+template <typename T>
+void runAll(std::string_view typeName, size_t size) {
+    run<T>("push_back", typeName, size, [](Vec<T>& v) { v.push_back(T{}); });
+    run<T>("erase", typeName, size, [](Vec<T>& v) { v.erase(v.cbegin() + v.size() / 2); });
+    run<T>("reserve", typeName, size, [size](Vec<T>& v) { v.reserve(size * 2); });
+    run<T>("resize", typeName, size, [size](Vec<T>& v) { v.resize(size + 1); });
+}
+
+}
+
+int main() {
+    const size_t sizes[] = {1'000, 10'000, 100'000, 1'000'000, 10'000'000};
+    for (auto size : sizes) {
+        runAll<int>("int", size);
+        runAll<float>("float", size);
+        runAll<Pod>("Pod", size);
+        runAll<NonTrivialInt>("NonTrivialInt", size);
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -3,10 +3,28 @@
 //
 #pragma once
 #include "Node.hpp"
+#include "Reclaimer.hpp"
+#include "PinTracker.hpp"
+#include "VersionSignal.hpp"
 #include <itlib/atomic_shared_ptr_storage.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
 namespace kuzco {
 
+// each store increments a version
+// readers can poll the version with a single atomic load and only detach when it has changed
+//
+//     uint64_t v = 0;
+//     ...
+//     if (auto d = storage.detachIfNewer(v)) {
+//         // v is updated, use d
+//     }
+//
+// or block until a store with waitForVersion
 template <typename T>
 class AtomicDetachedStorage {
 public:
@@ -15,6 +33,7 @@ public:
     AtomicDetachedStorage() = default;
     explicit AtomicDetachedStorage(Detached<T> ptr)
         : m_storage(std::move(ptr)._as_shared_ptr_unsafe())
+        , m_version(1)
     {}
     explicit AtomicDetachedStorage(const Node<T>& node)
         : AtomicDetachedStorage(node.detach())
@@ -30,15 +49,83 @@ public:
         return load();
     }
 
+    // a snapshot tagged with the acquisition site if there is a pin tracker (see PinTracker.hpp)
+    Detached<T> detach(std::string_view site) const {
+        auto d = load();
+        if (auto tracker = m_pinTracker.load(std::memory_order_acquire)) {
+            d = tracker->tag(std::move(d), site);
+        }
+        return d;
+    }
+
     void store(Detached<T> ptr) {
+        if (m_reclaimer) {
+            ptr = m_reclaimer->wrap(std::move(ptr));
+        }
+        if (auto tracker = m_pinTracker.load(std::memory_order_relaxed)) {
+            ptr = tracker->track(std::move(ptr), version() + 1);
+        }
         m_storage.store(std::move(ptr)._as_shared_ptr_unsafe());
+        m_version.bump();
     }
     void store(const Node<T>& node) {
         store(node.detach());
     }
 
+    // number of stores (plus one if constructed with a value)
+    uint64_t version() const noexcept {
+        return m_version.version();
+    }
+
+    // if the version is newer than the provided one, update it and return the stored value
+    // otherwise return null (without touching the stored value)
+    // the returned value may be newer than the updated version (if a store happens concurrently)
+    Detached<T> detachIfNewer(uint64_t& version) const {
+        auto v = this->version();
+        if (v <= version) return {};
+        version = v;
+        return load();
+    }
+
+    // block until the version is newer than the provided one or the timeout expires
+    // return the current version
+    template <typename Rep, typename Period>
+    uint64_t waitForVersion(uint64_t version, std::chrono::duration<Rep, Period> timeout) const {
+        return m_version.waitFor(version, timeout);
+    }
+    uint64_t waitForVersion(uint64_t version) const {
+        return m_version.waitFor(version);
+    }
+
+    // snapshots which are stored after this is set are reclaimed by the reclaimer when dropped
+    // (see Reclaimer.hpp)
+    // null disables deferred reclamation
+    // not thread safe with store
+    // the reclaimer must outlive the calls to store
+    void setReclaimer(Reclaimer* reclaimer) noexcept {
+        m_reclaimer = reclaimer;
+    }
+    Reclaimer* reclaimer() const noexcept {
+        return m_reclaimer;
+    }
+
+    // snapshots which are stored after this is set are tracked by the tracker (see PinTracker.hpp)
+    // null disables tracking
+    // not thread safe with store
+    // the tracker must outlive the calls to store and detach
+    void setPinTracker(PinTracker* tracker) noexcept {
+        m_pinTracker.store(tracker, std::memory_order_release);
+    }
+    PinTracker* pinTracker() const noexcept {
+        return m_pinTracker.load(std::memory_order_acquire);
+    }
+
 private:
     AtomicStorage m_storage;
+    Reclaimer* m_reclaimer = nullptr;
+    std::atomic<PinTracker*> m_pinTracker = nullptr;
+
+    VersionSignal m_version;
 };
 
 } // namespace kuzco
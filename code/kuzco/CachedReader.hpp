@@ -0,0 +1,74 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <utility>
+#include <cstdint>
+
+namespace kuzco {
+
+// a reader handle which caches a snapshot of a versioned source (SharedState or AtomicDetachedStorage)
+// and only detaches a new one when the version of the source has advanced
+//
+// reading an unchanged state is a single atomic load, no refcounts are touched
+// (with detach() each read bumps the refcount of the root, a cache line contended by all readers)
+//
+// a handle is not thread safe. Have one per thread, for example:
+//
+//     thread_local CachedReader reader(state);
+//     auto& config = *reader;
+//
+// note that the cached snapshot is kept alive until the next read after a change (or release())
+// the source must outlive the handle
+template <typename Source>
+class CachedReader {
+public:
+    using Snapshot = decltype(std::declval<const Source&>().detach());
+
+    explicit CachedReader(const Source& source)
+        : m_source(&source)
+    {}
+
+    // the latest snapshot
+    // the reference is valid until the next call to a non-const function of the handle
+    const Snapshot& get() {
+        refresh();
+        return m_snapshot;
+    }
+
+    auto& operator*() { return *get(); }
+    auto operator->() { return get().get(); }
+
+    // detach a new snapshot if the source has changed
+    // return whether it has
+    bool refresh() {
+        auto d = m_source->detachIfNewer(m_version);
+        if (!d) return false;
+        m_snapshot = std::move(d);
+        return true;
+    }
+
+    // the cached snapshot without checking for a newer one
+    const Snapshot& cached() const noexcept {
+        return m_snapshot;
+    }
+
+    // the version of the cached snapshot
+    uint64_t version() const noexcept {
+        return m_version;
+    }
+
+    // drop the cached snapshot
+    // the next read detaches a new one
+    void release() noexcept {
+        m_snapshot = {};
+        m_version = 0;
+    }
+
+private:
+    const Source* m_source;
+    Snapshot m_snapshot;
+    uint64_t m_version = 0;
+};
+
+} // namespace kuzco
@@ -0,0 +1,99 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "DeepVisitor.hpp"
+
+#include <concepts>
+#include <iterator>
+#include <ranges>
+
+namespace kuzco {
+
+// Deep equality of states
+//
+// deepEqual(a, b) compares the values of two objects:
+// * nodes and snapshots which are the same object (pointer-identical) are equal without
+//   comparing their values, otherwise their values are compared
+// * types with fields<T> (see Fields.hpp) and no operator==: field by field
+// * ranges which contain any of the above: element by element
+// * everything else with operator==
+//
+// As unchanged subtrees of a snapshot are shared with the previous one, comparing two versions
+// only visits the parts which were copied.
+//
+// The operator== of a type takes priority over its fields. Note that the default operator== of
+// a type with nodes compares them by identity, so equal values in different nodes differ there.
+//
+// Comparing by fields ignores the members which are not described: two values which only differ
+// in such members are equal. Describe all members of types which are compared by fields (or give
+// them an operator==), especially if they are compared to suppress commits (see SharedState.hpp).
+
+namespace impl {
+template <typename T>
+constexpr bool needsDeepEqual() {
+    if constexpr (IsOptNode<T> || IsDetached<T>) return true;
+    else if constexpr (HasFields<T>) return !std::equality_comparable<T>;
+    else if constexpr (IsDeepRange<T>) return needsDeepEqual<std::ranges::range_value_t<const T>>();
+    else return false;
+}
+
+// recursive types (a node which contains nodes of its own type) are only checked up to this
+// depth of nested nodes, deeper ones are assumed to be comparable
+inline constexpr int DeepEqualityMaxNodeDepth = 8;
+
+template <typename T, int Depth = 0>
+constexpr bool deepEqualityComparable() {
+    if constexpr (IsOptNode<T> || IsDetached<T>) {
+        if constexpr (Depth >= DeepEqualityMaxNodeDepth) return true;
+        else return deepEqualityComparable<std::remove_cvref_t<decltype(deepValue(std::declval<const T&>()))>, Depth + 1>();
+    }
+    else if constexpr (HasFields<T> && !std::equality_comparable<T>) {
+        return std::apply([](const auto&... field) {
+            return (deepEqualityComparable<typename std::remove_cvref_t<decltype(field)>::value_type, Depth>() && ...);
+        }, fields<T>);
+    }
+    // the operator== of std containers is not constrained, so check the elements
+    else if constexpr (IsDeepRange<T>) return deepEqualityComparable<std::ranges::range_value_t<const T>, Depth>();
+    else return std::equality_comparable<T>;
+}
+} // namespace impl
+
+template <typename T>
+concept DeepEqualityComparable = impl::deepEqualityComparable<T>();
+
+template <DeepEqualityComparable T>
+constexpr bool deepEqual(const T& a, const T& b) {
+    using namespace impl;
+    if constexpr (IsOptNode<T> || IsDetached<T>) {
+        // Node hides its operator bool as it's never null
+        if constexpr (requires { static_cast<bool>(a); }) {
+            if (!a || !b) return !a && !b;
+        }
+        auto& va = deepValue(a);
+        auto& vb = deepValue(b);
+        if (&va == &vb) return true;
+        return deepEqual(va, vb);
+    }
+    else if constexpr (HasFields<T> && !std::equality_comparable<T>) {
+        return std::apply([&](const auto&... field) {
+            return (deepEqual(field.get(a), field.get(b)) && ...);
+        }, fields<T>);
+    }
+    else if constexpr (!needsDeepEqual<T>() && std::equality_comparable<T>) {
+        return a == b;
+    }
+    else {
+        auto ia = std::ranges::begin(a), ea = std::ranges::end(a);
+        auto ib = std::ranges::begin(b), eb = std::ranges::end(b);
+        if constexpr (std::ranges::sized_range<const T>) {
+            if (std::ranges::size(a) != std::ranges::size(b)) return false;
+        }
+        for (; ia != ea && ib != eb; ++ia, ++ib) {
+            if (!deepEqual(*ia, *ib)) return false;
+        }
+        return ia == ea && ib == eb;
+    }
+}
+
+} // namespace kuzco
@@ -0,0 +1,104 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Fields.hpp"
+#include "Node.hpp"
+
+#include <concepts>
+#include <ranges>
+#include <string_view>
+#include <type_traits>
+
+namespace kuzco {
+
+// Deep visiting of states
+//
+// visitDeep(obj, visitor) recurses through obj and everything reachable from it:
+// * nodes (OptNode, Node, Vector, NodeVector...) and snapshots (Detached): the value of non-null ones
+// * types with fields<T> (see Fields.hpp): each field in order
+// * ranges (std::vector, std::array...) except strings: each element
+// * everything else is a leaf
+//
+// All members of the visitor are optional and are detected at compile time:
+//
+//     struct Visitor {
+//         // before the value of a node (its address is the identity of the node)
+//         // return false to skip the subtree
+//         template <typename T> bool enterNode(const T& value);
+//         template <typename T> void leaveNode(const T& value);
+//
+//         // around the fields of described types
+//         void enterField(std::string_view name);
+//         void leaveField(std::string_view name);
+//
+//         // leaves (this can be a set of overloads)
+//         template <typename T> void value(const T& leaf);
+//     };
+//
+// Dispatch is fully static: there are no virtual calls and no allocations. Nodes are read with
+// r(), so reference counts are not touched and nothing is copied.
+
+namespace impl {
+template <typename T>
+std::true_type isDetached(const Detached<T>*);
+std::false_type isDetached(const void*);
+
+template <typename T>
+inline constexpr bool IsDetached = decltype(isDetached(std::declval<const T*>()))::value;
+
+// the value of a node or a snapshot
+template <typename T>
+const auto& deepValue(const T& n) {
+    if constexpr (IsDetached<T>) return *n;
+    else return n.r();
+}
+
+template <typename T>
+inline constexpr bool IsDeepRange = std::ranges::input_range<const T>
+    && !std::is_convertible_v<const T&, std::string_view>;
+
+template <typename V, typename T>
+constexpr void visitDeep(V& v, const T& obj) {
+    if constexpr (IsOptNode<T> || IsDetached<T>) {
+        // Node hides its operator bool as it's never null
+        if constexpr (requires { static_cast<bool>(obj); }) {
+            if (!obj) return;
+        }
+        auto& value = deepValue(obj);
+        if constexpr (requires { { v.enterNode(value) } -> std::convertible_to<bool>; }) {
+            if (!v.enterNode(value)) return;
+        }
+        visitDeep(v, value);
+        if constexpr (requires { v.leaveNode(value); }) {
+            v.leaveNode(value);
+        }
+    }
+    else if constexpr (HasFields<T>) {
+        forEachField<T>([&](const auto& field) {
+            if constexpr (requires { v.enterField(field.name); }) {
+                v.enterField(field.name);
+            }
+            visitDeep(v, field.get(obj));
+            if constexpr (requires { v.leaveField(field.name); }) {
+                v.leaveField(field.name);
+            }
+        });
+    }
+    else if constexpr (IsDeepRange<T>) {
+        for (auto& e : obj) {
+            visitDeep(v, e);
+        }
+    }
+    else if constexpr (requires { v.value(obj); }) {
+        v.value(obj);
+    }
+}
+} // namespace impl
+
+template <typename T, typename Visitor>
+constexpr void visitDeep(const T& obj, Visitor&& visitor) {
+    impl::visitDeep(visitor, obj);
+}
+
+} // namespace kuzco
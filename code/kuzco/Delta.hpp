@@ -0,0 +1,401 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Persist.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <stdexcept>
+
+namespace kuzco {
+
+// Deltas between snapshots
+//
+// encodeDelta(from, to) produces a compact binary delta which turns the snapshot `from` into `to`
+// and applyDelta(from, delta) applies it. The two calls are typically in different processes:
+// a leader encodes the deltas between its consecutive snapshots and the followers apply them to
+// their copies of the previous snapshot.
+//
+// Nodes are serialized with PersistTraits (see Persist.hpp). The delta of a node contains its
+// payload and its children, which are one of:
+// * a run of children of the node's base (the node in `from` at the same place), which are
+//   pointer-identical in `to`
+// * a new node, whose delta is relative to the corresponding child of the base
+// * a reference to a new node which appeared earlier in the delta
+// * null
+// Unchanged subtrees cost a few bytes regardless of their size. Inserting or erasing elements of
+// a vector of nodes (NodeVector, std::vector<Node<T>>) costs a copied run for the elements before
+// and after, and the new elements.
+// A changed node whose contents are equal to the base (for example modified and then restored)
+// is encoded as a reference to the base.
+//
+// The follower reuses its nodes for the unchanged parts, so the result of applyDelta shares them
+// with `from`. Only the changed nodes are allocated.
+// Children are referenced by their position in the base, so a delta must be applied to the
+// snapshot which it was encoded from (or to an equal one, such as the result of the previous
+// applyDelta of the follower). Truncated or corrupted deltas result in an exception, and so do
+// deltas whose references to nodes of the base (or to earlier nodes of the delta) resolve to nodes
+// of a different type than the expected one.
+
+struct DeltaStats {
+    size_t nodesEncoded = 0; // new nodes in the delta
+    size_t nodesReused = 0; // referenced nodes of the base snapshot
+    size_t bytes = 0;
+};
+
+namespace impl {
+struct DeltaFormat {
+    static constexpr char magic[4] = {'K', 'Z', 'D', '1'};
+
+    enum Op : uint8_t {
+        Null,
+        Copy, // start, count: a run of children of the base
+        New, // payload size, payload, children
+        Backref, // index of a new node in the delta
+    };
+
+    static void writeVarint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(char(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(char(v));
+    }
+
+    static uint64_t readVarint(std::string_view in, size_t& pos) {
+        uint64_t ret = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= in.size()) break;
+            auto b = uint8_t(in[pos++]);
+            ret |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) return ret;
+        }
+        throw std::runtime_error("kuzco::applyDelta: bad delta");
+    }
+};
+
+// the payload and the children of a node (the children are not serialized)
+struct DeltaNode {
+    struct Child {
+        std::shared_ptr<const void> obj; // null for null children
+        const PersistNodeType* type = nullptr;
+    };
+
+    std::string payload;
+    std::vector<Child> children;
+
+    class Collector final : public PersistNodeSink {
+    public:
+        std::vector<Child> children;
+        virtual NodeId persistNode(const std::shared_ptr<const void>& obj, const PersistNodeType& type) override {
+            children.push_back({obj, &type});
+            return {children.size(), 0};
+        }
+    };
+
+    static DeltaNode expand(const Child& c) {
+        DeltaNode ret;
+        if (!c.obj) return ret;
+        Collector col;
+        PersistWriter w(col);
+        c.type->save(c.obj.get(), w);
+        ret.payload = w.payload();
+        for (auto& id : w.children()) {
+            if (id) ret.children.push_back(std::move(col.children[id.a - 1]));
+            else ret.children.emplace_back();
+        }
+        return ret;
+    }
+
+    bool sameAs(const DeltaNode& other) const noexcept {
+        if (payload != other.payload || children.size() != other.children.size()) return false;
+        for (size_t i = 0; i < children.size(); ++i) {
+            if (children[i].obj != other.children[i].obj) return false;
+        }
+        return true;
+    }
+};
+
+class DeltaEncoder {
+    using Format = DeltaFormat;
+public:
+    std::string out;
+    DeltaStats stats;
+
+    // encode the children of a node relative to the children of its base
+    void encodeChildren(const std::vector<DeltaNode::Child>& base, const std::vector<DeltaNode::Child>& children) {
+        Format::writeVarint(out, children.size());
+
+        // index the base for moved children (small ones are searched)
+        std::unordered_map<const void*, size_t> baseIndex;
+        if (base.size() > 16) {
+            for (size_t i = 0; i < base.size(); ++i) {
+                if (base[i].obj) baseIndex.emplace(base[i].obj.get(), i);
+            }
+        }
+        auto find = [&](const void* obj, size_t cursor) -> size_t {
+            if (cursor < base.size() && base[cursor].obj.get() == obj) return cursor;
+            if (base.size() > 16) {
+                auto i = baseIndex.find(obj);
+                return i == baseIndex.end() ? base.size() : i->second;
+            }
+            for (size_t i = 0; i < base.size(); ++i) {
+                if (base[i].obj.get() == obj) return i;
+            }
+            return base.size();
+        };
+
+        size_t cursor = 0; // the corresponding child of the base
+        for (size_t i = 0; i < children.size(); ) {
+            auto& c = children[i];
+            if (!c.obj) {
+                out.push_back(Format::Null);
+                ++i, ++cursor;
+                continue;
+            }
+
+            if (auto start = find(c.obj.get(), cursor); start != base.size()) {
+                size_t count = 1;
+                while (i + count < children.size() && start + count < base.size()
+                    && children[i + count].obj && children[i + count].obj == base[start + count].obj)
+                {
+                    ++count;
+                }
+                copy(start, count);
+                i += count;
+                cursor = start + count;
+                continue;
+            }
+
+            if (auto e = m_encoded.find(c.obj.get()); e != m_encoded.end()) {
+                out.push_back(Format::Backref);
+                Format::writeVarint(out, e->second);
+                ++i, ++cursor;
+                continue;
+            }
+
+            // only a base of the same type can replace the node
+            bool sameType = cursor < base.size() && base[cursor].obj && base[cursor].type->tag == c.type->tag;
+            DeltaNode b;
+            if (cursor < base.size()) b = DeltaNode::expand(base[cursor]);
+            auto n = DeltaNode::expand(c);
+            if (sameType && n.sameAs(b)) {
+                copy(cursor, 1);
+            }
+            else {
+                encodeNode(c, n, b);
+            }
+            ++i, ++cursor;
+        }
+    }
+
+    void encodeNode(const DeltaNode::Child& c, const DeltaNode& n, const DeltaNode& base) {
+        out.push_back(Format::New);
+        Format::writeVarint(out, n.payload.size());
+        out.append(n.payload);
+        m_encoded.emplace(c.obj.get(), m_encoded.size());
+        ++stats.nodesEncoded;
+        encodeChildren(base.children, n.children);
+    }
+
+private:
+    void copy(size_t start, size_t count) {
+        out.push_back(Format::Copy);
+        Format::writeVarint(out, start);
+        Format::writeVarint(out, count);
+        stats.nodesReused += count;
+    }
+
+    // new node -> index in the delta
+    // keeps nodes which are shared in `to` shared after applying
+    std::unordered_map<const void*, uint64_t> m_encoded;
+};
+
+class DeltaDecoder final : public PersistNodeSource {
+    using Format = DeltaFormat;
+public:
+    DeltaDecoder(std::string_view in, size_t pos) : m_in(in), m_pos(pos) {}
+
+    bool atEnd() const noexcept { return m_pos == m_in.size(); }
+
+    // parse the children of a node, and return the index of the first one in m_refs
+    size_t parseChildren(const std::vector<DeltaNode::Child>& base, size_t& num) {
+        num = size_t(Format::readVarint(m_in, m_pos));
+        // each child takes at least one byte, except for copied runs
+        if (num > m_in.size() - m_pos + base.size()) throw std::runtime_error("kuzco::applyDelta: bad delta");
+
+        auto first = m_refs.size();
+        m_refs.resize(first + num);
+
+        size_t cursor = 0;
+        for (size_t i = 0; i < num; ) {
+            if (m_pos >= m_in.size()) throw std::runtime_error("kuzco::applyDelta: bad delta");
+            auto op = uint8_t(m_in[m_pos++]);
+            if (op == Format::Null) {
+                ++i, ++cursor;
+            }
+            else if (op == Format::Copy) {
+                auto start = Format::readVarint(m_in, m_pos);
+                auto count = Format::readVarint(m_in, m_pos);
+                if (start > base.size() || count > base.size() - start || count > num - i || !count) {
+                    throw std::runtime_error("kuzco::applyDelta: bad delta");
+                }
+                for (size_t k = 0; k < count; ++k) {
+                    auto& b = base[size_t(start + k)];
+                    m_refs[first + i + k].old = b.obj;
+                    m_refs[first + i + k].type = b.type;
+                }
+                i += size_t(count);
+                cursor = size_t(start + count);
+            }
+            else if (op == Format::Backref) {
+                auto index = Format::readVarint(m_in, m_pos);
+                if (index >= m_nodes.size()) throw std::runtime_error("kuzco::applyDelta: bad delta");
+                m_refs[first + i].node = size_t(index) + 1;
+                ++i, ++cursor;
+            }
+            else if (op == Format::New) {
+                DeltaNode b;
+                if (cursor < base.size()) b = DeltaNode::expand(base[cursor]);
+                m_refs[first + i].node = parseNode(b) + 1;
+                ++i, ++cursor;
+            }
+            else {
+                throw std::runtime_error("kuzco::applyDelta: bad delta");
+            }
+        }
+        return first;
+    }
+
+    // returns the index of the node in m_nodes
+    size_t parseNode(const DeltaNode& base) {
+        auto size = Format::readVarint(m_in, m_pos);
+        if (size > m_in.size() - m_pos) throw std::runtime_error("kuzco::applyDelta: bad delta");
+
+        auto index = m_nodes.size();
+        m_nodes.emplace_back();
+        m_nodes[index].payload = m_in.substr(m_pos, size_t(size));
+        m_pos += size_t(size);
+
+        size_t num;
+        auto first = parseChildren(base.children, num);
+        m_nodes[index].firstChild = first;
+        m_nodes[index].numChildren = num;
+        return index;
+    }
+
+    // resolve a parsed child
+    // the type of the node is checked against the expected one
+    std::shared_ptr<void> resolve(size_t ref, const PersistNodeType& type) {
+        auto& r = m_refs[ref];
+        if (r.old) {
+            if (r.type->tag != type.tag) throw std::runtime_error("kuzco::applyDelta: delta doesn't match the type");
+            // the base snapshot is immutable and the result is a snapshot, too
+            return std::const_pointer_cast<void>(r.old);
+        }
+        if (!r.node) return {};
+
+        auto& n = m_nodes[r.node - 1];
+        if (n.obj) {
+            // a backref
+            if (n.type->tag != type.tag) throw std::runtime_error("kuzco::applyDelta: delta doesn't match the type");
+            return n.obj;
+        }
+        // only possible with a corrupted backref
+        if (n.resolving) throw std::runtime_error("kuzco::applyDelta: bad delta");
+        n.resolving = true;
+
+        std::vector<NodeId> children(n.numChildren);
+        for (size_t i = 0; i < n.numChildren; ++i) {
+            auto& c = m_refs[n.firstChild + i];
+            if (c.old || c.node) children[i].a = n.firstChild + i + 1;
+        }
+        PersistReader r2(*this, std::move(children), n.payload);
+        n.obj = type.load(r2);
+        n.type = &type;
+        if (r2.remaining() || r2.remainingNodes()) throw std::runtime_error("kuzco::applyDelta: delta doesn't match the type");
+        return n.obj;
+    }
+
+    virtual std::shared_ptr<void> loadNode(const NodeId& id, const PersistNodeType& type) override {
+        return resolve(size_t(id.a - 1), type);
+    }
+
+private:
+    std::string_view m_in;
+    size_t m_pos;
+
+    struct Ref {
+        std::shared_ptr<const void> old;
+        const PersistNodeType* type = nullptr; // of old
+        size_t node = 0; // index in m_nodes + 1
+    };
+    std::vector<Ref> m_refs;
+
+    struct ParsedNode {
+        std::string_view payload;
+        size_t firstChild = 0; // in m_refs
+        size_t numChildren = 0;
+        std::shared_ptr<void> obj;
+        const PersistNodeType* type = nullptr; // of obj
+        bool resolving = false;
+    };
+    std::vector<ParsedNode> m_nodes;
+};
+} // namespace impl
+
+// encode the delta from the snapshot `from` (can be null) to `to` (can be null)
+template <typename T>
+std::string encodeDelta(const Detached<T>& from, const Detached<T>& to, DeltaStats* stats = nullptr) {
+    using Format = impl::DeltaFormat;
+    impl::DeltaEncoder e;
+    e.out.append(Format::magic, 4);
+
+    // the root is the only child of a virtual node
+    std::vector<impl::DeltaNode::Child> base, root;
+    if (from) base.push_back({from._as_shared_ptr_unsafe(), &impl::persistNodeType<T>});
+    root.push_back({to._as_shared_ptr_unsafe(), &impl::persistNodeType<T>});
+    e.encodeChildren(base, root);
+
+    e.stats.bytes = e.out.size();
+    if (stats) *stats = e.stats;
+    return std::move(e.out);
+}
+
+template <typename T>
+std::string encodeDelta(const OptNode<T>& from, const OptNode<T>& to, DeltaStats* stats = nullptr) {
+    return encodeDelta(from.detach(), to.detach(), stats);
+}
+
+// apply a delta to the snapshot it was encoded from
+// the result shares the unchanged nodes with it
+template <typename T>
+OptNode<T> applyDelta(const Detached<T>& from, std::string_view delta) {
+    using Format = impl::DeltaFormat;
+    if (delta.size() < 4 || delta.substr(0, 4) != std::string_view(Format::magic, 4)) {
+        throw std::runtime_error("kuzco::applyDelta: bad delta");
+    }
+
+    impl::DeltaDecoder d(delta, 4);
+    std::vector<impl::DeltaNode::Child> base;
+    if (from) base.push_back({from._as_shared_ptr_unsafe(), &impl::persistNodeType<T>});
+    size_t num;
+    auto ref = d.parseChildren(base, num);
+    if (num != 1 || !d.atEnd()) throw std::runtime_error("kuzco::applyDelta: bad delta");
+
+    auto obj = d.resolve(ref, impl::persistNodeType<T>);
+    if (!obj) return {};
+    return impl::LoadedNode<T>(std::move(obj));
+}
+
+template <typename T>
+OptNode<T> applyDelta(const OptNode<T>& from, std::string_view delta) {
+    return applyDelta(from.detach(), delta);
+}
+
+} // namespace kuzco
@@ -0,0 +1,78 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace kuzco {
+
+// Field descriptions
+//
+// fields<T> describes the data members of a type, so that generic operations over states
+// (visiting, comparing, hashing, dumping...) don't need to be written for each type.
+// Describe a type by specializing fields<T> with a tuple of its fields:
+//
+//     template <>
+//     inline constexpr auto kuzco::fields<Employee> = kuzco::makeFields(
+//         kuzco::field("data", &Employee::data),
+//         kuzco::field("department", &Employee::department),
+//         kuzco::field("salary", &Employee::salary)
+//     );
+//
+// The descriptions are constexpr and the operations over them are fully static.
+// Members which are not described are ignored by the generic operations. This includes deepEqual,
+// which compares types without operator== by their fields (see DeepEqual.hpp).
+
+template <typename Class, typename T>
+struct Field {
+    using class_type = Class;
+    using value_type = T;
+
+    std::string_view name;
+    T Class::* member;
+
+    constexpr const T& get(const Class& obj) const noexcept { return obj.*member; }
+    constexpr T& get(Class& obj) const noexcept { return obj.*member; }
+};
+
+template <typename Class, typename T>
+constexpr Field<Class, T> field(std::string_view name, T Class::* member) noexcept {
+    return {name, member};
+}
+
+template <typename... Fields>
+constexpr std::tuple<Fields...> makeFields(Fields... f) noexcept {
+    return {f...};
+}
+
+// not described
+template <typename T>
+inline constexpr std::nullptr_t fields = nullptr;
+
+template <typename T>
+inline constexpr bool HasFields = !std::is_same_v<std::remove_cv_t<decltype(fields<T>)>, std::nullptr_t>;
+
+template <typename T>
+inline constexpr size_t numFields = [] {
+    if constexpr (HasFields<T>) return std::tuple_size_v<std::remove_cv_t<decltype(fields<T>)>>;
+    else return size_t(0);
+}();
+
+// call f(field) for each field of T
+template <typename T, typename F>
+constexpr void forEachField(F&& f) {
+    static_assert(HasFields<T>, "kuzco::fields is not specialized for this type");
+    std::apply([&](const auto&... field) { (f(field), ...); }, fields<T>);
+}
+
+// call f(name, value) for each field of obj
+template <typename T, typename F>
+constexpr void forEachField(T& obj, F&& f) {
+    forEachField<std::remove_const_t<T>>([&](const auto& field) { f(field.name, field.get(obj)); });
+}
+
+} // namespace kuzco
@@ -0,0 +1,147 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <mutex>
+#include <condition_variable>
+#include <coroutine>
+
+namespace kuzco {
+
+// a mutex which serves its waiters in FIFO order
+// it can be locked synchronously (blocking the thread) or asynchronously by a coroutine:
+//
+//     co_await mutex.lockAsync(executor);
+//     // locked here
+//
+// when the mutex is unlocked, the ownership is handed off directly to the first waiter
+// coroutine waiters are resumed by posting them to the executor they provided
+// an executor is any object with post(callable)
+//
+// a coroutine which is suspended on lockAsync must not be destroyed before it's resumed
+class FifoMutex {
+    struct Waiter {
+        Waiter* next = nullptr;
+        bool granted = false;
+
+        // set for synchronous waiters
+        std::condition_variable* cv = nullptr;
+
+        // set for asynchronous waiters
+        // called after the lock has been granted
+        void (*resume)(Waiter*) = nullptr;
+    };
+public:
+    FifoMutex() = default;
+
+    FifoMutex(const FifoMutex&) = delete;
+    FifoMutex& operator=(const FifoMutex&) = delete;
+
+    void lock() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_locked) {
+            m_locked = true;
+            return;
+        }
+
+        std::condition_variable cv;
+        Waiter w;
+        w.cv = &cv;
+        enqueue(w);
+        cv.wait(lock, [&]() { return w.granted; });
+    }
+
+    bool try_lock() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_locked) return false;
+        m_locked = true;
+        return true;
+    }
+
+    void unlock() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto w = m_head;
+        if (!w) {
+            m_locked = false;
+            return;
+        }
+
+        m_head = w->next;
+        if (!m_head) m_tail = nullptr;
+
+        // hand off the ownership: m_locked stays true
+        w->granted = true;
+
+        if (w->cv) {
+            // notify while locked, as the waiter (and its cv) may be gone as soon as we unlock
+            w->cv->notify_one();
+            return;
+        }
+
+        lock.unlock();
+        w->resume(w);
+    }
+
+    template <typename Executor>
+    class LockAwaiter : private Waiter {
+    public:
+        LockAwaiter(FifoMutex& mutex, Executor& executor)
+            : m_mutex(mutex)
+            , m_executor(executor)
+        {}
+
+        bool await_ready() {
+            return m_mutex.try_lock();
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            m_handle = h;
+            this->resume = [](Waiter* w) {
+                auto self = static_cast<LockAwaiter*>(w);
+                // don't touch self after post, as the coroutine may have already been resumed
+                auto& executor = self->m_executor;
+                executor.post([h = self->m_handle]() { h.resume(); });
+            };
+
+            std::lock_guard<std::mutex> lock(m_mutex.m_mutex);
+            if (!m_mutex.m_locked) {
+                // unlocked in the meantime
+                m_mutex.m_locked = true;
+                return false;
+            }
+            m_mutex.enqueue(*this);
+            return true;
+        }
+
+        void await_resume() noexcept {}
+
+    private:
+        FifoMutex& m_mutex;
+        Executor& m_executor;
+        std::coroutine_handle<> m_handle;
+    };
+
+    template <typename Executor>
+    LockAwaiter<Executor> lockAsync(Executor& executor) {
+        return LockAwaiter<Executor>(*this, executor);
+    }
+
+private:
+    // call while m_mutex is locked
+    void enqueue(Waiter& w) {
+        if (m_tail) {
+            m_tail->next = &w;
+        }
+        else {
+            m_head = &w;
+        }
+        m_tail = &w;
+    }
+
+    std::mutex m_mutex;
+    bool m_locked = false;
+    Waiter* m_head = nullptr;
+    Waiter* m_tail = nullptr;
+};
+
+} // namespace kuzco
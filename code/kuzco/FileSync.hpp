@@ -0,0 +1,77 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <cstdio>
+#include <stdexcept>
+#include <filesystem>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+namespace kuzco::impl {
+
+// durable file writes for the journal and the snapshot store
+
+inline int fileDescriptor(std::FILE* f) {
+#if defined(_WIN32)
+    return ::_fileno(f);
+#else
+    return ::fileno(f);
+#endif
+}
+
+inline void syncDescriptor(int fd) {
+#if defined(_WIN32)
+    auto ret = ::_commit(fd);
+#else
+    auto ret = ::fsync(fd);
+#endif
+    if (ret != 0) throw std::runtime_error("kuzco: fsync failed");
+}
+
+// a descriptor of the same file which stays valid if the original one is closed
+inline int duplicateDescriptor(int fd) {
+#if defined(_WIN32)
+    auto ret = ::_dup(fd);
+#else
+    auto ret = ::dup(fd);
+#endif
+    if (ret < 0) throw std::runtime_error("kuzco: dup failed");
+    return ret;
+}
+
+inline void closeDescriptor(int fd) {
+#if defined(_WIN32)
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+// flush the buffers of the file to the OS and then to the storage device
+inline void flushAndSync(std::FILE* f) {
+    if (std::fflush(f) != 0) throw std::runtime_error("kuzco: flush failed");
+    syncDescriptor(fileDescriptor(f));
+}
+
+// make the creation, removal, or renaming of files in the directory durable
+// (on Windows the directory entries can't be synced and this does nothing)
+inline void syncDirectory(const std::filesystem::path& dir) {
+#if !defined(_WIN32)
+    auto path = dir.empty() ? std::filesystem::path(".") : dir;
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) throw std::runtime_error("kuzco: can't open directory " + path.string());
+    auto ret = ::fsync(fd);
+    ::close(fd);
+    if (ret != 0) throw std::runtime_error("kuzco: fsync failed");
+#else
+    (void)dir;
+#endif
+}
+
+} // namespace kuzco::impl
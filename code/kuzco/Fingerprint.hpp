@@ -3,6 +3,8 @@
 //
 #pragma once
 #include <itlib/ref_ptr.hpp>
+#include <cstdint>
+#include <type_traits>
 
 namespace kuzco {
 
@@ -42,6 +44,8 @@ namespace kuzco {
 // For cases when you're not sure that the use is safe (or when you know it's not) for now you must
 // use alternative mechanisms for fingerprinting like revisions or hashes, or just keep a strong ref
 // (Detached) and sacrifice the resources.
+//
+// Another alternative is generation stamps (see below).
 
 class Fingerprint {
     std::weak_ptr<const void> m_fp;
@@ -108,4 +112,115 @@ bool operator!=(const Fingerprint& a, const itlib::ref_ptr<T>& b) noexcept {
     return !a.sameAs(b);
 }
 
+// Generation stamps
+//
+// A type which derives from GenerationStamp gets a counter which nodes bump on every non-const
+// access (get(), operator->, cow(), assignment). VersionedFingerprint pairs a fingerprint with the
+// generation at the time it was taken, so it also notices when a unique node is changed in place.
+// Thus caches can safely key on VersionedFingerprint without keeping strong refs or forcing CoW.
+//
+// The generation is only bumped when the node is unique (possibly after copying), so it is never
+// modified while a detached state is being read concurrently.
+//
+// Changes through a reference obtained before the fingerprint was taken are not noticed, so don't
+// hold mutable references across fingerprints (or call bumpGeneration manually after such changes).
+// The stamp is per value type, so it is not available for containers like Vector whose wrapped type
+// is a std container.
+
+class GenerationStamp {
+public:
+    GenerationStamp() noexcept = default;
+
+    // a copy is a different object with its own generation
+    // assignment keeps the generation (and the node bumps it)
+    GenerationStamp(const GenerationStamp&) noexcept {}
+    GenerationStamp& operator=(const GenerationStamp&) noexcept { return *this; }
+
+    // the generation is not a part of the value
+    // (so stamped types can have a defaulted operator==)
+    bool operator==(const GenerationStamp&) const noexcept { return true; }
+
+    uint64_t generation() const noexcept { return m_generation; }
+    void bumpGeneration() noexcept { ++m_generation; }
+private:
+    uint64_t m_generation = 0;
+};
+
+template <typename T>
+inline constexpr bool HasGenerationStamp = std::is_base_of_v<GenerationStamp, T>;
+
+class VersionedFingerprint {
+    Fingerprint m_fp;
+    uint64_t m_generation = 0;
+public:
+    VersionedFingerprint() noexcept = default;
+
+    VersionedFingerprint(const VersionedFingerprint&) = default;
+    VersionedFingerprint& operator=(const VersionedFingerprint&) = default;
+    VersionedFingerprint(VersionedFingerprint&&) noexcept = default;
+    VersionedFingerprint& operator=(VersionedFingerprint&&) noexcept = default;
+
+    template <typename U>
+        requires HasGenerationStamp<U>
+    VersionedFingerprint(const itlib::ref_ptr<U>& ptr) noexcept
+        : m_fp(ptr)
+        , m_generation(ptr ? ptr->generation() : 0)
+    {}
+    template <typename U>
+        requires HasGenerationStamp<U>
+    VersionedFingerprint& operator=(const itlib::ref_ptr<U>& ptr) noexcept {
+        m_fp = ptr;
+        m_generation = ptr ? ptr->generation() : 0;
+        return *this;
+    }
+
+    explicit operator bool() const noexcept {
+        return !!m_fp;
+    }
+
+    void reset() noexcept {
+        m_fp.reset();
+        m_generation = 0;
+    }
+
+    const Fingerprint& fingerprint() const noexcept { return m_fp; }
+    uint64_t generation() const noexcept { return m_generation; }
+
+    bool sameAs(const VersionedFingerprint& other) const noexcept {
+        return m_fp.sameAs(other.m_fp) && m_generation == other.m_generation;
+    }
+
+    // the identity is checked first, so the generation is only read from the object it was taken from
+    template <typename U>
+        requires HasGenerationStamp<U>
+    bool sameAs(const itlib::ref_ptr<U>& ptr) const noexcept {
+        if (!m_fp.sameAs(ptr)) return false;
+        return !ptr || ptr->generation() == m_generation;
+    }
+
+    bool operator==(const VersionedFingerprint& other) const noexcept {
+        return sameAs(other);
+    }
+    bool operator!=(const VersionedFingerprint& other) const noexcept {
+        return !sameAs(other);
+    }
+};
+
+template <typename T>
+bool operator==(const itlib::ref_ptr<T>& a, const VersionedFingerprint& b) noexcept {
+    return b.sameAs(a);
+}
+template <typename T>
+bool operator!=(const itlib::ref_ptr<T>& a, const VersionedFingerprint& b) noexcept {
+    return !b.sameAs(a);
+}
+template <typename T>
+bool operator==(const VersionedFingerprint& a, const itlib::ref_ptr<T>& b) noexcept {
+    return a.sameAs(b);
+}
+template <typename T>
+bool operator!=(const VersionedFingerprint& a, const itlib::ref_ptr<T>& b) noexcept {
+    return !a.sameAs(b);
+}
+
 } // namespace kuzco
@@ -0,0 +1,64 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <type_traits>
+#include <utility>
+
+namespace kuzco {
+
+// a node-like wrapper which stores its value inline
+// for small trivially copyable types a heap allocation and a control block (not to mention the
+// pointer chase on every read) are more expensive than simply copying the value
+// so this has the interface of Node, but value semantics: copies are always deep (and cheap)
+// thus there is no identity, no fingerprints, and detach() returns a copy
+template <typename T>
+class InlineNode {
+public:
+    static_assert(std::is_trivially_copyable_v<T>, "InlineNode is only for trivially copyable types. Use Node instead");
+    // a cache line
+    // bigger values are likely cheaper to share than to copy
+    static_assert(sizeof(T) <= 64, "InlineNode is only for small types. Use Node instead");
+
+    template <typename... Args, typename = decltype(T(std::declval<Args>()...))>
+    InlineNode(Args&&... args)
+        : m_value(std::forward<Args>(args)...)
+    {}
+
+    InlineNode(const InlineNode&) = default;
+    InlineNode& operator=(const InlineNode&) = default;
+    InlineNode(InlineNode&&) noexcept = default;
+    InlineNode& operator=(InlineNode&&) noexcept = default;
+
+    const T* get() const noexcept { return &m_value; }
+    const T* operator->() const noexcept { return get(); }
+    const T& operator*() const noexcept { return m_value; }
+
+    const T& r() const noexcept { return m_value; }
+
+    template <typename U, std::enable_if_t<std::is_assignable_v<T&, U>, int> = 0>
+    InlineNode& operator=(U&& u) {
+        m_value = std::forward<U>(u);
+        return *this;
+    }
+
+    // an inline node is always unique
+    // provided for compatibility with generic code which works with nodes
+    bool unique() const noexcept { return true; }
+
+    // no copy is ever needed on write
+    T* get() noexcept { return &m_value; }
+    T* operator->() noexcept { return get(); }
+    T& cow() noexcept { return m_value; }
+
+    // as with Node, operator* is deliberately not provided for non-const access
+
+    // there is nothing to share, so this is a copy
+    T detach() const noexcept { return m_value; }
+
+    bool operator==(const InlineNode& other) const = default;
+private:
+    T m_value;
+};
+
+} // namespace kuzco
@@ -0,0 +1,573 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "FileSync.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <exception>
+
+namespace kuzco {
+
+// A write-ahead log of operations for durable states
+//
+// Instead of saving the entire state on every change, each commit appends a record which
+// describes the operation (serialized by the user) to an append-only file. On startup the
+// records are replayed on top of the last saved snapshot. Saving a snapshot (checkpoint) drops
+// the records which it contains.
+//
+// Records have log sequence numbers (lsn) which increase monotonically, including across
+// checkpoints and restarts. A snapshot should be saved with the lsn of the last record it
+// contains, so that replay can skip the records which are already in it:
+//
+//     auto [snapshot, lsn] = loadSnapshot();
+//     SharedState<State> state(snapshot);
+//     Journal::replay(path, [&](std::string_view rec) {
+//         auto t = state.transaction();
+//         apply(t, rec);
+//     }, lsn);
+//     Journal journal(path);
+//     state.setJournal(&journal);
+//
+// The sync policy determines when records are flushed to the storage device (fsync):
+// * None: never, records are only handed to the OS (they survive a crash of the process, but
+//   not of the system). In this mode "durable" (durableLsn, waitDurable) means handed to the OS.
+// * EveryCommit: each append waits for its own fsync
+// * Batched: a background thread fsyncs groups of records when the oldest unsynced one is
+//   maxDelay old or when there are maxBatchBytes unsynced bytes. Appends don't wait. Use
+//   waitDurable to wait (preferably after the transaction lock is released).
+//
+// A torn record at the end of the file (from a crash during a write) is discarded
+//
+// If an append fails, the part of its record which was written is truncated, so the transaction
+// which appended it can be aborted safely.
+// The journal is failed if a sync fails (sync, the background one of batched sync, or the one of
+// an append with EveryCommit), if the truncation of a failed append fails, or if a checkpoint fails
+// after the journal file was closed and it can't be reopened. Appends and waits of a failed
+// journal throw.
+//
+// Records are limited to 4 GiB - 1 (bigger ones throw std::length_error before anything is written)
+
+enum class JournalSync {
+    None,
+    EveryCommit,
+    Batched,
+};
+
+struct JournalConfig {
+    JournalSync sync = JournalSync::Batched;
+
+    // batched sync only
+    std::chrono::microseconds maxDelay = std::chrono::milliseconds(2);
+    size_t maxBatchBytes = 1024 * 1024;
+};
+
+struct JournalMetrics {
+    uint64_t records = 0;
+    uint64_t bytes = 0; // including record headers
+    uint64_t syncs = 0;
+
+    // time spent in append: the latency overhead of commits
+    std::chrono::nanoseconds appendTime = {};
+    std::chrono::nanoseconds maxAppendTime = {};
+
+    // time spent in fsync (in the background for batched sync)
+    std::chrono::nanoseconds syncTime = {};
+};
+
+namespace impl {
+struct JournalFormat {
+    // file header: magic, padding, and the lsn of the last checkpoint
+    static constexpr char magic[4] = {'K', 'Z', 'J', '1'};
+    static constexpr size_t fileHeaderSize = 16;
+
+    // record header: lsn, data size, checksum of the data
+    struct RecordHeader {
+        uint64_t lsn;
+        uint32_t size;
+        uint32_t checksum;
+    };
+    static_assert(sizeof(RecordHeader) == 16);
+
+    static constexpr uint64_t maxRecordSize = ~uint32_t(0);
+
+    // fnv-1a seeded with the lsn
+    static uint32_t checksum(uint64_t lsn, std::string_view data) noexcept {
+        uint32_t h = 2166136261u ^ uint32_t(lsn) ^ uint32_t(lsn >> 32);
+        for (auto c : data) {
+            h ^= uint8_t(c);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    static void writeFileHeader(std::FILE* f, uint64_t baseLsn) {
+        char buf[fileHeaderSize] = {};
+        std::memcpy(buf, magic, 4);
+        std::memcpy(buf + 8, &baseLsn, 8);
+        if (std::fwrite(buf, 1, fileHeaderSize, f) != fileHeaderSize) {
+            throw std::runtime_error("kuzco::Journal: write failed");
+        }
+    }
+
+    // sequential reader of the valid records of a file
+    class Reader {
+    public:
+        explicit Reader(const std::filesystem::path& path)
+            : m_file(std::fopen(path.string().c_str(), "rb"))
+        {
+            if (!m_file) return;
+            char buf[fileHeaderSize];
+            if (std::fread(buf, 1, fileHeaderSize, m_file) != fileHeaderSize) {
+                // an empty file (or a crash while creating it)
+                return;
+            }
+            if (std::memcmp(buf, magic, 4) != 0) {
+                std::fclose(m_file);
+                throw std::runtime_error("kuzco::Journal: not a journal file: " + path.string());
+            }
+            std::memcpy(&m_lastLsn, buf + 8, 8);
+            m_validEnd = fileHeaderSize;
+        }
+
+        ~Reader() {
+            if (m_file) std::fclose(m_file);
+        }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // false on the end of the file or on a torn or corrupted record
+        bool next() {
+            if (!m_file) return false;
+            RecordHeader h;
+            if (std::fread(&h, sizeof(h), 1, m_file) != 1) return false;
+            if (h.lsn <= m_lastLsn) return false;
+            m_data.resize(h.size);
+            if (h.size && std::fread(m_data.data(), 1, h.size, m_file) != h.size) return false;
+            if (JournalFormat::checksum(h.lsn, m_data) != h.checksum) return false;
+            m_lastLsn = h.lsn;
+            m_validEnd += sizeof(RecordHeader) + h.size;
+            return true;
+        }
+
+        uint64_t lsn() const noexcept { return m_lastLsn; }
+        std::string_view data() const noexcept { return m_data; }
+
+        // size of the valid part of the file (zero if it has no header)
+        uint64_t validEnd() const noexcept { return m_validEnd; }
+
+    private:
+        std::FILE* m_file;
+        uint64_t m_lastLsn = 0;
+        uint64_t m_validEnd = 0;
+        std::string m_data;
+    };
+};
+} // namespace impl
+
+class Journal {
+    using Format = impl::JournalFormat;
+    using clock = std::chrono::steady_clock;
+public:
+    // open or create the journal file
+    // records are appended after the last valid one (a torn tail is truncated)
+    explicit Journal(std::filesystem::path path, JournalConfig config = {})
+        : m_path(std::move(path))
+        , m_config(config)
+    {
+        uint64_t validEnd = 0;
+        if (std::filesystem::exists(m_path)) {
+            Format::Reader reader(m_path);
+            while (reader.next());
+            m_lastLsn = reader.lsn();
+            validEnd = reader.validEnd();
+        }
+
+        if (validEnd) {
+            std::filesystem::resize_file(m_path, validEnd);
+            open("ab");
+            m_fileEnd = validEnd;
+        }
+        else {
+            open("wb");
+            Format::writeFileHeader(m_file, 0);
+            impl::flushAndSync(m_file);
+            impl::syncDirectory(m_path.parent_path());
+            m_fileEnd = Format::fileHeaderSize;
+        }
+        m_durableLsn = m_lastLsn;
+
+        if (m_config.sync == JournalSync::Batched) {
+            m_syncThread = std::thread([this]() { syncLoop(); });
+        }
+    }
+
+    // syncs all appended records
+    ~Journal() {
+        if (m_syncThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopped = true;
+            }
+            m_cv.notify_all();
+            m_syncThread.join();
+        }
+        try {
+            sync();
+        }
+        catch (...) {
+            // nothing sensible to do in a destructor
+        }
+        if (m_file) std::fclose(m_file);
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    const std::filesystem::path& path() const noexcept { return m_path; }
+    const JournalConfig& config() const noexcept { return m_config; }
+
+    // append a record and return its lsn
+    uint64_t append(std::string_view record) {
+        auto start = clock::now();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        checkFile();
+        if (record.size() > Format::maxRecordSize) {
+            throw std::length_error("kuzco::Journal: record too big");
+        }
+
+        Format::RecordHeader h;
+        h.lsn = m_lastLsn + 1;
+        h.size = uint32_t(record.size());
+        h.checksum = Format::checksum(h.lsn, record);
+        std::chrono::nanoseconds syncTime = {};
+        bool syncing = false;
+        try {
+            if (std::fwrite(&h, sizeof(h), 1, m_file) != 1
+                || (!record.empty() && std::fwrite(record.data(), 1, record.size(), m_file) != record.size())
+            ) {
+                throw std::runtime_error("kuzco::Journal: write failed");
+            }
+            if (m_config.sync == JournalSync::None) {
+                if (std::fflush(m_file) != 0) throw std::runtime_error("kuzco::Journal: flush failed");
+            }
+            else if (m_config.sync == JournalSync::EveryCommit) {
+                auto syncStart = clock::now();
+                syncing = true;
+                impl::flushAndSync(m_file);
+                syncTime = clock::now() - syncStart;
+            }
+        }
+        catch (...) {
+            // so that the record is not replayed and the following ones are not lost after it
+            truncateFailedAppend();
+            // the durability of the previous records is unknown
+            if (syncing) fail(std::current_exception());
+            throw;
+        }
+
+        m_lastLsn = h.lsn;
+        auto bytes = sizeof(h) + record.size();
+        m_fileEnd += bytes;
+        ++m_metrics.records;
+        m_metrics.bytes += bytes;
+
+        switch (m_config.sync) {
+        case JournalSync::None:
+            m_pendingBytes += bytes; // not synced
+            setDurable(h.lsn);
+            break;
+        case JournalSync::EveryCommit:
+            ++m_metrics.syncs;
+            m_metrics.syncTime += syncTime;
+            setDurable(h.lsn);
+            break;
+        case JournalSync::Batched:
+            if (!m_pendingBytes) {
+                m_firstPending = start;
+            }
+            m_pendingBytes += bytes;
+            m_cv.notify_all();
+            break;
+        }
+
+        auto time = clock::now() - start;
+        m_metrics.appendTime += time;
+        if (time > m_metrics.maxAppendTime) m_metrics.maxAppendTime = time;
+        return h.lsn;
+    }
+
+    // lsn of the last appended record
+    uint64_t lastLsn() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_lastLsn;
+    }
+
+    // records up to this lsn (inclusive) are durable
+    uint64_t durableLsn() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_durableLsn;
+    }
+
+    // block until the record with the lsn is durable
+    // throws if the journal fails before that
+    void waitDurable(uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&]() { return m_durableLsn >= lsn || m_error; });
+        if (m_durableLsn < lsn) std::rethrow_exception(m_error);
+    }
+
+    // flush and fsync all appended records now (regardless of the policy)
+    void sync() {
+        std::lock_guard<std::mutex> syncLock(m_syncMutex);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto lsn = m_lastLsn;
+        if (lsn == m_durableLsn && !m_pendingBytes) return;
+        checkFile();
+        int fd;
+        try {
+            if (std::fflush(m_file) != 0) throw std::runtime_error("kuzco::Journal: flush failed");
+            // a duplicate, as a failed append may reopen the file while we're syncing
+            fd = impl::duplicateDescriptor(impl::fileDescriptor(m_file));
+        }
+        catch (...) {
+            fail(std::current_exception());
+            throw;
+        }
+        m_pendingBytes = 0;
+        lock.unlock();
+
+        // appends can continue while we're syncing
+        auto start = clock::now();
+        try {
+            impl::syncDescriptor(fd);
+        }
+        catch (...) {
+            impl::closeDescriptor(fd);
+            lock.lock();
+            fail(std::current_exception());
+            throw;
+        }
+        impl::closeDescriptor(fd);
+        auto time = clock::now() - start;
+
+        lock.lock();
+        ++m_metrics.syncs;
+        m_metrics.syncTime += time;
+        setDurable(lsn);
+    }
+
+    // drop the records up to lsn (inclusive), as they are contained in a saved snapshot
+    // the rest of the records are moved to a new file which atomically replaces the journal
+    void checkpoint(uint64_t lsn) {
+        std::lock_guard<std::mutex> syncLock(m_syncMutex);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        checkFile();
+        impl::flushAndSync(m_file);
+        m_pendingBytes = 0;
+        setDurable(m_lastLsn);
+
+        auto tmpPath = m_path;
+        tmpPath += ".tmp";
+        auto size = writeCheckpoint(tmpPath, lsn);
+
+        {
+            // the journal file is closed while it's replaced
+            // reopen it whether the replacement succeeded or not
+            struct Reopen {
+                Journal& j;
+                ~Reopen() {
+                    j.m_file = std::fopen(j.m_path.string().c_str(), "ab");
+                    if (!j.m_file) j.failNoReopen();
+                }
+            } reopen{*this};
+            std::fclose(m_file);
+            m_file = nullptr;
+            std::filesystem::rename(tmpPath, m_path);
+            m_fileEnd = size;
+        }
+        checkFile();
+
+        if (lsn > m_lastLsn) m_lastLsn = lsn;
+        setDurable(m_lastLsn);
+        impl::syncDirectory(m_path.parent_path());
+    }
+
+    JournalMetrics metrics() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_metrics;
+    }
+
+    // call f(std::string_view record) for each valid record of the file with an lsn greater
+    // than afterLsn
+    // return the lsn of the last record (or afterLsn if there are none)
+    // a missing file is treated as an empty journal
+    template <typename F>
+    static uint64_t replay(const std::filesystem::path& path, F f, uint64_t afterLsn = 0) {
+        Format::Reader reader(path);
+        uint64_t last = afterLsn;
+        while (reader.next()) {
+            if (reader.lsn() <= afterLsn) continue;
+            f(reader.data());
+            last = reader.lsn();
+        }
+        return last;
+    }
+
+private:
+    void open(const char* mode) {
+        m_file = std::fopen(m_path.string().c_str(), mode);
+        if (!m_file) throw std::runtime_error("kuzco::Journal: can't open " + m_path.string());
+    }
+
+    // call while locked
+    void checkFile() const {
+        if (m_error) std::rethrow_exception(m_error);
+        if (!m_file) throw std::runtime_error("kuzco::Journal: failed, can't reopen " + m_path.string());
+    }
+
+    // write the records after lsn from the journal file to a new file
+    // return the size of the new file
+    uint64_t writeCheckpoint(const std::filesystem::path& tmpPath, uint64_t lsn) {
+        Format::Reader reader(m_path);
+        auto out = std::fopen(tmpPath.string().c_str(), "wb");
+        if (!out) throw std::runtime_error("kuzco::Journal: can't create " + tmpPath.string());
+        uint64_t size = Format::fileHeaderSize;
+        try {
+            Format::writeFileHeader(out, std::max(lsn, reader.lsn()));
+            while (reader.next()) {
+                if (reader.lsn() <= lsn) continue;
+                // read with a 32-bit size, so it fits in the header
+                auto data = reader.data();
+                Format::RecordHeader h{reader.lsn(), uint32_t(data.size()), Format::checksum(reader.lsn(), data)};
+                if (std::fwrite(&h, sizeof(h), 1, out) != 1
+                    || (!data.empty() && std::fwrite(data.data(), 1, data.size(), out) != data.size())
+                ) {
+                    throw std::runtime_error("kuzco::Journal: write failed");
+                }
+                size += sizeof(h) + data.size();
+            }
+            impl::flushAndSync(out);
+        }
+        catch (...) {
+            std::fclose(out);
+            std::error_code ec;
+            std::filesystem::remove(tmpPath, ec);
+            throw;
+        }
+        if (std::fclose(out) != 0) {
+            std::error_code ec;
+            std::filesystem::remove(tmpPath, ec);
+            throw std::runtime_error("kuzco::Journal: write failed");
+        }
+        return size;
+    }
+
+    // call while locked
+    // drop the part of the failed append which was written by truncating the file to the end of
+    // the last good record (closing the file drops what's left of it in the buffer)
+    // if that's not possible the journal is failed
+    void truncateFailedAppend() {
+        std::fclose(m_file);
+        m_file = nullptr;
+        std::error_code ec;
+        auto size = std::filesystem::file_size(m_path, ec);
+        // buffered records before the failed one may have been lost with it
+        if (!ec && size >= m_fileEnd) {
+            std::filesystem::resize_file(m_path, m_fileEnd, ec);
+            if (!ec) m_file = std::fopen(m_path.string().c_str(), "ab");
+            if (m_file) return;
+        }
+        fail(std::make_exception_ptr(std::runtime_error("kuzco::Journal: failed, can't truncate " + m_path.string())));
+    }
+
+    // call while locked
+    void failNoReopen() noexcept {
+        try {
+            fail(std::make_exception_ptr(std::runtime_error("kuzco::Journal: failed, can't reopen " + m_path.string())));
+        }
+        catch (...) {
+            // out of memory: checkFile still throws, as there is no file
+            m_cv.notify_all();
+        }
+    }
+
+    // call while locked
+    // the first error is the one which is rethrown
+    void fail(std::exception_ptr error) {
+        if (!m_error) m_error = std::move(error);
+        m_cv.notify_all();
+    }
+
+    // call while locked
+    void setDurable(uint64_t lsn) {
+        if (lsn <= m_durableLsn) return;
+        m_durableLsn = lsn;
+        m_cv.notify_all();
+    }
+
+    // a failed sync in the background fails the journal, as the durability of the following
+    // commits can't be guaranteed
+    void syncLoop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [&]() { return m_stopped || m_pendingBytes; });
+            if (m_stopped) return; // the destructor syncs the rest
+
+            // wait for the batch to fill up or for its oldest record to become too old
+            m_cv.wait_until(lock, m_firstPending + m_config.maxDelay, [&]() {
+                return m_stopped || m_pendingBytes >= m_config.maxBatchBytes;
+            });
+
+            lock.unlock();
+            try {
+                sync();
+            }
+            catch (...) {
+                lock.lock();
+                fail(std::current_exception());
+                return;
+            }
+            lock.lock();
+        }
+    }
+
+    const std::filesystem::path m_path;
+    const JournalConfig m_config;
+
+    std::FILE* m_file = nullptr;
+
+    // held while syncing (without m_mutex) so that the file is not replaced in the meantime
+    std::mutex m_syncMutex;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    uint64_t m_lastLsn = 0;
+    uint64_t m_durableLsn = 0;
+    size_t m_pendingBytes = 0;
+    clock::time_point m_firstPending;
+    JournalMetrics m_metrics;
+    bool m_stopped = false;
+
+    // end of the last record which was appended successfully
+    uint64_t m_fileEnd = 0;
+
+    // set when the journal is failed
+    std::exception_ptr m_error;
+
+    std::thread m_syncThread;
+};
+
+} // namespace kuzco
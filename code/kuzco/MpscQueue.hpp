@@ -0,0 +1,86 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <atomic>
+
+namespace kuzco {
+
+// the intrusive hook of items in MpscQueue
+struct MpscQueueHook {
+    std::atomic<MpscQueueHook*> mpscNext = nullptr;
+};
+
+// an intrusive lock-free multi-producer single-consumer queue (Dmitry Vyukov's)
+// T must derive from MpscQueueHook
+// the queue doesn't own the items
+//
+// push is wait-free and can be called from any thread
+// pop must only be called by a single consumer thread
+// pop may return null while a push is in progress, even if other items were pushed before it
+// thus the consumer needs a separate notification which producers signal after push
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() noexcept
+        : m_head(&m_stub)
+        , m_tail(&m_stub)
+    {}
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T* item) noexcept {
+        pushHook(item);
+    }
+
+    // null if the queue is empty (or a push is in progress)
+    T* pop() noexcept {
+        auto tail = m_tail;
+        auto next = tail->mpscNext.load(std::memory_order_acquire);
+
+        if (tail == &m_stub) {
+            if (!next) return nullptr;
+            m_tail = next;
+            tail = next;
+            next = next->mpscNext.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            m_tail = next;
+            return static_cast<T*>(tail);
+        }
+
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            // a push is in progress
+            return nullptr;
+        }
+
+        // tail is the last item
+        // push the stub behind it, so that we can pop it
+        pushHook(&m_stub);
+
+        next = tail->mpscNext.load(std::memory_order_acquire);
+        if (next) {
+            m_tail = next;
+            return static_cast<T*>(tail);
+        }
+        return nullptr;
+    }
+
+private:
+    void pushHook(MpscQueueHook* h) noexcept {
+        h->mpscNext.store(nullptr, std::memory_order_relaxed);
+        auto prev = m_head.exchange(h, std::memory_order_acq_rel);
+        prev->mpscNext.store(h, std::memory_order_release);
+    }
+
+    // producers push here
+    alignas(64) std::atomic<MpscQueueHook*> m_head;
+
+    // consumer only
+    alignas(64) MpscQueueHook* m_tail;
+    MpscQueueHook m_stub;
+};
+
+} // namespace kuzco
@@ -6,6 +6,7 @@
 #include "Fingerprint.hpp"
 #include <memory>
 #include <type_traits>
+#include <utility>
 #include <stdexcept>
 
 namespace kuzco {
@@ -40,6 +41,7 @@ public:
         if (this->unique()) {
             // modify the contents if unique
             *this->m_ptr = std::forward<U>(u);
+            if constexpr (HasGenerationStamp<T>) this->m_ptr->bumpGeneration();
         }
         else {
             // otherwise replace
@@ -65,6 +67,10 @@ public:
         if (m_ptr.use_count() > 1) {
             m_ptr = itlib::make_ref_ptr_from(*m_ptr);
         }
+        if constexpr (HasGenerationStamp<T>) {
+            // the value may be modified through the result (see Fingerprint.hpp)
+            if (m_ptr) m_ptr->bumpGeneration();
+        }
         return m_ptr.get();
     }
     T* operator->() { return get(); }
@@ -79,6 +85,7 @@ public:
 
     Detached<T> detach() const noexcept { return m_ptr; }
     Fingerprint fingerprint() const noexcept { return m_ptr; }
+    VersionedFingerprint versionedFingerprint() const noexcept requires HasGenerationStamp<T> { return m_ptr; }
 
     template <typename U>
     bool sameAs(const Detached<U>& other) const noexcept {
@@ -89,6 +96,10 @@ public:
         return other.sameAs(m_ptr);
     }
 
+    bool sameAs(const VersionedFingerprint& other) const noexcept requires HasGenerationStamp<T> {
+        return other.sameAs(m_ptr);
+    }
+
     auto operator<=>(const OptNode& other) const noexcept = default;
 protected:
     explicit OptNode(itlib::ref_ptr<T> ptr) : m_ptr(std::move(ptr)) {}
@@ -165,4 +176,31 @@ bool operator!=(const OptNode<T>& a, const Fingerprint& b) noexcept {
     return !a.sameAs(b);
 }
 
+template <typename T>
+bool operator==(const VersionedFingerprint& a, const OptNode<T>& b) noexcept {
+    return b.sameAs(a);
+}
+template <typename T>
+bool operator!=(const VersionedFingerprint& a, const OptNode<T>& b) noexcept {
+    return !b.sameAs(a);
+}
+template <typename T>
+bool operator==(const OptNode<T>& a, const VersionedFingerprint& b) noexcept {
+    return a.sameAs(b);
+}
+template <typename T>
+bool operator!=(const OptNode<T>& a, const VersionedFingerprint& b) noexcept {
+    return !a.sameAs(b);
+}
+
+namespace impl {
+template <typename T>
+std::true_type isOptNode(const OptNode<T>*);
+std::false_type isOptNode(const void*);
+} // namespace impl
+
+// whether T is a node type (OptNode, Node, or a class derived from them)
+template <typename T>
+inline constexpr bool IsOptNode = decltype(impl::isOptNode(std::declval<const T*>()))::value;
+
 } // namespace kuzco
@@ -12,10 +12,11 @@ namespace kuzco {
 // note that you can't just use a Node copy of another node - that would make it non-unique
 // alternatively if you use Node*, this is perfectly safe, but accessing the inner data is clunky
 // (*ptr)->member or **ptr
-template <typename T>
+// NodeT can be any type with the node interface (for example InlineNode)
+template <typename T, template <typename> class NodeT = Node>
 class NodeRef {
 public:
-    using Node = kuzco::Node<T>;
+    using Node = NodeT<T>;
 
     NodeRef() = default;
     explicit NodeRef(Node& n) : m_node(&n) {}
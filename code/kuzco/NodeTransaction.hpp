@@ -4,6 +4,7 @@
 #pragma once
 #include "Node.hpp"
 #include "NodeRef.hpp"
+#include "DeepEqual.hpp"
 
 #include <cassert>
 #include <utility>
@@ -59,6 +60,24 @@ public:
         return this->m_node->m_ptr != restore;
     }
 
+    // revert if the current value is deeply equal to the initial one (see DeepEqual.hpp)
+    // this restores the sharing with the initial state for changes which turned out to be no-ops
+    // returns whether it reverted
+    bool revertIfEqual() requires DeepEqualityComparable<T> {
+        assert(m_restoreState);
+        auto& cur = this->m_node->m_ptr;
+        if (cur == m_restoreState || !deepEqual(*cur, *m_restoreState)) return false;
+        cur = m_restoreState;
+        return true;
+    }
+
+    // complete committing changes unless the value is deeply equal to the initial one
+    // returns whether state changed
+    bool commitIfChanged() requires DeepEqualityComparable<T> {
+        revertIfEqual();
+        return commit();
+    }
+
     // complete, either committing or aborting based on commit flag
     // returns whether state changed
     bool complete(bool commit = true) {
@@ -8,10 +8,12 @@
 
 namespace kuzco {
 
-template <typename T, template <typename...> class WrappedVector>
-class NodeVector : public VectorImpl<WrappedVector<Node<T>>> {
+// NodeT can be used to provide alternative node types which have the node interface
+// for example NodeVector<int, std::vector, InlineNode>
+template <typename T, template <typename...> class WrappedVector, template <typename> class NodeT = Node>
+class NodeVector : public VectorImpl<WrappedVector<NodeT<T>>> {
 public:
-    using Super = VectorImpl<WrappedVector<Node<T>>>;
+    using Super = VectorImpl<WrappedVector<NodeT<T>>>;
 #if defined(_MSC_VER)
     // For some weird reason clang requires *typename* here and msvc requires *no-typename* here
     // gcc accepts both
@@ -36,11 +38,22 @@ public:
     // item mutators
     value_type& modify(size_type i) { return Super::operator[](i); }
 
+    // shadow the bulk erasers so that predicates work with items and not with nodes
     template <typename Pred>
-    NodeRef<T> find_if(Pred f) {
+    size_type erase_if(Pred f) {
+        return Super::erase_if([&](const value_type& n) { return f(n.r()); });
+    }
+
+    template <typename Pred>
+    size_type retain(Pred f) {
+        return Super::retain([&](const value_type& n) { return f(n.r()); });
+    }
+
+    template <typename Pred>
+    NodeRef<T, NodeT> find_if(Pred f) {
         for (auto i = this->begin(); i != this->end(); ++i) {
             if (f(i->r())) {
-                return NodeRef<T>(*i);
+                return NodeRef<T, NodeT>(*i);
             }
         }
         return {};
@@ -0,0 +1,196 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "ThreadPool.hpp"
+#include "Node.hpp"
+#include "InlineNode.hpp"
+#include "NodeVector.hpp"
+
+#include <itlib/type_traits.hpp>
+
+#include <atomic>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <ranges>
+#include <utility>
+#include <vector>
+
+namespace kuzco {
+
+// Parallel read-only algorithms over immutable snapshots
+//
+// They work with random access ranges (like the vectors in a Detached state) and with Detached
+// ranges directly. Snapshots are immutable, so they can safely be split between threads.
+// Node elements are unwrapped and functions receive const refs to the items (as with
+// NodeVector::find_if). This way no refcounts are touched per element.
+//
+// The calling thread participates in the work and the first exception thrown by a function
+// is rethrown to the caller.
+
+// minimum number of elements per task
+inline constexpr size_t ParallelGrain = 1024;
+
+namespace impl {
+template <typename E>
+const auto& item(const E& e) noexcept {
+    if constexpr (itlib::is_instantiation_of_v<Node, E> || itlib::is_instantiation_of_v<InlineNode, E>) {
+        return e.r();
+    }
+    else {
+        return e;
+    }
+}
+
+template <typename R>
+concept SnapshotRange = std::ranges::random_access_range<const R> && std::ranges::sized_range<const R>;
+} // namespace impl
+
+template <impl::SnapshotRange R, typename F>
+void parallel_for_each(ThreadPool& pool, const R& range, F f) {
+    auto begin = std::ranges::begin(range);
+    pool.parallelFor(std::ranges::size(range), ParallelGrain, [&](size_t b, size_t e) {
+        for (auto i = begin + b; i != begin + e; ++i) {
+            f(impl::item(*i));
+        }
+    });
+}
+
+template <typename R, typename F>
+void parallel_for_each(ThreadPool& pool, const Detached<R>& range, F f) {
+    parallel_for_each(pool, *range, std::move(f));
+}
+
+// folds all items with reduce(T, map(item))
+// reduce must be associative as chunks are reduced independently
+// the chunk results are then reduced in order
+template <impl::SnapshotRange R, typename T, typename Reduce, typename Map = std::identity>
+T parallel_reduce(ThreadPool& pool, const R& range, T init, Reduce reduce, Map map = {}) {
+    const auto size = std::ranges::size(range);
+    if (size == 0) return init;
+
+    auto begin = std::ranges::begin(range);
+
+    // (chunk begin, chunk result)
+    std::vector<std::pair<size_t, T>> chunks;
+    std::mutex chunksMutex;
+
+    pool.parallelFor(size, ParallelGrain, [&](size_t b, size_t e) {
+        auto i = begin + b;
+        T acc = map(impl::item(*i));
+        for (++i; i != begin + e; ++i) {
+            acc = reduce(std::move(acc), map(impl::item(*i)));
+        }
+        std::lock_guard<std::mutex> lock(chunksMutex);
+        chunks.emplace_back(b, std::move(acc));
+    });
+
+    // reduce in order, so that reduce doesn't need to be commutative
+    std::sort(chunks.begin(), chunks.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (auto& c : chunks) {
+        init = reduce(std::move(init), std::move(c.second));
+    }
+    return init;
+}
+
+template <typename R, typename T, typename Reduce, typename Map = std::identity>
+T parallel_reduce(ThreadPool& pool, const Detached<R>& range, T init, Reduce reduce, Map map = {}) {
+    return parallel_reduce(pool, *range, std::move(init), std::move(reduce), std::move(map));
+}
+
+template <impl::SnapshotRange R, typename Pred>
+size_t parallel_count_if(ThreadPool& pool, const R& range, Pred pred) {
+    return parallel_reduce(pool, range, size_t(0), std::plus<size_t>{}, [&](const auto& item) {
+        return size_t(!!pred(item));
+    });
+}
+
+template <typename R, typename Pred>
+size_t parallel_count_if(ThreadPool& pool, const Detached<R>& range, Pred pred) {
+    return parallel_count_if(pool, *range, std::move(pred));
+}
+
+// returns the index of the first item which satisfies pred or the size of the range if none does
+template <impl::SnapshotRange R, typename Pred>
+size_t parallel_find_if(ThreadPool& pool, const R& range, Pred pred) {
+    const auto size = std::ranges::size(range);
+    auto begin = std::ranges::begin(range);
+
+    std::atomic<size_t> found = size;
+    pool.parallelFor(size, ParallelGrain, [&](size_t b, size_t e) {
+        for (auto i = b; i < e; ++i) {
+            // stop if an earlier item has been found by another chunk
+            if (found.load(std::memory_order_relaxed) < i) return;
+            if (pred(impl::item(begin[i]))) {
+                auto cur = found.load(std::memory_order_relaxed);
+                while (i < cur && !found.compare_exchange_weak(cur, i, std::memory_order_relaxed));
+                return;
+            }
+        }
+    });
+    return found;
+}
+
+template <typename R, typename Pred>
+size_t parallel_find_if(ThreadPool& pool, const Detached<R>& range, Pred pred) {
+    return parallel_find_if(pool, *range, std::move(pred));
+}
+
+// writes f(item) to out[i] for each item
+// out must be a random access iterator to (at least) size(range) elements
+template <impl::SnapshotRange R, std::random_access_iterator OutIt, typename F>
+void parallel_transform_to(ThreadPool& pool, const R& range, OutIt out, F f) {
+    auto begin = std::ranges::begin(range);
+    pool.parallelFor(std::ranges::size(range), ParallelGrain, [&](size_t b, size_t e) {
+        for (auto i = b; i < e; ++i) {
+            out[i] = f(impl::item(begin[i]));
+        }
+    });
+}
+
+template <typename R, std::random_access_iterator OutIt, typename F>
+void parallel_transform_to(ThreadPool& pool, const Detached<R>& range, OutIt out, F f) {
+    parallel_transform_to(pool, *range, out, std::move(f));
+}
+
+// Parallel mutation of the elements of a NodeVector
+//
+// Useful in transactions. The vector itself is unshared once (which copies the nodes, but not the
+// items) and then the items are copied-on-write and modified independently across the pool.
+//
+// f receives a T& and must only modify the item it receives. Note that uniqueness checks on nodes
+// are not thread safe. Items modified in parallel must not share nodes which f modifies without
+// copying. (Items created separately never do. Copies of the same item do.)
+//
+// If f throws, the first exception is rethrown after all chunks are done. Some items may have been
+// modified, so the transaction must be aborted (which is what transactions do when they are
+// destroyed by an exception)
+
+template <typename T, template <typename...> class WV, template <typename> class NodeT, typename F>
+void parallel_modify(ThreadPool& pool, NodeVector<T, WV, NodeT>& vec, F f) {
+    if (vec.empty()) return;
+    auto begin = vec.begin(); // unshare
+    pool.parallelFor(vec.size(), ParallelGrain, [&](size_t b, size_t e) {
+        for (auto i = begin + b; i != begin + e; ++i) {
+            f(i->cow());
+        }
+    });
+}
+
+// only items which satisfy pred are copied and modified
+template <typename T, template <typename...> class WV, template <typename> class NodeT, typename Pred, typename F>
+void parallel_modify_if(ThreadPool& pool, NodeVector<T, WV, NodeT>& vec, Pred pred, F f) {
+    if (vec.empty()) return;
+    auto begin = vec.begin(); // unshare
+    pool.parallelFor(vec.size(), ParallelGrain, [&](size_t b, size_t e) {
+        for (auto i = begin + b; i != begin + e; ++i) {
+            if (pred(i->r())) {
+                f(i->cow());
+            }
+        }
+    });
+}
+
+} // namespace kuzco
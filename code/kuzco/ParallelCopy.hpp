@@ -0,0 +1,148 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "ThreadPool.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace kuzco {
+
+// Opt-in parallel copies for copy-on-write of large containers
+//
+// When a transaction first touches a huge shared container, the entire container is copied on the
+// writer thread. With ParallelCopyScope a thread can split such copies across a thread pool.
+// Note that only copies of trivially copyable elements can be split. Other elements can't be
+// constructed in parallel into a std::vector-like container. Copies of all elements are measured
+// though, so that the time spent copying can be tracked.
+
+struct CopyMetrics {
+    size_t elements = 0;
+    size_t bytes = 0;
+    size_t chunks = 0; // number of parallel chunks (0 for a serial copy)
+    std::chrono::steady_clock::duration time = {};
+};
+
+struct ParallelCopyConfig {
+    // null means no parallel copies (metrics are still reported)
+    ThreadPool* pool = nullptr;
+
+    // copies of at least this many bytes are split across the pool
+    size_t threshold = 8 * 1024 * 1024;
+
+    // minimum bytes per chunk
+    size_t grain = 1024 * 1024;
+
+    // called after each copy-on-write rebuild of a container
+    // must not throw
+    std::function<void(const CopyMetrics&)> onCopy;
+};
+
+// enables the config for copies on the current thread during its lifetime
+// the config must outlive the scope
+class ParallelCopyScope {
+public:
+    explicit ParallelCopyScope(const ParallelCopyConfig& config) noexcept
+        : m_config(config)
+        , m_prev(std::exchange(tlCurrent(), this))
+    {}
+
+    ~ParallelCopyScope() {
+        tlCurrent() = m_prev;
+    }
+
+    ParallelCopyScope(const ParallelCopyScope&) = delete;
+    ParallelCopyScope& operator=(const ParallelCopyScope&) = delete;
+
+    static const ParallelCopyConfig* current() noexcept {
+        auto s = tlCurrent();
+        return s ? &s->m_config : nullptr;
+    }
+
+    // whether a copy of this many bytes should be split
+    static bool splits(size_t bytes) noexcept {
+        auto c = current();
+        return c && c->pool && bytes >= c->threshold;
+    }
+
+private:
+    static ParallelCopyScope*& tlCurrent() noexcept {
+        static thread_local ParallelCopyScope* current = nullptr;
+        return current;
+    }
+
+    const ParallelCopyConfig& m_config;
+    ParallelCopyScope* m_prev;
+};
+
+// measures a single copy-on-write rebuild on the current thread
+// inactive unless there is a current ParallelCopyScope with onCopy
+class CopyMeter {
+public:
+    CopyMeter(size_t elements, size_t elementSize) noexcept
+        : m_config(ParallelCopyScope::current())
+    {
+        if (!m_config || !m_config->onCopy) {
+            m_config = nullptr;
+            return;
+        }
+        m_metrics.elements = elements;
+        m_metrics.bytes = elements * elementSize;
+        m_prev = std::exchange(tlCurrent(), this);
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    ~CopyMeter() {
+        if (!m_config) return;
+        m_metrics.time = std::chrono::steady_clock::now() - m_start;
+        tlCurrent() = m_prev;
+        m_config->onCopy(m_metrics);
+    }
+
+    CopyMeter(const CopyMeter&) = delete;
+    CopyMeter& operator=(const CopyMeter&) = delete;
+
+    // add parallel chunks to the active meter (if any)
+    static void addChunks(size_t chunks) noexcept {
+        if (auto m = tlCurrent()) {
+            m->m_metrics.chunks += chunks;
+        }
+    }
+
+private:
+    static CopyMeter*& tlCurrent() noexcept {
+        static thread_local CopyMeter* current = nullptr;
+        return current;
+    }
+
+    const ParallelCopyConfig* m_config;
+    CopyMeter* m_prev = nullptr;
+    CopyMetrics m_metrics;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// copy count elements from src to dst
+// split across the pool of the current ParallelCopyScope if it's large enough
+template <typename T>
+void parallelCopy(T* dst, const T* src, size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (!count) return;
+
+    if (!ParallelCopyScope::splits(count * sizeof(T))) {
+        std::memcpy(static_cast<void*>(dst), src, count * sizeof(T));
+        return;
+    }
+
+    auto& config = *ParallelCopyScope::current();
+    auto grain = std::max(config.grain / sizeof(T), size_t(1));
+    auto chunks = config.pool->parallelFor(count, grain, [&](size_t b, size_t e) {
+        std::memcpy(static_cast<void*>(dst + b), src + b, (e - b) * sizeof(T));
+    });
+    CopyMeter::addChunks(chunks);
+}
+
+} // namespace kuzco
@@ -0,0 +1,344 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Node.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace kuzco {
+
+// Serialization of node trees
+//
+// Each node is serialized as a separate record: a payload and a list of ids of its child nodes.
+// Stores (SnapshotStore, ShmPublisher) decide how records are identified and where they are
+// written, and they can skip nodes which they already have.
+//
+// Types are serialized by PersistTraits. The default implementation is for trivially copyable
+// types without pointers and padding (arithmetic types and enums, and structs of them without
+// padding). Specialize it for others:
+//
+//     template <>
+//     struct kuzco::PersistTraits<Person> {
+//         static void save(const Person& p, PersistWriter& w) {
+//             w.value(p.name);
+//             w.value(p.age);
+//             w.node(p.address); // child nodes are separate records
+//         }
+//         static Person load(PersistReader& r) {
+//             Person p;
+//             p.name = r.value<std::string>();
+//             p.age = r.value<int>();
+//             p.address = r.node<Address>();
+//             return p;
+//         }
+//     };
+//
+// Records of different types are told apart by a tag of the type, which is derived from its name
+// as spelled by the compiler. Thus records written by a build with a different compiler or
+// standard library can't be loaded. To make them portable, provide explicit names:
+//
+//     static constexpr std::string_view typeName = "Person"; // in PersistTraits<Person>
+
+// the meaning of the id depends on the store
+struct NodeId {
+    uint64_t a = 0, b = 0;
+
+    // null ids are used for null child nodes
+    explicit operator bool() const noexcept { return a || b; }
+    bool operator==(const NodeId&) const noexcept = default;
+};
+
+template <typename T>
+struct PersistTraits;
+
+class PersistWriter;
+class PersistReader;
+
+namespace impl {
+struct NodeIdHash {
+    size_t operator()(const NodeId& id) const noexcept { return size_t(id.a ^ id.b); }
+};
+
+// a node type: its (type-erased) persistence functions and its tag
+// there is a single instance per type: persistNodeType<T>
+struct PersistNodeType {
+    void (*save)(const void* obj, PersistWriter& w);
+    std::shared_ptr<void> (*load)(PersistReader& r);
+
+    // identifies the type in stored records
+    uint64_t tag;
+};
+
+// implemented by stores
+class PersistNodeSink {
+public:
+    // write the node unless it's already stored and return its id
+    virtual NodeId persistNode(const std::shared_ptr<const void>& obj, const PersistNodeType& type) = 0;
+protected:
+    ~PersistNodeSink() = default;
+};
+
+class PersistNodeSource {
+public:
+    // read the node unless it's already loaded
+    // type is the expected type of the node, sources which can check it throw on a mismatch
+    virtual std::shared_ptr<void> loadNode(const NodeId& id, const PersistNodeType& type) = 0;
+protected:
+    ~PersistNodeSource() = default;
+};
+
+template <typename T>
+void persistSave(const void* obj, PersistWriter& w) {
+    PersistTraits<T>::save(*static_cast<const T*>(obj), w);
+}
+
+template <typename T>
+std::shared_ptr<void> persistLoad(PersistReader& r) {
+    return itlib::make_ref_ptr<T>(PersistTraits<T>::load(r))._as_shared_ptr_unsafe();
+}
+
+// fnv-1a
+constexpr uint64_t persistHashName(std::string_view name) noexcept {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (auto c : name) {
+        h ^= uint8_t(c);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// the signature of this function contains the name of T
+template <typename T>
+constexpr std::string_view persistCompilerTypeName() noexcept {
+#if defined(_MSC_VER)
+    return __FUNCSIG__;
+#else
+    return __PRETTY_FUNCTION__;
+#endif
+}
+
+template <typename T>
+constexpr uint64_t persistTypeTag() noexcept {
+    if constexpr (requires { std::string_view(PersistTraits<T>::typeName); }) {
+        return persistHashName(PersistTraits<T>::typeName);
+    }
+    else {
+        return persistHashName(persistCompilerTypeName<T>());
+    }
+}
+
+template <typename T>
+inline constexpr PersistNodeType persistNodeType = {&persistSave<T>, &persistLoad<T>, persistTypeTag<T>()};
+
+// makes an OptNode from an existing object
+template <typename T>
+struct LoadedNode : public OptNode<T> {
+    explicit LoadedNode(std::shared_ptr<void> obj)
+        : OptNode<T>(itlib::ref_ptr<T>::_from_shared_ptr_unsafe(std::static_pointer_cast<T>(std::move(obj))))
+    {}
+};
+
+template <typename T>
+T* nodeValueType(const OptNode<T>*);
+} // namespace impl
+
+// serializes an object to the record of its node
+class PersistWriter {
+public:
+    explicit PersistWriter(impl::PersistNodeSink& sink) : m_sink(sink) {}
+
+    PersistWriter(const PersistWriter&) = delete;
+    PersistWriter& operator=(const PersistWriter&) = delete;
+
+    void write(const void* data, size_t size) {
+        m_payload.append(static_cast<const char*>(data), size);
+    }
+
+    template <typename T>
+    void value(const T& v) {
+        PersistTraits<T>::save(v, *this);
+    }
+
+    // child nodes (can be null)
+    template <typename T>
+    void node(const Detached<T>& n) {
+        m_children.push_back(n ? m_sink.persistNode(n._as_shared_ptr_unsafe(), impl::persistNodeType<T>) : NodeId{});
+    }
+
+    template <typename T>
+    void node(const OptNode<T>& n) {
+        node(n.detach());
+    }
+
+    const std::vector<NodeId>& children() const noexcept { return m_children; }
+    std::string_view payload() const noexcept { return m_payload; }
+
+private:
+    impl::PersistNodeSink& m_sink;
+    std::vector<NodeId> m_children;
+    std::string m_payload;
+};
+
+// deserializes an object from the record of its node
+// values and nodes must be read in the order in which they were written
+class PersistReader {
+public:
+    // the payload must outlive the reader
+    PersistReader(impl::PersistNodeSource& source, std::vector<NodeId> children, std::string_view payload)
+        : m_source(source)
+        , m_children(std::move(children))
+        , m_payload(payload)
+    {}
+
+    PersistReader(const PersistReader&) = delete;
+    PersistReader& operator=(const PersistReader&) = delete;
+
+    void read(void* data, size_t size) {
+        if (size > remaining()) {
+            throw std::runtime_error("kuzco::PersistReader: read past the end of the record");
+        }
+        if (size) std::memcpy(data, m_payload.data() + m_pos, size);
+        m_pos += size;
+    }
+
+    // unread bytes of the payload
+    size_t remaining() const noexcept { return m_payload.size() - m_pos; }
+
+    // unread child nodes
+    size_t remainingNodes() const noexcept { return m_children.size() - m_nextChild; }
+
+    template <typename T>
+    T value() {
+        return PersistTraits<T>::load(*this);
+    }
+
+    template <typename T>
+    OptNode<T> optNode() {
+        if (!remainingNodes()) {
+            throw std::runtime_error("kuzco::PersistReader: no more child nodes");
+        }
+        auto& id = m_children[m_nextChild++];
+        if (!id) return {};
+        return impl::LoadedNode<T>(m_source.loadNode(id, impl::persistNodeType<T>));
+    }
+
+    // throws if the node is null
+    template <typename T>
+    Node<T> node() {
+        return Node<T>(optNode<T>());
+    }
+
+private:
+    impl::PersistNodeSource& m_source;
+    std::vector<NodeId> m_children;
+    size_t m_nextChild = 0;
+    std::string_view m_payload;
+    size_t m_pos = 0;
+};
+
+namespace impl {
+// types which are saved as bytes by default
+// pointers are meaningless when loaded and padding is not initialized (so the bytes of equal values
+// can differ), so only types without them qualify. Floating point numbers don't have unique
+// representations (because of -0 and NaN), but they're allowed.
+template <typename T>
+inline constexpr bool persistAsBytes =
+    std::is_trivially_copyable_v<T>
+    && !std::is_pointer_v<T>
+    && !std::is_member_pointer_v<T>
+    && (std::is_floating_point_v<T> || std::has_unique_object_representations_v<T>);
+
+template <typename T, size_t N>
+inline constexpr bool persistAsBytes<T[N]> = persistAsBytes<T>;
+} // namespace impl
+
+// trivially copyable types without pointers and padding are saved as bytes
+// note that pointers inside of structs can't be detected: specialize PersistTraits for them
+template <typename T>
+struct PersistTraits {
+    static_assert(impl::persistAsBytes<T>, "kuzco::PersistTraits must be specialized for this type");
+
+    static void save(const T& v, PersistWriter& w) {
+        w.write(&v, sizeof(T));
+    }
+    static T load(PersistReader& r) {
+        T v;
+        r.read(&v, sizeof(T));
+        return v;
+    }
+};
+
+template <typename C, typename Traits, typename Alloc>
+struct PersistTraits<std::basic_string<C, Traits, Alloc>> {
+    using String = std::basic_string<C, Traits, Alloc>;
+    static void save(const String& s, PersistWriter& w) {
+        w.value(uint64_t(s.size()));
+        w.write(s.data(), s.size() * sizeof(C));
+    }
+    static String load(PersistReader& r) {
+        auto size = r.value<uint64_t>();
+        if (size > r.remaining() / sizeof(C)) {
+            throw std::runtime_error("kuzco::PersistReader: bad string size");
+        }
+        String s(size_t(size), C{});
+        r.read(s.data(), s.size() * sizeof(C));
+        return s;
+    }
+};
+
+// elements of vectors can be nodes (saved as child nodes), types saved as bytes (saved in bulk),
+// or other types with PersistTraits
+template <typename T, typename Alloc>
+struct PersistTraits<std::vector<T, Alloc>> {
+    using Vector = std::vector<T, Alloc>;
+    static void save(const Vector& vec, PersistWriter& w) {
+        w.value(uint64_t(vec.size()));
+        if constexpr (IsOptNode<T>) {
+            for (auto& n : vec) {
+                w.node(n);
+            }
+        }
+        else if constexpr (impl::persistAsBytes<T>) {
+            w.write(vec.data(), vec.size() * sizeof(T));
+        }
+        else {
+            for (auto& e : vec) {
+                w.value(e);
+            }
+        }
+    }
+    static Vector load(PersistReader& r) {
+        Vector vec;
+        auto size = r.value<uint64_t>();
+        if constexpr (IsOptNode<T>) {
+            using V = std::remove_pointer_t<decltype(impl::nodeValueType(std::declval<const T*>()))>;
+            if (size > r.remainingNodes()) throw std::runtime_error("kuzco::PersistReader: bad vector size");
+            vec.reserve(size_t(size));
+            for (uint64_t i = 0; i < size; ++i) {
+                vec.emplace_back(r.template optNode<V>());
+            }
+        }
+        else if constexpr (impl::persistAsBytes<T>) {
+            if (size > r.remaining() / sizeof(T)) throw std::runtime_error("kuzco::PersistReader: bad vector size");
+            vec.resize(size_t(size));
+            r.read(vec.data(), vec.size() * sizeof(T));
+        }
+        else {
+            for (uint64_t i = 0; i < size; ++i) {
+                vec.push_back(r.template value<T>());
+            }
+        }
+        return vec;
+    }
+};
+
+} // namespace kuzco
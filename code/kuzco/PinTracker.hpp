@@ -0,0 +1,272 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Node.hpp"
+#include "Reclaimer.hpp"
+
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <string_view>
+#include <unordered_set>
+#include <cstdint>
+
+namespace kuzco {
+
+// Tracking of pinned snapshots
+//
+// The memory of old states is freed when the last snapshot which references it is dropped. Thus a
+// reader which holds on to an old snapshot can pin a lot of memory.
+//
+// Snapshots published through a storage with a pin tracker are tracked per version. While a version
+// has live snapshots, the tracker lists it with their number and the time since a newer version was
+// published. Readers can additionally tag their snapshots with an acquisition site (detach(site)) to
+// find out who is holding them.
+//
+// Tracking costs an allocation and a short lock per publish, and nothing per (untagged) detach.
+// Tagged detaches cost an allocation and a short lock each.
+//
+// The retained memory can be measured on query with ReclaimTraits (see Reclaimer.hpp). Going from
+// the current version to the oldest one, each version is attributed the objects which are not
+// reachable from newer ones. Measuring walks the entire current state, so do it sparingly.
+//
+// Tracked snapshots wrap the published objects like the ones of Reclaimer (see Reclaimer.hpp).
+
+struct PinSite {
+    // the tag of the detach
+    std::string_view site;
+
+    // live snapshots tagged with it (copies of a tagged snapshot count as one)
+    size_t count = 0;
+};
+
+struct PinnedVersion {
+    uint64_t version = 0;
+
+    // the currently published version
+    bool current = false;
+
+    // live snapshots of this version, not counting the one in the storage
+    // (copies of a tagged snapshot count as one)
+    size_t snapshots = 0;
+
+    // time since a newer version was published (zero for the current one)
+    std::chrono::steady_clock::duration age = {};
+
+    std::vector<PinSite> sites;
+
+    // bytes retained by this version, but not by newer ones (only when measured)
+    uint64_t retainedBytes = 0;
+};
+
+class PinTracker {
+public:
+    using clock = std::chrono::steady_clock;
+
+    PinTracker() : m_state(std::make_shared<State>()) {}
+
+    PinTracker(const PinTracker&) = delete;
+    PinTracker& operator=(const PinTracker&) = delete;
+
+    // a snapshot of the same object, which is tracked as the version until it and all of its copies
+    // are dropped
+    // the storage calls this when publishing
+    template <typename T>
+    Detached<T> track(Detached<T> d, uint64_t version) {
+        if (!d) return d;
+        auto obj = d.get();
+
+        auto rec = std::make_shared<Record>();
+        rec->version = version;
+        rec->object = obj;
+        rec->entry = [](std::shared_ptr<const void> p) {
+            return impl::ReclaimEntry::make(
+                Detached<T>::_from_shared_ptr_unsafe(std::static_pointer_cast<const T>(std::move(p))));
+        };
+
+        std::shared_ptr<Holder> holder(
+            new Holder{std::move(d)._as_shared_ptr_unsafe(), rec, {}},
+            [state = m_state](Holder* h) {
+                state->untrack(*h->record);
+                // destroy the snapshot outside of the lock
+                delete h;
+            }
+        );
+        std::shared_ptr<const T> ret(std::move(holder), obj);
+        rec->snapshot = ret;
+
+        m_state->add(std::move(rec));
+        return Detached<T>::_from_shared_ptr_unsafe(std::move(ret));
+    }
+
+    // a snapshot of the same object, which is counted for the site until it and all of its copies
+    // are dropped
+    // snapshots which are not tracked are returned as they are
+    // the site is not copied, so it must outlive the snapshot (a string literal is a good choice)
+    template <typename T>
+    Detached<T> tag(Detached<T> d, std::string_view site) {
+        if (!d) return d;
+        auto obj = d.get();
+
+        auto rec = m_state->tag(obj, site);
+        if (!rec) return d;
+
+        std::shared_ptr<Holder> holder(
+            new Holder{std::move(d)._as_shared_ptr_unsafe(), std::move(rec), site},
+            [state = m_state](Holder* h) {
+                state->untag(*h->record, h->site);
+                delete h;
+            }
+        );
+        return Detached<T>::_from_shared_ptr_unsafe(std::shared_ptr<const T>(std::move(holder), obj));
+    }
+
+    // the versions which have live snapshots, oldest first (the current one is last)
+    // at most maxCount of the oldest ones are returned
+    // with measure the retained bytes are computed (see above)
+    std::vector<PinnedVersion> pinned(size_t maxCount = size_t(-1), bool measure = false) const {
+        std::vector<PinnedVersion> ret;
+        std::vector<std::shared_ptr<const Record>> records;
+        auto now = clock::now();
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            for (auto& r : m_state->records) {
+                if (!measure && ret.size() == maxCount) break;
+
+                auto& pv = ret.emplace_back();
+                pv.version = r->version;
+                pv.current = r->current;
+                pv.snapshots = size_t(r->snapshot.use_count());
+                if (r->current) {
+                    if (pv.snapshots) --pv.snapshots; // the one in the storage
+                }
+                else {
+                    pv.age = now - r->superseded;
+                }
+                for (auto& s : r->sites) {
+                    pv.sites.push_back(s);
+                }
+                records.push_back(r);
+            }
+        }
+
+        if (measure) {
+            measureRetained(records, ret);
+            if (ret.size() > maxCount) ret.resize(maxCount);
+        }
+
+        return ret;
+    }
+
+private:
+    struct Record {
+        uint64_t version = 0;
+        const void* object = nullptr;
+        std::weak_ptr<const void> snapshot;
+        impl::ReclaimEntry (*entry)(std::shared_ptr<const void>) = nullptr;
+
+        // guarded by the mutex of the state
+        bool current = true;
+        clock::time_point superseded;
+        std::vector<PinSite> sites;
+    };
+
+    struct Holder {
+        std::shared_ptr<const void> snapshot;
+        std::shared_ptr<Record> record;
+        std::string_view site;
+    };
+
+    struct State {
+        mutable std::mutex mutex;
+
+        // live versions, oldest first
+        std::vector<std::shared_ptr<Record>> records;
+
+        void add(std::shared_ptr<Record> rec) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!records.empty()) {
+                auto& prev = *records.back();
+                prev.current = false;
+                prev.superseded = clock::now();
+            }
+            records.push_back(std::move(rec));
+        }
+
+        void untrack(const Record& rec) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto i = records.begin(); i != records.end(); ++i) {
+                if (i->get() == &rec) {
+                    records.erase(i);
+                    return;
+                }
+            }
+        }
+
+        std::shared_ptr<Record> tag(const void* obj, std::string_view site) {
+            std::lock_guard<std::mutex> lock(mutex);
+            // the latest version of the object
+            for (auto i = records.rbegin(); i != records.rend(); ++i) {
+                auto& rec = **i;
+                if (rec.object != obj) continue;
+                for (auto& s : rec.sites) {
+                    if (s.site == site) {
+                        ++s.count;
+                        return *i;
+                    }
+                }
+                rec.sites.push_back({site, 1});
+                return *i;
+            }
+            return {};
+        }
+
+        void untag(Record& rec, std::string_view site) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto i = rec.sites.begin(); i != rec.sites.end(); ++i) {
+                if (i->site != site) continue;
+                if (--i->count == 0) {
+                    rec.sites.erase(i);
+                }
+                return;
+            }
+        }
+    };
+
+    static void measureRetained(const std::vector<std::shared_ptr<const Record>>& records, std::vector<PinnedVersion>& out) {
+        std::unordered_set<const void*> seen;
+
+        // keep everything which was visited alive, so that addresses are not reused while measuring
+        std::vector<std::shared_ptr<const void>> visited;
+
+        std::vector<impl::ReclaimEntry> stack;
+        for (size_t i = records.size(); i-- > 0; ) {
+            auto& rec = *records[i];
+            auto snapshot = rec.snapshot.lock();
+            if (!snapshot) continue; // being dropped
+
+            uint64_t bytes = 0;
+            stack.push_back(rec.entry(std::move(snapshot)));
+            while (!stack.empty()) {
+                auto e = std::move(stack.back());
+                stack.pop_back();
+                if (!seen.insert(e.ptr.get()).second) continue;
+
+                ReclaimSink sink;
+                e.children(e.ptr.get(), sink);
+                bytes += e.size + sink.m_bytes;
+                for (auto& c : sink.m_entries) {
+                    stack.push_back(std::move(c));
+                }
+                visited.push_back(std::move(e.ptr));
+            }
+            out[i].retainedBytes = bytes;
+        }
+    }
+
+    std::shared_ptr<State> m_state;
+};
+
+} // namespace kuzco
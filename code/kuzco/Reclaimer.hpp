@@ -0,0 +1,280 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Node.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <type_traits>
+#include <cstdint>
+
+namespace kuzco {
+
+// Deferred reclamation of released snapshots
+//
+// Without it, when the last reader drops an old snapshot, the entire subtree which is not shared
+// with newer states is destroyed synchronously on the reader's thread.
+// Snapshots published through a storage with a reclaimer are instead handed off to a background
+// thread when they are dropped.
+//
+// The background thread destroys objects in slices of a limited size (optionally pausing between
+// them). To make destruction iterative instead of recursive, types can specialize ReclaimTraits
+// and add their child nodes to the sink. Such children are destroyed as separate objects later.
+//
+// Note that published snapshots share the object, but not the control block with the root node.
+// Thus identity checks with sameAs work, but fingerprints of snapshots and nodes differ.
+
+class ReclaimSink;
+
+// specialize to make the destruction of T iterative
+template <typename T>
+struct ReclaimTraits {
+    // add child nodes (and the heap usage) of obj to the sink
+    static void children(const T&, ReclaimSink&) {}
+};
+
+struct ReclaimerConfig {
+    // maximum number of objects destroyed per slice
+    size_t sliceSize = 1024;
+
+    // pause between slices if there is more work
+    std::chrono::microseconds slicePause = {};
+};
+
+struct ReclaimerMetrics {
+    // objects waiting to be reclaimed
+    size_t queueDepth = 0;
+    size_t peakQueueDepth = 0;
+
+    // objects which were destroyed by the reclaimer
+    uint64_t reclaimedObjects = 0;
+
+    // sizeof the reclaimed objects plus the heap usage reported by ReclaimTraits
+    uint64_t reclaimedBytes = 0;
+
+    uint64_t slices = 0;
+};
+
+namespace impl {
+struct ReclaimEntry {
+    std::shared_ptr<const void> ptr;
+    void (*children)(const void*, ReclaimSink&) = nullptr;
+    size_t size = 0;
+
+    template <typename T>
+    static ReclaimEntry make(Detached<T> d) {
+        ReclaimEntry ret;
+        ret.ptr = std::move(d)._as_shared_ptr_unsafe();
+        ret.children = [](const void* p, ReclaimSink& sink) {
+            ReclaimTraits<T>::children(*static_cast<const T*>(p), sink);
+        };
+        ret.size = sizeof(T);
+        return ret;
+    }
+};
+} // namespace impl
+
+class ReclaimSink {
+public:
+    template <typename T>
+    void add(const Detached<T>& d) {
+        if (!d) return;
+        m_entries.push_back(impl::ReclaimEntry::make(d));
+    }
+
+    template <typename T>
+    void add(const OptNode<T>& n) {
+        add(n.detach());
+    }
+
+    // heap memory owned by the object, other than its child nodes
+    void addBytes(size_t bytes) {
+        m_bytes += bytes;
+    }
+
+private:
+    friend class Reclaimer;
+    friend class PinTracker;
+    std::vector<impl::ReclaimEntry> m_entries;
+    size_t m_bytes = 0;
+};
+
+// vectors report their buffers and their elements, if they're nodes
+template <typename T, typename Alloc>
+struct ReclaimTraits<std::vector<T, Alloc>> {
+    static void children(const std::vector<T, Alloc>& vec, ReclaimSink& sink) {
+        sink.addBytes(vec.capacity() * sizeof(T));
+        if constexpr (IsOptNode<T>) {
+            for (auto& n : vec) {
+                sink.add(n);
+            }
+        }
+    }
+};
+
+class Reclaimer {
+public:
+    explicit Reclaimer(ReclaimerConfig config = {})
+        : m_state(std::make_shared<State>())
+    {
+        m_state->config = config;
+        m_thread = std::thread([state = m_state]() { state->run(); });
+    }
+
+    // reclaims all queued objects before returning
+    // snapshots which are dropped after this are destroyed synchronously
+    ~Reclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            m_state->stopped = true;
+        }
+        m_state->workCv.notify_one();
+        m_thread.join();
+    }
+
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator=(const Reclaimer&) = delete;
+
+    // a snapshot of the same object, which, when dropped (the snapshot and all of its copies),
+    // hands the object off to the reclaimer
+    template <typename T>
+    Detached<T> wrap(Detached<T> d) {
+        if (!d) return d;
+        auto obj = d.get();
+        std::shared_ptr<impl::ReclaimEntry> holder(
+            new impl::ReclaimEntry(impl::ReclaimEntry::make(std::move(d))),
+            [state = m_state](impl::ReclaimEntry* e) {
+                state->enqueue(std::move(*e));
+                delete e;
+            }
+        );
+        return Detached<T>::_from_shared_ptr_unsafe(std::shared_ptr<const T>(std::move(holder), obj));
+    }
+
+    // hand off an object to the reclaimer directly
+    template <typename T>
+    void retire(Detached<T> d) {
+        if (!d) return;
+        m_state->enqueue(impl::ReclaimEntry::make(std::move(d)));
+    }
+
+    ReclaimerMetrics metrics() const {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        auto ret = m_state->metrics;
+        ret.queueDepth = m_state->queue.size();
+        return ret;
+    }
+
+    // block until there is nothing to reclaim
+    void waitIdle() {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        m_state->idleCv.wait(lock, [&]() { return m_state->queue.empty() && !m_state->busy; });
+    }
+
+private:
+    struct State {
+        ReclaimerConfig config;
+
+        mutable std::mutex mutex;
+        std::condition_variable workCv;
+        std::condition_variable idleCv;
+        std::deque<impl::ReclaimEntry> queue;
+        ReclaimerMetrics metrics;
+        bool busy = false;
+        bool stopped = false;
+
+        void enqueue(impl::ReclaimEntry&& e) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!stopped) {
+                    push(std::move(e));
+                    workCv.notify_one();
+                    return;
+                }
+            }
+            // no reclaimer thread: e is destroyed synchronously by the caller
+        }
+
+        // call while locked
+        void push(impl::ReclaimEntry&& e) {
+            queue.push_back(std::move(e));
+            if (queue.size() > metrics.peakQueueDepth) {
+                metrics.peakQueueDepth = queue.size();
+            }
+        }
+
+        // pop an entry from the queue, waiting for one if needed
+        // false means there is no more work
+        bool pop(impl::ReclaimEntry& e) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (queue.empty()) {
+                busy = false;
+                idleCv.notify_all();
+                workCv.wait(lock, [&]() { return stopped || !queue.empty(); });
+                if (queue.empty()) return false;
+            }
+            busy = true;
+            e = std::move(queue.front());
+            queue.pop_front();
+            return true;
+        }
+
+        void run() {
+            size_t inSlice = 0;
+            impl::ReclaimEntry e;
+            while (pop(e)) {
+                reclaim(e);
+
+                if (++inSlice < config.sliceSize) continue;
+
+                inSlice = 0;
+                bool more;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++metrics.slices;
+                    more = !queue.empty();
+                }
+                if (more && config.slicePause.count()) {
+                    std::this_thread::sleep_for(config.slicePause);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (inSlice) ++metrics.slices;
+            busy = false;
+            idleCv.notify_all();
+        }
+
+        // never called while locked, as destroying e may enqueue (if it's a wrapped snapshot)
+        void reclaim(impl::ReclaimEntry& e) {
+            if (e.ptr.use_count() != 1) {
+                // someone else still holds the object and will destroy it
+                e.ptr.reset();
+                return;
+            }
+
+            // we are the last owner, nobody else can access the object
+            ReclaimSink sink;
+            e.children(e.ptr.get(), sink);
+            e.ptr.reset();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ++metrics.reclaimedObjects;
+            metrics.reclaimedBytes += e.size + sink.m_bytes;
+            for (auto& c : sink.m_entries) {
+                push(std::move(c));
+            }
+        }
+    };
+
+    std::shared_ptr<State> m_state;
+    std::thread m_thread;
+};
+
+} // namespace kuzco
@@ -0,0 +1,366 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Detached.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <initializer_list>
+#include <cstdint>
+
+namespace kuzco {
+
+// A persistent string for large texts in states
+//
+// A Node<std::string> is copied in full on any edit after it's published. A rope is a balanced
+// (AVL) tree of immutable chunks of at most MaxChunk chars. Edits create O(log n) new tree nodes
+// and share the rest with the previous value.
+// Thus copying a rope is cheap (a refcount bump) and it can be stored by value in a state object
+// (no need to wrap it in a Node).
+//
+// * insert, erase, substr, and concatenation are O(log n)
+// * indexing is O(log n)
+// * chunks() iterates over the contents as contiguous string_views
+//
+// A string_view from chunks() or spans() is valid while a rope which shares the chunk is alive
+
+namespace impl {
+struct RopeNode {
+    // null for leaves
+    Detached<RopeNode> left, right;
+
+    // leaves only
+    std::string chunk;
+
+    size_t size = 0;
+    uint32_t height = 1; // leaves have height 1
+    size_t numChunks = 1;
+
+    bool leaf() const noexcept { return !left; }
+};
+} // namespace impl
+
+template <size_t MaxChunk = 1024>
+class BasicRope {
+    static_assert(MaxChunk > 0);
+    using NodePtr = Detached<impl::RopeNode>;
+public:
+    static constexpr size_t npos = std::string_view::npos;
+    static constexpr size_t maxChunk = MaxChunk;
+
+    BasicRope() noexcept = default;
+    explicit BasicRope(std::string_view str) : m_root(build(str)) {}
+    explicit BasicRope(const char* str) : BasicRope(std::string_view(str)) {}
+
+    size_t size() const noexcept { return m_root ? m_root->size : 0; }
+    size_t length() const noexcept { return size(); }
+    bool empty() const noexcept { return !m_root; }
+
+    void clear() noexcept { m_root.reset(); }
+
+    char operator[](size_t i) const noexcept {
+        auto n = m_root.get();
+        while (!n->leaf()) {
+            if (i < n->left->size) {
+                n = n->left.get();
+            }
+            else {
+                i -= n->left->size;
+                n = n->right.get();
+            }
+        }
+        return n->chunk[i];
+    }
+
+    char at(size_t i) const {
+        if (i >= size()) throw std::out_of_range("kuzco::Rope::at");
+        return (*this)[i];
+    }
+
+    char front() const noexcept { return (*this)[0]; }
+    char back() const noexcept { return (*this)[size() - 1]; }
+
+    void insert(size_t pos, const BasicRope& rope) {
+        checkPos(pos);
+        auto [a, b] = split(m_root, pos);
+        m_root = join(join(std::move(a), rope.m_root), std::move(b));
+    }
+    void insert(size_t pos, std::string_view str) {
+        insert(pos, BasicRope(str));
+    }
+
+    void append(const BasicRope& rope) {
+        m_root = join(std::move(m_root), rope.m_root);
+    }
+    void append(std::string_view str) {
+        append(BasicRope(str));
+    }
+    void push_back(char c) {
+        append(std::string_view(&c, 1));
+    }
+
+    BasicRope& operator+=(const BasicRope& rope) { append(rope); return *this; }
+    BasicRope& operator+=(std::string_view str) { append(str); return *this; }
+
+    friend BasicRope operator+(const BasicRope& a, const BasicRope& b) {
+        BasicRope ret;
+        ret.m_root = join(a.m_root, b.m_root);
+        return ret;
+    }
+
+    void erase(size_t pos, size_t count = npos) {
+        checkPos(pos);
+        count = std::min(count, size() - pos);
+        if (!count) return;
+        auto [a, rest] = split(m_root, pos);
+        auto [mid, b] = split(rest, count);
+        m_root = join(std::move(a), std::move(b));
+    }
+
+    BasicRope substr(size_t pos, size_t count = npos) const {
+        checkPos(pos);
+        count = std::min(count, size() - pos);
+        BasicRope ret;
+        auto rest = split(m_root, pos).second;
+        ret.m_root = split(rest, count).first;
+        return ret;
+    }
+
+    std::string str() const {
+        std::string ret;
+        ret.reserve(size());
+        for (auto c : chunks()) {
+            ret.append(c);
+        }
+        return ret;
+    }
+
+    // iterates the contents in contiguous chunks
+    class ChunkIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view*;
+        using reference = std::string_view;
+
+        ChunkIterator() = default;
+
+        std::string_view operator*() const noexcept { return m_stack.back().node->chunk; }
+
+        ChunkIterator& operator++() {
+            // go up until we come from a left subtree, then to the leftmost leaf of the right one
+            // (a subtree can be both the left and the right child of a node, as in r + r, so the
+            // direction is recorded in the stack instead of being deduced from pointers)
+            while (true) {
+                auto e = m_stack.back();
+                m_stack.pop_back();
+                if (m_stack.empty()) return *this;
+                if (!e.right) {
+                    descend(m_stack.back().node->right.get(), true);
+                    return *this;
+                }
+            }
+        }
+        ChunkIterator operator++(int) { auto ret = *this; ++*this; return ret; }
+
+        bool operator==(const ChunkIterator& other) const noexcept {
+            return m_stack == other.m_stack;
+        }
+    private:
+        friend class BasicRope;
+        explicit ChunkIterator(const impl::RopeNode* root) {
+            if (root) descend(root, false);
+        }
+        void descend(const impl::RopeNode* n, bool right) {
+            m_stack.push_back({n, right});
+            while (!n->leaf()) {
+                n = n->left.get();
+                m_stack.push_back({n, false});
+            }
+        }
+        struct Entry {
+            const impl::RopeNode* node;
+            bool right; // whether node is the right child of the previous entry
+            bool operator==(const Entry&) const noexcept = default;
+        };
+        std::vector<Entry> m_stack; // path from the root
+    };
+
+    struct ChunkRange {
+        ChunkIterator b, e;
+        ChunkIterator begin() const { return b; }
+        ChunkIterator end() const { return e; }
+    };
+
+    ChunkRange chunks() const {
+        return {ChunkIterator(m_root.get()), ChunkIterator()};
+    }
+
+    size_t numChunks() const noexcept { return m_root ? m_root->numChunks : 0; }
+
+    // the contents as string_views
+    std::vector<std::string_view> spans() const {
+        std::vector<std::string_view> ret;
+        ret.reserve(numChunks());
+        for (auto c : chunks()) {
+            ret.push_back(c);
+        }
+        return ret;
+    }
+
+    // height of the tree (0 for an empty rope)
+    uint32_t height() const noexcept { return h(m_root); }
+
+    // whether the two ropes share the entire tree
+    bool sameAs(const BasicRope& other) const noexcept { return m_root == other.m_root; }
+
+    friend bool operator==(const BasicRope& a, const BasicRope& b) {
+        if (a.sameAs(b)) return true;
+        if (a.size() != b.size()) return false;
+        return equal(a, b.chunks());
+    }
+    friend bool operator==(const BasicRope& a, std::string_view b) {
+        if (a.size() != b.size()) return false;
+        return equal(a, std::initializer_list<std::string_view>{b});
+    }
+    friend bool operator==(const BasicRope& a, const std::string& b) {
+        return a == std::string_view(b);
+    }
+    friend bool operator==(const BasicRope& a, const char* b) {
+        return a == std::string_view(b);
+    }
+private:
+    NodePtr m_root;
+
+    void checkPos(size_t pos) const {
+        if (pos > size()) throw std::out_of_range("kuzco::Rope position out of range");
+    }
+
+    template <typename Chunks>
+    static bool equal(const BasicRope& a, const Chunks& bchunks) {
+        // compare chunk by chunk, both sides may be split at different positions
+        auto ai = a.chunks().begin();
+        std::string_view ac;
+        for (auto bc : bchunks) {
+            while (!bc.empty()) {
+                if (ac.empty()) ac = *ai++;
+                auto n = std::min(ac.size(), bc.size());
+                if (ac.substr(0, n) != bc.substr(0, n)) return false;
+                ac.remove_prefix(n);
+                bc.remove_prefix(n);
+            }
+        }
+        return true;
+    }
+
+    static uint32_t h(const NodePtr& n) noexcept { return n ? n->height : 0; }
+
+    static NodePtr leaf(std::string_view str) {
+        if (str.empty()) return {};
+        auto n = itlib::make_ref_ptr<impl::RopeNode>();
+        n->chunk = str;
+        n->size = str.size();
+        return n;
+    }
+
+    // both non-null
+    static NodePtr node(NodePtr l, NodePtr r) {
+        auto n = itlib::make_ref_ptr<impl::RopeNode>();
+        n->size = l->size + r->size;
+        n->height = std::max(l->height, r->height) + 1;
+        n->numChunks = l->numChunks + r->numChunks;
+        n->left = std::move(l);
+        n->right = std::move(r);
+        return n;
+    }
+
+    // a node from two subtrees whose heights differ by at most 2
+    static NodePtr balanced(NodePtr l, NodePtr r) {
+        auto hl = h(l), hr = h(r);
+        if (hl > hr + 1) {
+            if (h(l->left) >= h(l->right)) {
+                return node(l->left, node(l->right, std::move(r)));
+            }
+            auto& lr = l->right;
+            return node(node(l->left, lr->left), node(lr->right, std::move(r)));
+        }
+        if (hr > hl + 1) {
+            if (h(r->right) >= h(r->left)) {
+                return node(node(std::move(l), r->left), r->right);
+            }
+            auto& rl = r->left;
+            return node(node(std::move(l), rl->left), node(rl->right, r->right));
+        }
+        return node(std::move(l), std::move(r));
+    }
+
+    // concatenate
+    static NodePtr join(NodePtr l, NodePtr r) {
+        if (!l) return r;
+        if (!r) return l;
+        if (l->leaf() && r->leaf() && l->size + r->size <= MaxChunk) {
+            std::string merged;
+            merged.reserve(l->size + r->size);
+            merged.append(l->chunk);
+            merged.append(r->chunk);
+            return leaf(merged);
+        }
+        auto hl = l->height, hr = r->height;
+        // also descend to a neighboring leaf for small leaves, so that they can be merged
+        // (otherwise appending char by char would create a chunk per char)
+        if (hl > hr + 1 || (r->leaf() && !l->leaf() && r->size < MaxChunk)) {
+            return balanced(l->left, join(l->right, std::move(r)));
+        }
+        if (hr > hl + 1 || (l->leaf() && !r->leaf() && l->size < MaxChunk)) {
+            return balanced(join(std::move(l), r->left), r->right);
+        }
+        return node(std::move(l), std::move(r));
+    }
+
+    static std::pair<NodePtr, NodePtr> split(const NodePtr& n, size_t pos) {
+        if (!n) return {};
+        if (pos == 0) return {NodePtr{}, n};
+        if (pos >= n->size) return {n, NodePtr{}};
+        if (n->leaf()) {
+            std::string_view c = n->chunk;
+            return {leaf(c.substr(0, pos)), leaf(c.substr(pos))};
+        }
+        auto ls = n->left->size;
+        if (pos <= ls) {
+            auto [a, b] = split(n->left, pos);
+            return {std::move(a), join(std::move(b), n->right)};
+        }
+        auto [a, b] = split(n->right, pos - ls);
+        return {join(n->left, std::move(a)), std::move(b)};
+    }
+
+    static NodePtr build(std::string_view str) {
+        if (str.empty()) return {};
+        std::vector<NodePtr> leaves;
+        leaves.reserve((str.size() + MaxChunk - 1) / MaxChunk);
+        while (!str.empty()) {
+            auto n = std::min(str.size(), MaxChunk);
+            leaves.push_back(leaf(str.substr(0, n)));
+            str.remove_prefix(n);
+        }
+        return build(leaves, 0, leaves.size());
+    }
+
+    // perfectly balanced tree from the leaves in [b, e)
+    static NodePtr build(std::vector<NodePtr>& leaves, size_t b, size_t e) {
+        if (e - b == 1) return std::move(leaves[b]);
+        auto mid = b + (e - b) / 2;
+        return node(build(leaves, b, mid), build(leaves, mid, e));
+    }
+};
+
+using Rope = BasicRope<>;
+
+} // namespace kuzco
@@ -0,0 +1,134 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Node.hpp"
+#include "Reclaimer.hpp"
+#include "VersionSignal.hpp"
+#include <itlib/atomic_shared_ptr_storage.hpp>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+namespace kuzco {
+
+// A drop-in alternative of AtomicDetachedStorage with sharded reference counting
+//
+// With AtomicDetachedStorage all snapshots of the current value share its control block. When
+// many threads copy and drop them, the refcount becomes the most contended cache line.
+// Here each stored value gets a separate control block per shard, each holding a single ref to
+// the value. Threads are assigned to shards round-robin, and snapshots loaded by a thread only
+// touch the refcount of its shard.
+// When a new value is stored, the shards of the old value are reconciled as they are released:
+// the ref of each shard is dropped when the last snapshot from it is.
+//
+// Use it as the storage of SharedState: SharedState<T, ShardedDetachedStorage<T>>
+//
+// Notes:
+// * the shards are stored one by one, so for a moment threads on different shards may see
+//   different values. A single thread always sees the values in order.
+// * snapshots from different shards share the object, but not the control block. Thus identity
+//   checks with sameAs work, but fingerprints of snapshots and nodes differ.
+// * pin tracking (see PinTracker.hpp) is not supported, so SharedState::setPinTracker and
+//   SharedState::detach(site) are not available with this storage.
+template <typename T, size_t NumShards = 16>
+class ShardedDetachedStorage {
+public:
+    static_assert(NumShards > 0);
+    using AtomicStorage = itlib::atomic_shared_ptr_storage<const T>;
+
+    ShardedDetachedStorage() = default;
+    explicit ShardedDetachedStorage(Detached<T> ptr)
+        : m_version(1)
+    {
+        storeShards(std::move(ptr));
+    }
+    explicit ShardedDetachedStorage(const Node<T>& node)
+        : ShardedDetachedStorage(node.detach())
+    {}
+
+    ShardedDetachedStorage(const ShardedDetachedStorage&) = delete;
+    ShardedDetachedStorage& operator=(const ShardedDetachedStorage&) = delete;
+
+    static constexpr size_t numShards() noexcept { return NumShards; }
+
+    // the shard of the current thread
+    static size_t currentShard() noexcept {
+        static std::atomic<size_t> next = 0;
+        static thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed) % NumShards;
+        return shard;
+    }
+
+    Detached<T> load() const {
+        return Detached<T>::_from_shared_ptr_unsafe(m_shards[currentShard()].storage.load());
+    }
+    Detached<T> detach() const {
+        return load();
+    }
+
+    void store(Detached<T> ptr) {
+        if (m_reclaimer) {
+            ptr = m_reclaimer->wrap(std::move(ptr));
+        }
+        storeShards(std::move(ptr));
+        m_version.bump();
+    }
+    void store(const Node<T>& node) {
+        store(node.detach());
+    }
+
+    // the same as in AtomicDetachedStorage
+
+    uint64_t version() const noexcept {
+        return m_version.version();
+    }
+
+    Detached<T> detachIfNewer(uint64_t& version) const {
+        auto v = this->version();
+        if (v <= version) return {};
+        version = v;
+        return load();
+    }
+
+    template <typename Rep, typename Period>
+    uint64_t waitForVersion(uint64_t version, std::chrono::duration<Rep, Period> timeout) const {
+        return m_version.waitFor(version, timeout);
+    }
+    uint64_t waitForVersion(uint64_t version) const {
+        return m_version.waitFor(version);
+    }
+
+    void setReclaimer(Reclaimer* reclaimer) noexcept {
+        m_reclaimer = reclaimer;
+    }
+    Reclaimer* reclaimer() const noexcept {
+        return m_reclaimer;
+    }
+
+private:
+    void storeShards(Detached<T> ptr) {
+        auto obj = ptr.get();
+        for (auto& shard : m_shards) {
+            std::shared_ptr<const T> sp;
+            if (obj) {
+                // the shard's control block holds a ref to the value
+                sp = std::shared_ptr<const T>(std::make_shared<Detached<T>>(ptr), obj);
+            }
+            shard.storage.store(std::move(sp));
+        }
+    }
+
+    struct alignas(64) Shard {
+        AtomicStorage storage;
+    };
+    std::array<Shard, NumShards> m_shards;
+
+    Reclaimer* m_reclaimer = nullptr;
+
+    VersionSignal m_version;
+};
+
+} // namespace kuzco
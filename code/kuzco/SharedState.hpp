@@ -0,0 +1,350 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Node.hpp"
+#include "NodeTransaction.hpp"
+#include "AtomicDetachedStorage.hpp"
+#include "FifoMutex.hpp"
+
+#include <mutex>
+#include <utility>
+#include <coroutine>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace kuzco {
+
+class Journal;
+
+// a shared state which multiple threads can
+// * read: atomically load
+// * write: transaction which atomically stores the new state on commit
+//
+// writers are served in FIFO order
+// a coroutine can wait for its transaction without blocking the thread:
+//
+//     auto t = co_await state.transactionAsync(executor);
+//     t->value = 5;
+//     co_await t.commitAsync();
+//
+// the coroutine is resumed on the provided executor (any object with post(callable))
+//
+// the storage of the published state can be AtomicDetachedStorage or ShardedDetachedStorage
+//
+// with a journal (see Journal.hpp) each transaction can record its operation, which is appended
+// to the journal on commit (only code which sets a journal needs to include Journal.hpp)
+//
+// with setSkipEqualCommits, commits of values which are deeply equal to the previous state (see
+// DeepEqual.hpp) keep the previous state: nothing is published and readers see no new version
+
+template <typename T, typename Storage = AtomicDetachedStorage<T>>
+class SharedState {
+public:
+    SharedState(Node<T> obj)
+        : m_sharedNode(obj)
+        , m_root(std::move(obj))
+    {}
+
+    SharedState(const SharedState&) = delete;
+    SharedState& operator=(const SharedState&) = delete;
+    SharedState(SharedState&&) = delete;
+    SharedState& operator=(SharedState&&) = delete;
+
+private:
+    using RevertIfEqual = bool (*)(NodeTransaction<T>&);
+
+    // the journal is accessed through these so that they are only instantiated by setJournal
+    struct JournalOps {
+        uint64_t (*append)(Journal& journal, std::string_view record);
+        uint64_t (*lastLsn)(const Journal& journal);
+        void (*checkpoint)(Journal& journal, uint64_t lsn);
+    };
+public:
+    class Transaction : private std::unique_lock<FifoMutex>, private NodeTransaction<T> {
+        // NOTE:
+        // since m_root is never unique at the beginning of a transaction (there is a strong ref in m_sharedNode).
+        // the restore state from NodeTransaction comes at practically no additional cost
+
+        Storage& m_sharedNode;
+
+        Journal* m_journal;
+        const JournalOps* m_journalOps;
+        RevertIfEqual m_revertIfEqual;
+        std::string m_record;
+        bool m_hasRecord = false;
+        uint64_t m_lsn = 0;
+
+        using NT = NodeTransaction<T>;
+    public:
+        Transaction(SharedState& state)
+            : std::unique_lock<FifoMutex>(state.m_transactionMutex)
+            , NT(state.m_root)
+            , m_sharedNode(state.m_sharedNode)
+            , m_journal(state.m_journal)
+            , m_journalOps(state.m_journalOps)
+            , m_revertIfEqual(state.m_revertIfEqual)
+        {}
+
+        // the transaction mutex must already be locked
+        Transaction(SharedState& state, std::adopt_lock_t)
+            : std::unique_lock<FifoMutex>(state.m_transactionMutex, std::adopt_lock)
+            , NT(state.m_root)
+            , m_sharedNode(state.m_sharedNode)
+            , m_journal(state.m_journal)
+            , m_journalOps(state.m_journalOps)
+            , m_revertIfEqual(state.m_revertIfEqual)
+        {}
+
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+        using NT::done;
+        using NT::active;
+        using NT::revert;
+        using NT::restoreState;
+
+        // set the journal record of the transaction: the serialized operation which it performs
+        // (a transaction has a single record, so it's replayed atomically)
+        // the record is appended on commit if the state changed and dropped on abort
+        // it's ignored if the state has no journal
+        void journal(std::string record) {
+            if (!m_journal) return;
+            m_record = std::move(record);
+            m_hasRecord = true;
+        }
+
+        // lsn of the record appended by commit (zero if none)
+        uint64_t lsn() const noexcept { return m_lsn; }
+
+        // complete reverting changes
+        void abort() {
+            NT::abort();
+            m_hasRecord = false;
+            this->unlock();
+        }
+
+        // complete committing changes
+        // return value: pair of (new detached state, whether state changed)
+        std::pair<Detached<T>, bool> commit() {
+            if (m_revertIfEqual) m_revertIfEqual(*this);
+
+            if (m_hasRecord) {
+                // write ahead: log before publishing
+                if (this->detach() != restoreState()) {
+                    try {
+                        m_lsn = m_journalOps->append(*m_journal, m_record);
+                    }
+                    catch (...) {
+                        abort();
+                        throw;
+                    }
+                }
+                m_hasRecord = false;
+            }
+
+            auto ret = std::make_pair(this->detach(), NT::commit());
+
+            if (ret.second) {
+                // store state
+                m_sharedNode.store(ret.first);
+            }
+
+            this->unlock();
+            return ret;
+        }
+
+        class CommitAwaiter {
+        public:
+            explicit CommitAwaiter(Transaction& t) : m_transaction(t) {}
+
+            // commits are currently synchronous, so this never suspends
+            // awaiting them allows commits to become asynchronous without changing the callers
+            bool await_ready() const noexcept { return true; }
+            void await_suspend(std::coroutine_handle<>) const noexcept {}
+            std::pair<Detached<T>, bool> await_resume() { return m_transaction.commit(); }
+        private:
+            Transaction& m_transaction;
+        };
+
+        // co_await-able commit
+        // the result is the same as the one of commit()
+        [[nodiscard]] CommitAwaiter commitAsync() {
+            return CommitAwaiter(*this);
+        }
+
+        // complete, either committing or aborting based on commit flag
+        // return value: pair of (new detached state, whether state changed)
+        std::pair<Detached<T>, bool> complete(bool commit = true) {
+            if (!commit) {
+                auto ret = std::make_pair(restoreState(), false);
+                abort();
+                return ret;
+            }
+            return this->commit();
+        }
+
+        using NT::operator->;
+        using NT::r;
+        using NT::cow;
+
+        ~Transaction() {
+            if (!active()) {
+                // explicitly or implicitly completed
+                return;
+            }
+
+            if (std::uncaught_exceptions()) {
+                // something bad is happening, abort
+                abort();
+            }
+            else {
+                commit();
+            }
+        }
+    };
+
+    Transaction transaction() {
+        return Transaction(*this);
+    }
+
+    template <typename Executor>
+    class TransactionAwaiter {
+    public:
+        TransactionAwaiter(SharedState& state, Executor& executor)
+            : m_state(state)
+            , m_lock(state.m_transactionMutex, executor)
+        {}
+
+        bool await_ready() { return m_lock.await_ready(); }
+        bool await_suspend(std::coroutine_handle<> h) { return m_lock.await_suspend(h); }
+        Transaction await_resume() { return Transaction(m_state, std::adopt_lock); }
+    private:
+        SharedState& m_state;
+        typename FifoMutex::template LockAwaiter<Executor> m_lock;
+    };
+
+    // co_await-able transaction
+    // if the writer slot is taken, the coroutine is suspended and then resumed on the executor
+    // the coroutine must not be destroyed while it's waiting
+    template <typename Executor>
+    [[nodiscard]] TransactionAwaiter<Executor> transactionAsync(Executor& executor) {
+        return TransactionAwaiter<Executor>(*this, executor);
+    }
+
+    // enable (or disable with null) the deferred reclamation of snapshots (see Reclaimer.hpp)
+    // the current state is republished, so that it's also reclaimed
+    // the reclaimer must outlive the transactions which follow
+    void setReclaimer(Reclaimer* reclaimer) {
+        std::lock_guard<FifoMutex> lock(m_transactionMutex);
+        m_sharedNode.setReclaimer(reclaimer);
+        m_sharedNode.store(m_root);
+    }
+
+    // enable (or disable with null) the tracking of pinned snapshots (see PinTracker.hpp)
+    // the current state is republished, so that it's also tracked
+    // the tracker must outlive the transactions and the tagged detaches which follow
+    // only available with storages which support pin tracking (AtomicDetachedStorage)
+    void setPinTracker(PinTracker* tracker) requires requires(Storage& s, PinTracker* t) { s.setPinTracker(t); } {
+        std::lock_guard<FifoMutex> lock(m_transactionMutex);
+        m_sharedNode.setPinTracker(tracker);
+        m_sharedNode.store(m_root);
+    }
+
+    // enable or disable the suppression of commits which don't change the value
+    // commits compare the new value with the previous one (short-circuiting on shared nodes) and
+    // keep the previous one if they are equal
+    // WARNING: types compared by their fields ignore the members which are not described, so a
+    // transaction which only changes such members is reverted and the write is lost
+    // describe all members of such types or give them an operator== (see DeepEqual.hpp)
+    void setSkipEqualCommits(bool skip) requires DeepEqualityComparable<T> {
+        std::lock_guard<FifoMutex> lock(m_transactionMutex);
+        m_revertIfEqual = skip ? &revertIfEqual : nullptr;
+    }
+
+    // enable (or disable with null) the journal of transactions
+    // the journal must outlive the transactions which follow
+    void setJournal(Journal* journal) {
+        std::lock_guard<FifoMutex> lock(m_transactionMutex);
+        m_journal = journal;
+        m_journalOps = &journalOps<Journal>;
+    }
+
+    // save a snapshot with save(Detached<T>, uint64_t lsn) and drop the journal records up to
+    // lsn (contained in the snapshot)
+    // the transaction lock is held only while taking the snapshot, not while saving it
+    template <typename Save>
+    void checkpoint(Save save) {
+        Journal* journal;
+        const JournalOps* ops;
+        Detached<T> snapshot;
+        uint64_t lsn = 0;
+        {
+            std::lock_guard<FifoMutex> lock(m_transactionMutex);
+            journal = m_journal;
+            ops = m_journalOps;
+            snapshot = m_sharedNode.detach();
+            if (journal) lsn = ops->lastLsn(*journal);
+        }
+        save(std::move(snapshot), lsn);
+        if (journal) ops->checkpoint(*journal, lsn);
+    }
+
+    // atomic snapshot of the current state
+    Detached<T> detach() const {
+        return m_sharedNode.detach();
+    }
+
+    // snapshot tagged with the acquisition site, if pin tracking is enabled
+    // only available with storages which support pin tracking (AtomicDetachedStorage)
+    Detached<T> detach(std::string_view site) const requires requires(const Storage& s, std::string_view site) { s.detach(site); } {
+        return m_sharedNode.detach(site);
+    }
+
+    // the version is incremented by each commit which changes the state (and by setReclaimer and
+    // setPinTracker)
+    // see AtomicDetachedStorage
+    uint64_t version() const noexcept {
+        return m_sharedNode.version();
+    }
+
+    Detached<T> detachIfNewer(uint64_t& version) const {
+        return m_sharedNode.detachIfNewer(version);
+    }
+
+    template <typename Rep, typename Period>
+    uint64_t waitForVersion(uint64_t version, std::chrono::duration<Rep, Period> timeout) const {
+        return m_sharedNode.waitForVersion(version, timeout);
+    }
+
+    uint64_t waitForVersion(uint64_t version) const {
+        return m_sharedNode.waitForVersion(version);
+    }
+
+protected:
+    Storage m_sharedNode;
+
+    FifoMutex m_transactionMutex;
+    Journal* m_journal = nullptr;
+    const JournalOps* m_journalOps = nullptr;
+    template <typename J>
+    static constexpr JournalOps journalOps = {
+        [](J& journal, std::string_view record) { return journal.append(record); },
+        [](const J& journal) { return journal.lastLsn(); },
+        [](J& journal, uint64_t lsn) { journal.checkpoint(lsn); },
+    };
+
+    // set by setSkipEqualCommits
+    // deepEqual is only instantiated for states which enable it
+    RevertIfEqual m_revertIfEqual = nullptr;
+    static bool revertIfEqual(NodeTransaction<T>& t) requires DeepEqualityComparable<T> {
+        return t.revertIfEqual();
+    }
+
+    // mutable root, modified during transaction, not thread safe
+    Node<T> m_root;
+};
+
+} // namespace kuzco
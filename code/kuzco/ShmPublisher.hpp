@@ -0,0 +1,594 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Persist.hpp"
+
+#if defined(_WIN32)
+#error "kuzco::ShmPublisher requires POSIX shared memory"
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kuzco {
+
+// Publication of snapshots to other processes through shared memory
+//
+// ShmPublisher serializes snapshots (with PersistTraits, see Persist.hpp) to a shared memory
+// region. Processes which attach to the region with ShmReader get the last published snapshot.
+//
+// Like SnapshotStore, the publisher remembers the nodes which it has written and publishing a
+// snapshot only writes its new nodes. The rest of the nodes are referenced in place. The publisher
+// holds refs to the written nodes, so that they are copied on write instead of being modified in
+// place (which it wouldn't notice).
+// Readers get either zero-copy views of the records in the region (ShmSnapshot), or load the
+// snapshot as nodes. Loading reuses the nodes loaded for previous versions which are unchanged,
+// so a reader only decodes what changed between the versions.
+//
+// Records are never modified after they are written, so readers don't block the publisher and
+// vice versa. The data area is split in two halves. Records are appended to the active one, and
+// when it gets full the publisher switches to the other one and writes the entire snapshot
+// there. This starts a new epoch. A reader detects that data of its snapshot was overwritten
+// (two switches happened while it was reading) and retries.
+//
+// The region is either named (shm_open) or anonymous (memfd_create on Linux), in which case the
+// readers get its file descriptor from the publisher process (through fork or a unix socket).
+
+// a mapped shared memory object
+class ShmRegion {
+public:
+    ShmRegion() noexcept = default;
+
+    ShmRegion(ShmRegion&& other) noexcept
+        : m_fd(std::exchange(other.m_fd, -1))
+        , m_data(std::exchange(other.m_data, nullptr))
+        , m_size(std::exchange(other.m_size, 0))
+        , m_writable(other.m_writable)
+    {}
+
+    ShmRegion& operator=(ShmRegion&& other) noexcept {
+        if (this == &other) return *this;
+        close();
+        m_fd = std::exchange(other.m_fd, -1);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_writable = other.m_writable;
+        return *this;
+    }
+
+    ~ShmRegion() { close(); }
+
+    // open or create a named object for writing
+    // a new object is resized to size, an existing one must already have it
+    static ShmRegion create(const std::string& name, size_t size) {
+        int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0) throw std::runtime_error("kuzco::ShmRegion: can't create " + name);
+        return fromFd(fd, true, size);
+    }
+
+    // open an existing named object for reading
+    static ShmRegion open(const std::string& name) {
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) throw std::runtime_error("kuzco::ShmRegion: can't open " + name);
+        return fromFd(fd, false, 0);
+    }
+
+#if defined(__linux__)
+    // create an anonymous object for writing
+    static ShmRegion createAnonymous(size_t size) {
+        int fd = ::memfd_create("kuzco", MFD_CLOEXEC);
+        if (fd < 0) throw std::runtime_error("kuzco::ShmRegion: memfd_create failed");
+        return fromFd(fd, true, size);
+    }
+#endif
+
+    // map an object by its file descriptor and take ownership of it
+    // size is only used to resize a new (empty) object
+    static ShmRegion fromFd(int fd, bool writable, size_t size = 0) {
+        ShmRegion ret;
+        ret.m_fd = fd;
+        ret.m_writable = writable;
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0) throw std::runtime_error("kuzco::ShmRegion: fstat failed");
+        auto cur = size_t(st.st_size);
+        if (writable && cur == 0 && size) {
+            if (::ftruncate(fd, off_t(size)) != 0) throw std::runtime_error("kuzco::ShmRegion: ftruncate failed");
+            cur = size;
+        }
+        if (cur == 0) throw std::runtime_error("kuzco::ShmRegion: empty object");
+        if (size && cur != size) throw std::runtime_error("kuzco::ShmRegion: object exists with a different size");
+
+        auto prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        auto data = ::mmap(nullptr, cur, prot, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) throw std::runtime_error("kuzco::ShmRegion: mmap failed");
+        ret.m_data = static_cast<char*>(data);
+        ret.m_size = cur;
+        return ret;
+    }
+
+    // remove a named object (mapped regions remain valid)
+    static void unlink(const std::string& name) noexcept {
+        ::shm_unlink(name.c_str());
+    }
+
+    explicit operator bool() const noexcept { return !!m_data; }
+
+    int fd() const noexcept { return m_fd; }
+    char* data() const noexcept { return m_data; }
+    size_t size() const noexcept { return m_size; }
+    bool writable() const noexcept { return m_writable; }
+
+private:
+    void close() noexcept {
+        if (m_data) ::munmap(m_data, m_size);
+        if (m_fd >= 0) ::close(m_fd);
+        m_data = nullptr;
+        m_fd = -1;
+    }
+
+    int m_fd = -1;
+    char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_writable = false;
+};
+
+struct ShmPublishStats {
+    uint64_t version = 0;
+
+    size_t nodesWritten = 0;
+    size_t nodesReused = 0;
+    uint64_t bytesWritten = 0;
+
+    // the snapshot didn't fit in the active half and was written entirely to the other one
+    bool switched = false;
+};
+
+namespace impl {
+struct ShmFormat {
+    static constexpr uint64_t magic = 0x314d5a4b; // "KZM1"
+
+    // all fields are accessed atomically
+    // seq is odd while the publisher updates version, epoch, and root
+    struct Header {
+        uint64_t magic; // written last
+        uint64_t size; // of the region
+        uint64_t seq;
+        uint64_t version;
+        uint64_t epoch; // of the root
+        uint64_t root; // offset of the root record
+        uint64_t fillEpoch; // epoch of the half which is being written
+        uint64_t reserved[9];
+    };
+    static_assert(sizeof(Header) == 128);
+
+    static constexpr uint64_t dataOffset = sizeof(Header);
+
+    // 8-aligned records
+    // followed by the offsets of the children (zero for null ones) and the payload
+    struct RecordHeader {
+        uint32_t payloadSize;
+        uint32_t numChildren;
+    };
+
+    static constexpr uint64_t align(uint64_t size) noexcept { return (size + 7) & ~uint64_t(7); }
+
+    static uint64_t recordSize(uint64_t numChildren, uint64_t payloadSize) noexcept {
+        return sizeof(RecordHeader) + numChildren * sizeof(uint64_t) + align(payloadSize);
+    }
+
+    static uint64_t halfSize(uint64_t regionSize) noexcept {
+        return ((regionSize - dataOffset) / 2) & ~uint64_t(7);
+    }
+
+    static uint64_t halfBegin(uint64_t regionSize, uint64_t epoch) noexcept {
+        return dataOffset + (epoch % 2) * halfSize(regionSize);
+    }
+
+    static uint64_t load(const uint64_t& field, std::memory_order order = std::memory_order_relaxed) noexcept {
+        // mappings of readers are read-only, but atomic loads don't write
+        return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(field)).load(order);
+    }
+
+    static void store(uint64_t& field, uint64_t value, std::memory_order order = std::memory_order_relaxed) noexcept {
+        std::atomic_ref<uint64_t>(field).store(value, order);
+    }
+};
+} // namespace impl
+
+// a zero-copy view of a record in the region
+// the contents may be overwritten by the publisher, so use ShmReader::valid() after reading them
+class ShmNodeView {
+    using Format = impl::ShmFormat;
+public:
+    ShmNodeView() noexcept = default;
+
+    // throws if the record is out of the bounds of the region
+    ShmNodeView(const char* region, uint64_t regionSize, uint64_t offset)
+        : m_region(region)
+        , m_regionSize(regionSize)
+        , m_offset(offset)
+    {
+        if (!offset) return;
+        if (offset < Format::dataOffset || offset % 8 || offset + sizeof(Format::RecordHeader) > regionSize) {
+            throw std::runtime_error("kuzco::ShmNodeView: bad record");
+        }
+        std::memcpy(&m_header, region + offset, sizeof(m_header));
+        if (offset + Format::recordSize(m_header.numChildren, m_header.payloadSize) > regionSize) {
+            throw std::runtime_error("kuzco::ShmNodeView: bad record");
+        }
+    }
+
+    explicit operator bool() const noexcept { return !!m_offset; }
+
+    uint64_t offset() const noexcept { return m_offset; }
+
+    std::string_view payload() const noexcept {
+        auto p = m_region + m_offset + sizeof(Format::RecordHeader) + m_header.numChildren * sizeof(uint64_t);
+        return {p, m_header.payloadSize};
+    }
+
+    size_t numChildren() const noexcept { return m_header.numChildren; }
+
+    uint64_t childOffset(size_t i) const {
+        if (i >= numChildren()) throw std::out_of_range("kuzco::ShmNodeView: bad child index");
+        uint64_t ret;
+        std::memcpy(&ret, m_region + m_offset + sizeof(Format::RecordHeader) + i * sizeof(uint64_t), sizeof(ret));
+        // children are written before their parents
+        if (ret >= m_offset) throw std::runtime_error("kuzco::ShmNodeView: bad record");
+        return ret;
+    }
+
+    // a null view for null children
+    ShmNodeView child(size_t i) const {
+        return ShmNodeView(m_region, m_regionSize, childOffset(i));
+    }
+
+private:
+    const char* m_region = nullptr;
+    uint64_t m_regionSize = 0;
+    uint64_t m_offset = 0;
+    Format::RecordHeader m_header = {};
+};
+
+struct ShmSnapshot {
+    uint64_t version = 0; // zero if nothing is published
+    uint64_t epoch = 0;
+    ShmNodeView root;
+};
+
+class ShmPublisher : private impl::PersistNodeSink {
+    using Format = impl::ShmFormat;
+public:
+    // create a named region or continue publishing to an existing one
+    // (readers which are attached to it keep working)
+    ShmPublisher(const std::string& name, size_t size)
+        : ShmPublisher(ShmRegion::create(name, size))
+    {}
+
+    explicit ShmPublisher(ShmRegion region)
+        : m_region(std::move(region))
+    {
+        if (!m_region.writable()) throw std::invalid_argument("kuzco::ShmPublisher: region is not writable");
+        if (m_region.size() < Format::dataOffset + 1024) throw std::invalid_argument("kuzco::ShmPublisher: region is too small");
+
+        auto& h = header();
+        if (Format::load(h.magic, std::memory_order_acquire) == Format::magic && h.size == m_region.size()) {
+            // continue in the epoch after the one of the published root, as the previous publisher
+            // may have been appending to its half
+            // (if it crashed while switching halves, the other half only has unpublished data and
+            // can be reused)
+            // a publisher may have crashed while updating the header
+            auto seq = Format::load(h.seq);
+            if (seq % 2) Format::store(h.seq, seq + 1);
+            m_version = Format::load(h.version);
+            m_epoch = Format::load(h.epoch) + 1;
+        }
+        else {
+            std::memset(&h, 0, sizeof(h));
+            h.size = m_region.size();
+            m_epoch = 1;
+        }
+        startEpoch();
+        Format::store(h.magic, Format::magic, std::memory_order_release);
+    }
+
+    ShmPublisher(const ShmPublisher&) = delete;
+    ShmPublisher& operator=(const ShmPublisher&) = delete;
+
+    const ShmRegion& region() const noexcept { return m_region; }
+
+    // the last published version (versions start from one)
+    uint64_t version() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_version;
+    }
+
+    // write the new nodes of the snapshot and make it the current one for readers
+    // throws std::length_error if the snapshot doesn't fit in half of the region
+    template <typename T>
+    ShmPublishStats publish(const Detached<T>& root) {
+        if (!root) throw std::invalid_argument("kuzco::ShmPublisher: null root");
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats = {};
+        uint64_t offset;
+        try {
+            offset = persist(root);
+        }
+        catch (Full&) {
+            // rewrite everything in the other half
+            ++m_epoch;
+            startEpoch();
+            m_stats = {};
+            m_stats.switched = true;
+            try {
+                offset = persist(root);
+            }
+            catch (Full&) {
+                throw std::length_error("kuzco::ShmPublisher: snapshot doesn't fit in the region");
+            }
+        }
+
+        auto& h = header();
+        auto seq = Format::load(h.seq);
+        Format::store(h.seq, seq + 1);
+        std::atomic_thread_fence(std::memory_order_release);
+        Format::store(h.version, ++m_version);
+        Format::store(h.epoch, m_epoch);
+        Format::store(h.root, offset);
+        Format::store(h.seq, seq + 2, std::memory_order_release);
+
+        if (m_known.size() >= 2 * m_knownAfterPrune) {
+            releaseUnused();
+            m_knownAfterPrune = std::max(m_known.size(), size_t(1024));
+        }
+
+        m_stats.version = m_version;
+        return m_stats;
+    }
+
+    template <typename T>
+    ShmPublishStats publish(const OptNode<T>& root) {
+        return publish(root.detach());
+    }
+
+private:
+    struct Full {};
+
+    Format::Header& header() noexcept {
+        return *reinterpret_cast<Format::Header*>(m_region.data());
+    }
+
+    // start writing to the half of the current epoch
+    // readers of its previous contents detect that they are overwritten with fillEpoch
+    void startEpoch() {
+        m_known.clear();
+        m_knownAfterPrune = 1024;
+        m_used = Format::halfBegin(m_region.size(), m_epoch);
+        m_end = m_used + Format::halfSize(m_region.size());
+        Format::store(header().fillEpoch, m_epoch);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    template <typename T>
+    uint64_t persist(const Detached<T>& obj) {
+        return persistNode(obj._as_shared_ptr_unsafe(), impl::persistNodeType<T>).a;
+    }
+
+    virtual NodeId persistNode(const std::shared_ptr<const void>& obj, const impl::PersistNodeType& type) override {
+        const void* addr = obj.get();
+        // known objects are not modified, as the ref of the publisher makes them non-unique
+        auto known = m_known.find(addr);
+        if (known != m_known.end()) {
+            ++m_stats.nodesReused;
+            return {known->second.offset, 0};
+        }
+
+        PersistWriter w(*this);
+        type.save(addr, w);
+        auto& children = w.children();
+        auto payload = w.payload();
+
+        auto size = Format::recordSize(children.size(), payload.size());
+        if (size > m_end - m_used) throw Full{};
+
+        auto offset = m_used;
+        auto p = m_region.data() + offset;
+        Format::RecordHeader h{uint32_t(payload.size()), uint32_t(children.size())};
+        std::memcpy(p, &h, sizeof(h));
+        p += sizeof(h);
+        for (auto& c : children) {
+            std::memcpy(p, &c.a, sizeof(uint64_t));
+            p += sizeof(uint64_t);
+        }
+        if (!payload.empty()) std::memcpy(p, payload.data(), payload.size());
+        m_used += size;
+
+        ++m_stats.nodesWritten;
+        m_stats.bytesWritten += size;
+
+        m_known[addr] = Known{obj, offset};
+        return {offset, 0};
+    }
+
+    // release the objects which only the publisher references
+    // releasing an object can leave its children only referenced by the publisher, so repeat
+    void releaseUnused() {
+        while (std::erase_if(m_known, [](auto& e) { return e.second.obj.use_count() == 1; }));
+    }
+
+    ShmRegion m_region;
+
+    mutable std::mutex m_mutex;
+
+    uint64_t m_version = 0;
+    uint64_t m_epoch = 0;
+
+    // free space of the active half
+    uint64_t m_used = 0;
+    uint64_t m_end = 0;
+
+    // written objects
+    struct Known {
+        std::shared_ptr<const void> obj;
+        uint64_t offset;
+    };
+    std::unordered_map<const void*, Known> m_known;
+    size_t m_knownAfterPrune = 1024;
+
+    ShmPublishStats m_stats;
+};
+
+// attaches to a region of a publisher
+// a reader is not thread safe
+class ShmReader : private impl::PersistNodeSource {
+    using Format = impl::ShmFormat;
+public:
+    explicit ShmReader(const std::string& name)
+        : ShmReader(ShmRegion::open(name))
+    {}
+
+    explicit ShmReader(ShmRegion region)
+        : m_region(std::move(region))
+    {
+        if (m_region.size() < Format::dataOffset) throw std::runtime_error("kuzco::ShmReader: region is too small");
+    }
+
+    ShmReader(const ShmReader&) = delete;
+    ShmReader& operator=(const ShmReader&) = delete;
+
+    const ShmRegion& region() const noexcept { return m_region; }
+
+    // the current version (zero if nothing is published)
+    uint64_t version() const noexcept {
+        auto& h = header();
+        if (Format::load(h.magic, std::memory_order_acquire) != Format::magic) return 0;
+        return Format::load(h.version, std::memory_order_acquire);
+    }
+
+    // a zero-copy view of the current snapshot
+    ShmSnapshot snapshot() const {
+        auto& h = header();
+        ShmSnapshot ret;
+        if (Format::load(h.magic, std::memory_order_acquire) != Format::magic) return ret;
+
+        uint64_t root;
+        while (true) {
+            auto seq = Format::load(h.seq, std::memory_order_acquire);
+            if (seq % 2) continue;
+            ret.version = Format::load(h.version);
+            ret.epoch = Format::load(h.epoch);
+            root = Format::load(h.root);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (Format::load(h.seq) == seq) break;
+        }
+
+        if (ret.version) {
+            ret.root = ShmNodeView(m_region.data(), m_region.size(), root);
+        }
+        return ret;
+    }
+
+    // whether the data of the snapshot hasn't been overwritten
+    // check it after reading from the views of the snapshot
+    bool valid(const ShmSnapshot& s) const noexcept {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return Format::load(header().fillEpoch) <= s.epoch + 1;
+    }
+
+    // load the current snapshot (null if nothing is published)
+    template <typename T>
+    OptNode<T> load(uint64_t* version = nullptr) {
+        while (true) {
+            auto s = snapshot();
+            if (version) *version = s.version;
+            if (!s.version) return {};
+
+            if (s.epoch != m_loadedEpoch) {
+                // the records of other epochs are at different offsets
+                m_loaded.clear();
+                m_loadedAfterPrune = 1024;
+                m_loadedEpoch = s.epoch;
+            }
+
+            std::shared_ptr<void> obj;
+            try {
+                obj = loadNode({s.root.offset(), 0}, impl::persistNodeType<T>);
+            }
+            catch (...) {
+                if (valid(s)) throw;
+            }
+
+            if (valid(s)) {
+                forgetUnused();
+                return impl::LoadedNode<T>(std::move(obj));
+            }
+
+            // overwritten while loading, the loaded nodes may be garbage
+            m_loaded.clear();
+        }
+    }
+
+    // load the current snapshot if its version is greater than the provided one
+    // and update the provided one (returns null otherwise)
+    template <typename T>
+    OptNode<T> loadIfNewer(uint64_t& version) {
+        if (this->version() <= version) return {};
+        return load<T>(&version);
+    }
+
+private:
+    const Format::Header& header() const noexcept {
+        return *reinterpret_cast<const Format::Header*>(m_region.data());
+    }
+
+    virtual std::shared_ptr<void> loadNode(const NodeId& id, const impl::PersistNodeType& type) override {
+        if (auto i = m_loaded.find(id.a); i != m_loaded.end()) {
+            return i->second;
+        }
+
+        ShmNodeView view(m_region.data(), m_region.size(), id.a);
+        std::vector<NodeId> children(view.numChildren());
+        for (size_t i = 0; i < children.size(); ++i) {
+            children[i].a = view.childOffset(i);
+        }
+        PersistReader r(*this, std::move(children), view.payload());
+        auto obj = type.load(r);
+
+        m_loaded.emplace(id.a, obj);
+        return obj;
+    }
+
+    // forget the nodes which are no longer referenced when their number may have doubled
+    void forgetUnused() {
+        if (m_loaded.size() < 2 * m_loadedAfterPrune) return;
+        std::erase_if(m_loaded, [](auto& e) { return e.second.use_count() == 1; });
+        m_loadedAfterPrune = std::max(m_loaded.size(), size_t(1024));
+    }
+
+    ShmRegion m_region;
+
+    // offset -> loaded node of the epoch
+    // nodes which are unchanged between versions are shared
+    std::unordered_map<uint64_t, std::shared_ptr<void>> m_loaded;
+    size_t m_loadedAfterPrune = 1024;
+    uint64_t m_loadedEpoch = 0;
+};
+
+} // namespace kuzco
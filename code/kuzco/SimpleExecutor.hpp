@@ -0,0 +1,83 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <cstddef>
+
+namespace kuzco {
+
+// a minimal single-threaded executor
+// tasks can be posted from any thread and are executed by the thread which runs the executor
+// meant for tests and for simple programs which don't have an event loop of their own
+class SimpleExecutor {
+public:
+    SimpleExecutor() = default;
+
+    SimpleExecutor(const SimpleExecutor&) = delete;
+    SimpleExecutor& operator=(const SimpleExecutor&) = delete;
+
+    void post(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_cv.notify_one();
+    }
+
+    // execute ready tasks (including ones posted by them) until there are none
+    // return the number of executed tasks
+    size_t poll() {
+        size_t n = 0;
+        std::function<void()> task;
+        while (pop(task, false)) {
+            task();
+            task = nullptr;
+            ++n;
+        }
+        return n;
+    }
+
+    // execute tasks until stop() is called
+    // (tasks which are already queued when stop() is called are still executed)
+    void run() {
+        std::function<void()> task;
+        while (pop(task, true)) {
+            task();
+            task = nullptr;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = false;
+    }
+
+    // make run() return
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cv.notify_one();
+    }
+
+private:
+    bool pop(std::function<void()>& task, bool wait) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (wait) {
+            m_cv.wait(lock, [this]() { return m_stopped || !m_tasks.empty(); });
+        }
+        if (m_tasks.empty()) return false;
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        return true;
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_stopped = false;
+};
+
+} // namespace kuzco
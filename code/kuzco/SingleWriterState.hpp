@@ -0,0 +1,166 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "SharedState.hpp"
+#include "MpscQueue.hpp"
+
+#include <thread>
+#include <future>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <type_traits>
+#include <algorithm>
+#include <cstdint>
+
+namespace kuzco {
+
+// a shared state with a dedicated writer thread
+//
+// instead of taking the transaction lock, writers post mutations to a lock-free queue
+// the writer thread applies them back to back, keeping the root hot in its cache
+// it can apply several queued mutations (up to maxBatch) per publish
+//
+// a mutation is a callable which takes either T& or NodeTransaction<T>&
+// the latter allows mutations to read and only copy on write when needed
+// each mutation is applied in its own NodeTransaction, so if it throws, only its changes are
+// reverted and only its future gets the exception
+// (note that this means that each mutation in a batch does a CoW of the root)
+//
+// the future result is a pair of (published detached state, whether the mutation changed it)
+// in a batch, all mutations get the same detached state: the one after the entire batch
+// if the commit of the batch reverts it (see setSkipEqualCommits), no mutation changed the state
+// and if the commit throws, all mutations of the batch get the exception
+//
+// transactions are still possible, though they are serialized with the batches of the writer
+// mutations which are posted before the destructor is called are applied before it returns
+template <typename T, typename Storage = AtomicDetachedStorage<T>>
+class SingleWriterState : public SharedState<T, Storage> {
+    using Super = SharedState<T, Storage>;
+public:
+    using Result = std::pair<Detached<T>, bool>;
+
+    explicit SingleWriterState(Node<T> obj, size_t maxBatch = 1)
+        : Super(std::move(obj))
+        , m_maxBatch(std::max(maxBatch, size_t(1)))
+    {
+        m_writer = std::thread([this]() { run(); });
+    }
+
+    ~SingleWriterState() {
+        m_stop.store(true, std::memory_order_release);
+        signal();
+        m_writer.join();
+    }
+
+    template <typename F>
+    std::future<Result> post(F&& f) {
+        auto m = std::make_unique<Mutation>();
+        if constexpr (std::is_invocable_v<F&, NodeTransaction<T>&>) {
+            m->func = std::forward<F>(f);
+        }
+        else {
+            m->func = [f = std::forward<F>(f)](NodeTransaction<T>& t) mutable {
+                f(t.cow());
+            };
+        }
+        auto ret = m->promise.get_future();
+        m_queue.push(m.release());
+        signal();
+        return ret;
+    }
+
+    std::thread::id writerThreadId() const noexcept {
+        return m_writer.get_id();
+    }
+
+    size_t maxBatch() const noexcept {
+        return m_maxBatch;
+    }
+
+private:
+    struct Mutation : public MpscQueueHook {
+        std::function<void(NodeTransaction<T>&)> func;
+        std::promise<Result> promise;
+        bool changed = false;
+        bool failed = false;
+    };
+
+    void signal() {
+        m_signal.fetch_add(1, std::memory_order_release);
+        m_signal.notify_one();
+    }
+
+    void run() {
+        std::vector<std::unique_ptr<Mutation>> batch;
+        batch.reserve(m_maxBatch);
+
+        while (true) {
+            auto signal = m_signal.load(std::memory_order_acquire);
+
+            while (batch.size() < m_maxBatch) {
+                auto m = m_queue.pop();
+                if (!m) break;
+                batch.emplace_back(m);
+            }
+
+            if (batch.empty()) {
+                if (m_stop.load(std::memory_order_acquire)) return;
+                m_signal.wait(signal, std::memory_order_acquire);
+                continue;
+            }
+
+            apply(batch);
+            batch.clear();
+        }
+    }
+
+    void apply(std::vector<std::unique_ptr<Mutation>>& batch) {
+        typename Super::Transaction t(*this);
+
+        for (auto& m : batch) {
+            NodeTransaction<T> nt(this->m_root);
+            try {
+                m->func(nt);
+                m->changed = nt.commit();
+            }
+            catch (...) {
+                nt.abort();
+                m->failed = true;
+                m->promise.set_exception(std::current_exception());
+            }
+        }
+
+        std::pair<Detached<T>, bool> published;
+        try {
+            published = t.commit();
+        }
+        catch (...) {
+            // the batch is not published: all its mutations fail
+            if (t.active()) t.abort();
+            for (auto& m : batch) {
+                if (m->failed) continue;
+                m->promise.set_exception(std::current_exception());
+            }
+            return;
+        }
+
+        for (auto& m : batch) {
+            if (m->failed) continue;
+            // the commit can revert the batch (see setSkipEqualCommits)
+            m->promise.set_value({published.first, m->changed && published.second});
+        }
+    }
+
+    const size_t m_maxBatch;
+
+    MpscQueue<Mutation> m_queue;
+    std::atomic<uint32_t> m_signal = 0;
+    std::atomic<bool> m_stop = false;
+
+    std::thread m_writer;
+};
+
+} // namespace kuzco
@@ -0,0 +1,269 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Node.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <iterator>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace kuzco {
+
+// A NodeVector alternative which keeps its elements contiguously in slabs
+//
+// In a NodeVector each element is a separately allocated node. Iterating over many elements is
+// dominated by cache misses and each element costs a 16-byte ref_ptr in the index.
+// Here elements which are created in bulk (from a range) are allocated in a single immutable
+// slab and referenced by 8-byte handles.
+//
+// A slab is shared between all vectors which reference it. When an element from a slab is
+// modified, it's copied into a standalone node (the overflow) and its handle is updated.
+// Elements which are added one by one also go to the overflow.
+// compact() re-packs all elements into a single new slab
+//
+// Handles are 32-bit, so a slab, the overflow, and the number of slabs are limited to 2^32 - 1
+// (std::length_error is thrown otherwise)
+//
+// Note that compact() copies the elements, so the identities of elements change
+// (Detached elements obtained before it are still valid and keep their slab alive)
+//
+// WARNING: Detached elements of a slab share the ownership of the slab, and fingerprints (see
+// Fingerprint.hpp) compare ownership, not addresses. So the fingerprints of all elements of a slab
+// are equal: Fingerprint(v.detach(i)) == Fingerprint(v.detach(j)). Don't key caches of elements
+// on fingerprints. Compare the addresses of detached elements instead (as long as they are held).
+
+struct SlabHandle {
+    static constexpr uint32_t Overflow = ~uint32_t(0);
+
+    uint32_t slab; // index of slab or Overflow
+    uint32_t index; // index in slab or overflow
+};
+
+template <typename T>
+struct SlabNodeVectorStorage {
+    using Slab = std::vector<T>;
+
+    std::vector<SlabHandle> handles;
+    std::vector<Detached<Slab>> slabs;
+    std::vector<OptNode<T>> overflow;
+    std::vector<uint32_t> freeOverflow;
+
+    const T& r(SlabHandle h) const noexcept {
+        if (h.slab == SlabHandle::Overflow) return overflow[h.index].r();
+        return (*slabs[h.slab])[h.index];
+    }
+};
+
+template <typename T>
+class SlabNodeVector : public Node<SlabNodeVectorStorage<T>> {
+public:
+    using Storage = SlabNodeVectorStorage<T>;
+    using Super = Node<Storage>;
+    using value_type = T;
+    using size_type = size_t;
+private:
+    // hide these dangerous accessors
+    using Super::get;
+    using Super::operator->;
+    using Super::cow;
+public:
+    using Super::r;
+
+    SlabNodeVector() = default;
+
+    // elements are allocated in a single slab
+    template <std::input_iterator InputIt>
+    SlabNodeVector(InputIt first, InputIt last) {
+        append_range(first, last);
+    }
+
+    SlabNodeVector(std::initializer_list<T> ilist)
+        : SlabNodeVector(ilist.begin(), ilist.end())
+    {}
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+
+        reference operator*() const noexcept { return m_storage->r(m_storage->handles[m_index]); }
+        pointer operator->() const noexcept { return &**this; }
+
+        const_iterator& operator++() noexcept { ++m_index; return *this; }
+        const_iterator operator++(int) noexcept { auto ret = *this; ++m_index; return ret; }
+
+        bool operator==(const const_iterator& other) const noexcept = default;
+    private:
+        friend class SlabNodeVector;
+        const_iterator(const Storage* s, size_type i) : m_storage(s), m_index(i) {}
+        const Storage* m_storage = nullptr;
+        size_type m_index = 0;
+    };
+
+    size_type size() const noexcept { return this->r().handles.size(); }
+    bool empty() const noexcept { return this->r().handles.empty(); }
+
+    const T& operator[](size_type i) const noexcept { return r(i); }
+    const T& r(size_type i) const noexcept { return this->r().r(this->r().handles[i]); }
+    const T& front() const noexcept { return r(0); }
+    const T& back() const noexcept { return r(size() - 1); }
+
+    const_iterator begin() const noexcept { return const_iterator(&this->r(), 0); }
+    const_iterator end() const noexcept { return const_iterator(&this->r(), size()); }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    SlabHandle handle(size_type i) const noexcept { return this->r().handles[i]; }
+
+    // a strong ref to an element
+    // elements in slabs keep the entire slab alive and share its fingerprint (see above)
+    Detached<T> detach(size_type i) const {
+        auto& s = this->r();
+        auto h = s.handles[i];
+        if (h.slab == SlabHandle::Overflow) return s.overflow[h.index].detach();
+        auto& slab = s.slabs[h.slab];
+        return Detached<T>::_from_shared_ptr_unsafe(std::shared_ptr<const T>(slab._as_shared_ptr_unsafe(), &(*slab)[h.index]));
+    }
+    using Super::detach;
+
+    template <typename Pred>
+    size_type find_if(Pred f) const {
+        auto& s = this->r();
+        for (size_type i = 0; i < s.handles.size(); ++i) {
+            if (f(s.r(s.handles[i]))) return i;
+        }
+        return size();
+    }
+
+    // item mutator
+    // moves the element out of its slab (if it's in one) and returns it for modification
+    T& modify(size_type i) {
+        auto& s = Super::cow();
+        auto& h = s.handles[i];
+        if (h.slab == SlabHandle::Overflow) {
+            return s.overflow[h.index].cow();
+        }
+        auto slot = allocOverflow(s);
+        s.overflow[slot] = Node<T>((*s.slabs[h.slab])[h.index]);
+        h = {SlabHandle::Overflow, slot};
+        return s.overflow[slot].cow();
+    }
+
+    template <typename... Args>
+    const T& emplace_back(Args&&... args) {
+        auto& s = Super::cow();
+        auto slot = allocOverflow(s);
+        s.overflow[slot] = Node<T>(std::forward<Args>(args)...);
+        s.handles.push_back({SlabHandle::Overflow, slot});
+        return s.overflow[slot].r();
+    }
+
+    void push_back(const T& val) { emplace_back(val); }
+    void push_back(T&& val) { emplace_back(std::move(val)); }
+
+    // the new elements are allocated in a single slab
+    template <std::input_iterator InputIt>
+    void append_range(InputIt first, InputIt last) {
+        auto slab = itlib::make_ref_ptr<typename Storage::Slab>(first, last);
+        if (slab->empty()) return;
+        if (slab->size() > maxHandle || this->r().slabs.size() >= maxHandle) {
+            throw std::length_error("kuzco::SlabNodeVector: too many elements");
+        }
+
+        auto& s = Super::cow();
+        auto slabIndex = uint32_t(s.slabs.size());
+        s.handles.reserve(s.handles.size() + slab->size());
+        for (uint32_t i = 0; i < uint32_t(slab->size()); ++i) {
+            s.handles.push_back({slabIndex, i});
+        }
+        s.slabs.push_back(std::move(slab));
+    }
+
+    template <typename Range>
+    void append_range(const Range& range) {
+        append_range(std::begin(range), std::end(range));
+    }
+
+    void erase(size_type i) {
+        erase(i, i + 1);
+    }
+
+    // erase the elements in [b, e)
+    void erase(size_type b, size_type e) {
+        if (b == e) return;
+        auto& s = Super::cow();
+        for (auto i = b; i != e; ++i) {
+            auto h = s.handles[i];
+            if (h.slab == SlabHandle::Overflow) {
+                s.overflow[h.index].reset();
+                s.freeOverflow.push_back(h.index);
+            }
+            // erased elements in slabs are kept until compact()
+        }
+        s.handles.erase(s.handles.begin() + b, s.handles.begin() + e);
+    }
+
+    void pop_back() {
+        erase(size() - 1);
+    }
+
+    void clear() {
+        Super::operator=(Storage{});
+    }
+
+    // number of elements which are not in slabs
+    size_type overflowSize() const noexcept {
+        auto& s = this->r();
+        return s.overflow.size() - s.freeOverflow.size();
+    }
+
+    size_type slabCount() const noexcept {
+        return this->r().slabs.size();
+    }
+
+    // re-pack all elements in a single new slab
+    void compact() {
+        if (compacted()) return;
+        SlabNodeVector packed(begin(), end());
+        *this = std::move(packed);
+    }
+
+private:
+    static constexpr size_t maxHandle = SlabHandle::Overflow;
+
+    // whether the elements are exactly the elements of a single slab, in order
+    // (the overflow may still have free slots)
+    bool compacted() const noexcept {
+        auto& s = this->r();
+        if (s.handles.empty()) return s.slabs.empty() && s.overflow.empty();
+        if (s.slabs.size() != 1 || s.slabs.front()->size() != s.handles.size()) return false;
+        for (size_t i = 0; i < s.handles.size(); ++i) {
+            auto h = s.handles[i];
+            if (h.slab != 0 || h.index != i) return false;
+        }
+        return true;
+    }
+
+    static uint32_t allocOverflow(Storage& s) {
+        if (!s.freeOverflow.empty()) {
+            auto ret = s.freeOverflow.back();
+            s.freeOverflow.pop_back();
+            return ret;
+        }
+        if (s.overflow.size() >= maxHandle) {
+            throw std::length_error("kuzco::SlabNodeVector: too many elements");
+        }
+        s.overflow.emplace_back();
+        return uint32_t(s.overflow.size() - 1);
+    }
+};
+
+} // namespace kuzco
@@ -0,0 +1,755 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Persist.hpp"
+#include "FileSync.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+
+namespace kuzco {
+
+// Incremental persistence of snapshots
+//
+// Saving the entire state on every checkpoint is wasteful, as typically only a small part of the
+// nodes change between two checkpoints. The rest are shared (pointer-identical) with the
+// previous snapshot.
+// The store remembers the identities of the persisted nodes and a checkpoint only serializes and
+// writes the nodes which are new, plus a root record.
+//
+// Nodes are content-addressed: a node record is identified by a hash of its type tag (see
+// Persist.hpp) and its contents, including the ids of its children. Equal nodes of the same type
+// are stored once, even if they are different objects. Loading a record as a different type
+// throws.
+//
+// The store is a directory with:
+// * segment files (seg-<n>.kzs) with node records. Records are appended to the current segment,
+//   and a new one is started when it reaches segmentSize
+// * a root file (roots.kzr) with a record per checkpoint
+//
+// compact() drops the segments which have no nodes reachable from the last checkpoints. It also
+// copies the reachable nodes of mostly unreachable segments to the current one and drops them.
+// It can be called from a background thread (checkpoints wait for it to complete).
+//
+// A checkpoint or compaction which fails (throws) leaves the store usable: its records which were
+// not synced are dropped and the checkpoints are not changed.
+//
+// Types are serialized by PersistTraits (see Persist.hpp).
+//
+// The store holds refs to the persisted objects, so that they are never unique: nodes copy them
+// on write instead of modifying them in place (which the store wouldn't notice). The objects which
+// only the store references are released when their number may have doubled, or by compact().
+// Node ids are 128-bit non-cryptographic hashes.
+
+struct SnapshotStoreConfig {
+    // a new segment is started when the current one reaches this size
+    uint64_t segmentSize = 64 * 1024 * 1024;
+
+    // compact() rewrites segments with a smaller ratio of reachable bytes
+    double compactLiveRatio = 0.5;
+};
+
+struct CheckpointStats {
+    uint64_t checkpoint = 0;
+
+    size_t nodesWritten = 0;
+    size_t nodesReused = 0; // pointer-identical to persisted ones
+    size_t nodesDeduplicated = 0; // new objects with the contents of persisted ones
+    uint64_t bytesWritten = 0;
+};
+
+struct CompactionStats {
+    size_t liveNodes = 0;
+    size_t segmentsRemoved = 0;
+    size_t nodesCopied = 0;
+    uint64_t bytesCopied = 0;
+    uint64_t bytesFreed = 0;
+};
+
+namespace impl {
+// two differently seeded fnv-1a-like streams with a final mix
+class NodeHasher {
+public:
+    void add(const void* data, size_t size) noexcept {
+        auto p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            m_a = (m_a ^ p[i]) * 0x100000001b3ull;
+            m_b = (m_b ^ p[i]) * 0x9e3779b97f4a7c15ull;
+        }
+        m_size += size;
+    }
+
+    NodeId id() const noexcept {
+        NodeId ret{mix(m_a ^ m_size), mix(m_b + m_size)};
+        if (!ret) ret.a = 1;
+        return ret;
+    }
+
+private:
+    static uint64_t mix(uint64_t x) noexcept {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    uint64_t m_a = 0xcbf29ce484222325ull;
+    uint64_t m_b = 0x84222325cbf29ce4ull;
+    uint64_t m_size = 0;
+};
+
+struct SnapshotFormat {
+    static constexpr char segmentMagic[4] = {'K', 'Z', 'S', '2'};
+    static constexpr char rootsMagic[4] = {'K', 'Z', 'R', '1'};
+    static constexpr size_t fileHeaderSize = 8;
+
+    // followed by the child ids and the payload
+    struct RecordHeader {
+        NodeId id;
+        uint64_t typeTag;
+        uint32_t payloadSize;
+        uint32_t numChildren;
+    };
+    static_assert(sizeof(RecordHeader) == 32);
+
+    // of the payload and the number of children
+    static constexpr uint64_t maxRecordSize = ~uint32_t(0);
+
+    struct RootRecord {
+        uint64_t checkpoint;
+        NodeId id;
+        uint64_t check;
+
+        uint64_t computeCheck() const noexcept {
+            return (checkpoint ^ id.a ^ (id.b << 1)) + 0x5bd1e995ull;
+        }
+    };
+    static_assert(sizeof(RootRecord) == 32);
+
+    static NodeId recordId(uint64_t typeTag, const std::vector<NodeId>& children, std::string_view payload) noexcept {
+        NodeHasher h;
+        h.add(&typeTag, sizeof(typeTag));
+        uint32_t sizes[] = {uint32_t(payload.size()), uint32_t(children.size())};
+        h.add(sizes, sizeof(sizes));
+        h.add(children.data(), children.size() * sizeof(NodeId));
+        h.add(payload.data(), payload.size());
+        return h.id();
+    }
+};
+
+// open segment files during a load or compaction
+class SegmentFiles {
+public:
+    explicit SegmentFiles(const std::filesystem::path& dir) : m_dir(dir) {}
+    ~SegmentFiles() { close(); }
+
+    SegmentFiles(const SegmentFiles&) = delete;
+    SegmentFiles& operator=(const SegmentFiles&) = delete;
+
+    std::FILE* get(uint64_t segment) {
+        auto& f = m_files[segment];
+        if (!f) {
+            auto path = m_dir / ("seg-" + std::to_string(segment) + ".kzs");
+            f = std::fopen(path.string().c_str(), "rb");
+            if (!f) throw std::runtime_error("kuzco::SnapshotStore: can't open " + path.string());
+        }
+        return f;
+    }
+
+    void close() {
+        for (auto& [_, f] : m_files) {
+            std::fclose(f);
+        }
+        m_files.clear();
+    }
+
+private:
+    const std::filesystem::path& m_dir;
+    std::map<uint64_t, std::FILE*> m_files;
+};
+
+struct SnapshotLoadContext {
+    explicit SnapshotLoadContext(const std::filesystem::path& dir) : files(dir) {}
+
+    SegmentFiles files;
+
+    // loaded nodes, so that shared nodes are also shared after loading
+    struct Loaded {
+        std::shared_ptr<void> obj;
+        uint64_t typeTag;
+    };
+    std::unordered_map<NodeId, Loaded, NodeIdHash> loaded;
+};
+} // namespace impl
+
+class SnapshotStore : private impl::PersistNodeSink, private impl::PersistNodeSource {
+    using Format = impl::SnapshotFormat;
+public:
+    // open or create a store in the directory
+    explicit SnapshotStore(std::filesystem::path dir, SnapshotStoreConfig config = {})
+        : m_dir(std::move(dir))
+        , m_config(config)
+    {
+        std::filesystem::create_directories(m_dir);
+        readRoots();
+        scanSegments();
+    }
+
+    ~SnapshotStore() {
+        if (m_segFile) std::fclose(m_segFile);
+    }
+
+    SnapshotStore(const SnapshotStore&) = delete;
+    SnapshotStore& operator=(const SnapshotStore&) = delete;
+
+    const std::filesystem::path& dir() const noexcept { return m_dir; }
+
+    // persist the new nodes of the snapshot and add a checkpoint for it
+    // it's durable when this returns
+    template <typename T>
+    CheckpointStats checkpoint(const Detached<T>& root) {
+        if (!root) throw std::invalid_argument("kuzco::SnapshotStore: null root");
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats = {};
+        auto id = persist(root);
+        if (m_segFile) syncSegment();
+
+        Format::RootRecord rec;
+        rec.checkpoint = (m_roots.empty() ? 0 : m_roots.back().checkpoint) + 1;
+        rec.id = id;
+        rec.check = rec.computeCheck();
+        appendRoot(rec);
+        m_roots.push_back(rec);
+
+        if (m_known.size() >= 2 * m_knownAfterPrune) {
+            releaseUnused();
+            m_knownAfterPrune = std::max(m_known.size(), size_t(1024));
+        }
+
+        m_stats.checkpoint = rec.checkpoint;
+        return m_stats;
+    }
+
+    template <typename T>
+    CheckpointStats checkpoint(const OptNode<T>& root) {
+        return checkpoint(root.detach());
+    }
+
+    // the last checkpoint (zero if there are none)
+    uint64_t lastCheckpoint() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_roots.empty() ? 0 : m_roots.back().checkpoint;
+    }
+
+    std::vector<uint64_t> checkpoints() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<uint64_t> ret;
+        for (auto& r : m_roots) {
+            ret.push_back(r.checkpoint);
+        }
+        return ret;
+    }
+
+    // load the snapshot of a checkpoint (the last one by default)
+    // nodes which are shared in the store are also shared in the result
+    // the loaded nodes are considered persisted, so the following checkpoints are incremental
+    // (like all persisted nodes, they are referenced by the store and copied on write)
+    template <typename T>
+    Node<T> load(uint64_t checkpoint = 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto root = m_roots.end();
+        if (checkpoint) {
+            root = std::find_if(m_roots.begin(), m_roots.end(), [&](auto& r) { return r.checkpoint == checkpoint; });
+        }
+        else if (!m_roots.empty()) {
+            root = m_roots.end() - 1;
+        }
+        if (root == m_roots.end()) {
+            throw std::out_of_range("kuzco::SnapshotStore: no such checkpoint");
+        }
+
+        impl::SnapshotLoadContext ctx(m_dir);
+        m_loadCtx = &ctx;
+        std::shared_ptr<void> obj;
+        try {
+            obj = loadNode(root->id, impl::persistNodeType<T>);
+        }
+        catch (...) {
+            m_loadCtx = nullptr;
+            throw;
+        }
+        m_loadCtx = nullptr;
+        return Node<T>(impl::LoadedNode<T>(std::move(obj)));
+    }
+
+    // drop the checkpoints except for the last keepCheckpoints ones (at least one is kept),
+    // and the nodes which are not reachable from them
+    CompactionStats compact(size_t keepCheckpoints = 1) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        CompactionStats stats;
+
+        // reachable nodes are copied to a new segment
+        closeSegment();
+
+        // the dropped roots are only forgotten when the new roots are durable
+        keepCheckpoints = std::max(keepCheckpoints, size_t(1));
+        std::vector<Format::RootRecord> roots(m_roots.end() - std::min(keepCheckpoints, m_roots.size()), m_roots.end());
+
+        impl::SegmentFiles files(m_dir);
+
+        // mark
+        std::unordered_set<NodeId, impl::NodeIdHash> live;
+        std::vector<NodeId> stack;
+        for (auto& r : roots) {
+            stack.push_back(r.id);
+        }
+        std::vector<NodeId> children;
+        while (!stack.empty()) {
+            auto id = stack.back();
+            stack.pop_back();
+            if (!live.insert(id).second) continue;
+            readRecord(id, files, children, nullptr);
+            for (auto& c : children) {
+                if (c) stack.push_back(c);
+            }
+        }
+        stats.liveNodes = live.size();
+
+        std::map<uint64_t, std::vector<NodeId>> liveBySegment;
+        for (auto& id : live) {
+            liveBySegment[m_index.at(id).segment].push_back(id);
+        }
+
+        // sweep
+        // the copies are indexed when they are durable
+        std::vector<std::pair<NodeId, Location>> copies;
+        std::vector<std::pair<uint64_t, uint64_t>> segments(m_segments.begin(), m_segments.end());
+        std::vector<uint64_t> removed;
+        for (auto& [seg, size] : segments) {
+            auto& ids = liveBySegment[seg];
+            uint64_t liveBytes = 0;
+            for (auto& id : ids) {
+                liveBytes += m_index.at(id).size;
+            }
+
+            if (liveBytes && liveBytes >= m_config.compactLiveRatio * double(size - Format::fileHeaderSize)) continue;
+
+            std::string raw;
+            for (auto& id : ids) {
+                auto loc = m_index.at(id);
+                raw.resize(loc.size);
+                auto f = files.get(seg);
+                if (std::fseek(f, long(loc.offset), SEEK_SET) != 0 || std::fread(raw.data(), 1, raw.size(), f) != raw.size()) {
+                    throw std::runtime_error("kuzco::SnapshotStore: can't read segment");
+                }
+                copies.emplace_back(id, writeRecord(raw));
+                ++stats.nodesCopied;
+                stats.bytesCopied += raw.size();
+            }
+            removed.push_back(seg);
+        }
+
+        // the copies and the new roots must be durable before anything is removed
+        if (m_segFile) syncSegment();
+        for (auto& [id, loc] : copies) {
+            m_index[id] = loc;
+        }
+        rewriteRoots(roots);
+        m_roots = std::move(roots);
+
+        files.close();
+        for (auto seg : removed) {
+            std::filesystem::remove(segmentPath(seg));
+            stats.bytesFreed += m_segments[seg];
+            m_segments.erase(seg);
+            ++stats.segmentsRemoved;
+        }
+
+        // forget unreachable nodes, as they are no longer stored
+        std::erase_if(m_index, [&](auto& e) { return !live.count(e.first); });
+        std::erase_if(m_known, [&](auto& e) { return !live.count(e.second.id); });
+        releaseUnused();
+        m_knownAfterPrune = std::max(m_known.size(), size_t(1024));
+
+        return stats;
+    }
+
+    // number of stored nodes
+    size_t numNodes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_index.size();
+    }
+
+    size_t numSegments() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_segments.size();
+    }
+
+    // total size of the segments
+    uint64_t segmentBytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t ret = 0;
+        for (auto& [_, size] : m_segments) {
+            ret += size;
+        }
+        return ret;
+    }
+
+private:
+    struct Location {
+        uint64_t segment;
+        uint64_t offset;
+        uint64_t size; // of the entire record
+    };
+
+    template <typename T>
+    NodeId persist(const Detached<T>& obj) {
+        return persistNode(obj._as_shared_ptr_unsafe(), impl::persistNodeType<T>);
+    }
+
+    virtual NodeId persistNode(const std::shared_ptr<const void>& obj, const impl::PersistNodeType& type) override {
+        const void* addr = obj.get();
+        // known objects are not modified, as the ref of the store makes them non-unique
+        auto known = m_known.find(addr);
+        if (known != m_known.end()) {
+            ++m_stats.nodesReused;
+            return known->second.id;
+        }
+
+        PersistWriter w(*this);
+        type.save(addr, w);
+        auto& children = w.children();
+        auto payload = w.payload();
+        // the sizes in the record header are 32-bit
+        if (payload.size() > Format::maxRecordSize || children.size() > Format::maxRecordSize) {
+            throw std::length_error("kuzco::SnapshotStore: node too big");
+        }
+        auto id = Format::recordId(type.tag, children, payload);
+
+        if (m_index.count(id)) {
+            ++m_stats.nodesDeduplicated;
+        }
+        else {
+            Format::RecordHeader h{id, type.tag, uint32_t(payload.size()), uint32_t(children.size())};
+            std::string raw;
+            raw.reserve(sizeof(h) + children.size() * sizeof(NodeId) + payload.size());
+            raw.append(reinterpret_cast<const char*>(&h), sizeof(h));
+            raw.append(reinterpret_cast<const char*>(children.data()), children.size() * sizeof(NodeId));
+            raw.append(payload);
+            m_index[id] = writeRecord(raw);
+            ++m_stats.nodesWritten;
+            m_stats.bytesWritten += raw.size();
+        }
+
+        m_known[addr] = Known{obj, id};
+        return id;
+    }
+
+    virtual std::shared_ptr<void> loadNode(const NodeId& id, const impl::PersistNodeType& type) override {
+        auto& ctx = *m_loadCtx;
+        if (auto i = ctx.loaded.find(id); i != ctx.loaded.end()) {
+            if (i->second.typeTag != type.tag) throw std::runtime_error("kuzco::SnapshotStore: node type mismatch");
+            return i->second.obj;
+        }
+
+        std::vector<NodeId> children;
+        std::string payload;
+        auto typeTag = readRecord(id, ctx.files, children, &payload);
+        if (typeTag != type.tag) throw std::runtime_error("kuzco::SnapshotStore: node type mismatch");
+        PersistReader r(*this, std::move(children), payload);
+        auto obj = type.load(r);
+
+        ctx.loaded.emplace(id, impl::SnapshotLoadContext::Loaded{obj, typeTag});
+        m_known[obj.get()] = Known{obj, id};
+        return obj;
+    }
+
+    // read the children and optionally the payload of a record
+    // returns the type tag of the record
+    uint64_t readRecord(const NodeId& id, impl::SegmentFiles& files, std::vector<NodeId>& children, std::string* payload) {
+        auto i = m_index.find(id);
+        if (i == m_index.end()) throw std::runtime_error("kuzco::SnapshotStore: missing node");
+        auto& loc = i->second;
+
+        auto f = files.get(loc.segment);
+        Format::RecordHeader h;
+        if (std::fseek(f, long(loc.offset), SEEK_SET) != 0 || std::fread(&h, sizeof(h), 1, f) != 1 || h.id != id) {
+            throw std::runtime_error("kuzco::SnapshotStore: can't read node");
+        }
+        children.resize(h.numChildren);
+        if (h.numChildren && std::fread(children.data(), sizeof(NodeId), h.numChildren, f) != h.numChildren) {
+            throw std::runtime_error("kuzco::SnapshotStore: can't read node");
+        }
+        if (!payload) return h.typeTag;
+        payload->resize(h.payloadSize);
+        if (h.payloadSize && std::fread(payload->data(), 1, h.payloadSize, f) != h.payloadSize) {
+            throw std::runtime_error("kuzco::SnapshotStore: can't read node");
+        }
+        return h.typeTag;
+    }
+
+    // append a record (header, children, and payload) to the current segment
+    // return its location
+    Location writeRecord(std::string_view raw) {
+        if (!m_segFile || m_segments[m_segment] >= m_config.segmentSize) {
+            openSegment();
+        }
+        if (std::fwrite(raw.data(), 1, raw.size(), m_segFile) != raw.size()) {
+            abandonSegment();
+            throw std::runtime_error("kuzco::SnapshotStore: write failed");
+        }
+        auto& size = m_segments[m_segment];
+        Location ret{m_segment, size, raw.size()};
+        size += raw.size();
+        return ret;
+    }
+
+    std::filesystem::path segmentPath(uint64_t segment) const {
+        return m_dir / ("seg-" + std::to_string(segment) + ".kzs");
+    }
+
+    std::filesystem::path rootsPath() const {
+        return m_dir / "roots.kzr";
+    }
+
+    void openSegment() {
+        closeSegment();
+        m_segment = m_nextSegment++;
+        auto path = segmentPath(m_segment);
+        m_segFile = std::fopen(path.string().c_str(), "wb");
+        if (!m_segFile) throw std::runtime_error("kuzco::SnapshotStore: can't create segment");
+        try {
+            writeFileHeader(m_segFile, Format::segmentMagic);
+            // the header is synced, so that failed writes can be truncated to a valid segment
+            impl::flushAndSync(m_segFile);
+            // the contents are synced before they are referenced by a root, the entry is synced now
+            impl::syncDirectory(m_dir);
+        }
+        catch (...) {
+            std::fclose(m_segFile);
+            m_segFile = nullptr;
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            throw;
+        }
+        m_segments[m_segment] = Format::fileHeaderSize;
+        m_segSynced = Format::fileHeaderSize;
+    }
+
+    void closeSegment() {
+        if (!m_segFile) return;
+        syncSegment();
+        std::fclose(m_segFile);
+        m_segFile = nullptr;
+    }
+
+    void syncSegment() {
+        try {
+            impl::flushAndSync(m_segFile);
+        }
+        catch (...) {
+            abandonSegment();
+            throw;
+        }
+        m_segSynced = m_segments[m_segment];
+    }
+
+    // after a failed write or sync: close the current segment, so that the following records start
+    // a new one, and forget its records which were not synced (no root references them)
+    // a part of a record may have been written, so the segment is truncated to the synced records
+    void abandonSegment() {
+        std::fclose(m_segFile);
+        m_segFile = nullptr;
+        std::erase_if(m_index, [&](auto& e) { return e.second.segment == m_segment && e.second.offset >= m_segSynced; });
+        std::erase_if(m_known, [&](auto& e) { return !m_index.count(e.second.id); });
+        m_segments[m_segment] = m_segSynced;
+        // if this fails, the torn tail is dropped when the store is opened
+        std::error_code ec;
+        std::filesystem::resize_file(segmentPath(m_segment), m_segSynced, ec);
+    }
+
+    static void writeFileHeader(std::FILE* f, const char* magic) {
+        char buf[Format::fileHeaderSize] = {};
+        std::memcpy(buf, magic, 4);
+        if (std::fwrite(buf, 1, sizeof(buf), f) != sizeof(buf)) {
+            throw std::runtime_error("kuzco::SnapshotStore: write failed");
+        }
+    }
+
+    static bool readFileHeader(std::FILE* f, const char* magic, const std::filesystem::path& path) {
+        char buf[Format::fileHeaderSize];
+        if (std::fread(buf, 1, sizeof(buf), f) != sizeof(buf)) return false;
+        if (std::memcmp(buf, magic, 4) != 0) {
+            throw std::runtime_error("kuzco::SnapshotStore: bad file: " + path.string());
+        }
+        return true;
+    }
+
+    void readRoots() {
+        auto path = rootsPath();
+        uint64_t validEnd = 0;
+        if (auto f = std::fopen(path.string().c_str(), "rb")) {
+            try {
+                if (readFileHeader(f, Format::rootsMagic, path)) {
+                    validEnd = Format::fileHeaderSize;
+                    Format::RootRecord rec;
+                    while (std::fread(&rec, sizeof(rec), 1, f) == 1 && rec.check == rec.computeCheck()) {
+                        m_roots.push_back(rec);
+                        validEnd += sizeof(rec);
+                    }
+                }
+            }
+            catch (...) {
+                std::fclose(f);
+                throw;
+            }
+            std::fclose(f);
+        }
+
+        if (validEnd) {
+            // drop a torn tail
+            std::filesystem::resize_file(path, validEnd);
+        }
+        else {
+            rewriteRoots(m_roots);
+        }
+    }
+
+    void appendRoot(const Format::RootRecord& rec) {
+        auto f = std::fopen(rootsPath().string().c_str(), "ab");
+        if (!f) throw std::runtime_error("kuzco::SnapshotStore: can't open roots");
+        auto ok = std::fwrite(&rec, sizeof(rec), 1, f) == 1;
+        if (ok) impl::flushAndSync(f);
+        std::fclose(f);
+        if (!ok) throw std::runtime_error("kuzco::SnapshotStore: write failed");
+    }
+
+    // atomically replace the roots file with one with the roots
+    void rewriteRoots(const std::vector<Format::RootRecord>& roots) {
+        auto path = rootsPath();
+        auto tmpPath = path;
+        tmpPath += ".tmp";
+        auto f = std::fopen(tmpPath.string().c_str(), "wb");
+        if (!f) throw std::runtime_error("kuzco::SnapshotStore: can't create roots");
+        writeFileHeader(f, Format::rootsMagic);
+        bool ok = true;
+        for (auto& r : roots) {
+            ok = ok && std::fwrite(&r, sizeof(r), 1, f) == 1;
+        }
+        if (ok) impl::flushAndSync(f);
+        std::fclose(f);
+        if (!ok) throw std::runtime_error("kuzco::SnapshotStore: write failed");
+        std::filesystem::rename(tmpPath, path);
+        impl::syncDirectory(m_dir);
+    }
+
+    // index the records of all segments
+    void scanSegments() {
+        std::vector<uint64_t> segments;
+        for (auto& e : std::filesystem::directory_iterator(m_dir)) {
+            auto name = e.path().filename().string();
+            if (name.size() > 8 && name.starts_with("seg-") && name.ends_with(".kzs")) {
+                segments.push_back(std::stoull(name.substr(4, name.size() - 8)));
+            }
+        }
+        std::sort(segments.begin(), segments.end());
+
+        std::vector<NodeId> children;
+        std::string payload;
+        for (auto seg : segments) {
+            auto path = segmentPath(seg);
+            auto f = std::fopen(path.string().c_str(), "rb");
+            if (!f) throw std::runtime_error("kuzco::SnapshotStore: can't open " + path.string());
+
+            uint64_t validEnd = 0;
+            try {
+                if (readFileHeader(f, Format::segmentMagic, path)) {
+                    validEnd = Format::fileHeaderSize;
+                    Format::RecordHeader h;
+                    while (std::fread(&h, sizeof(h), 1, f) == 1) {
+                        children.resize(h.numChildren);
+                        payload.resize(h.payloadSize);
+                        if (h.numChildren && std::fread(children.data(), sizeof(NodeId), h.numChildren, f) != h.numChildren) break;
+                        if (h.payloadSize && std::fread(payload.data(), 1, h.payloadSize, f) != h.payloadSize) break;
+                        if (Format::recordId(h.typeTag, children, payload) != h.id) break;
+
+                        auto size = sizeof(h) + h.numChildren * sizeof(NodeId) + h.payloadSize;
+                        // the first copy wins (others may come from an interrupted compaction)
+                        m_index.emplace(h.id, Location{seg, validEnd, size});
+                        validEnd += size;
+                    }
+                }
+            }
+            catch (...) {
+                std::fclose(f);
+                throw;
+            }
+            std::fclose(f);
+
+            if (validEnd) {
+                // drop a torn tail
+                std::filesystem::resize_file(path, validEnd);
+                m_segments[seg] = validEnd;
+            }
+            else {
+                std::filesystem::remove(path);
+            }
+            m_nextSegment = seg + 1;
+        }
+    }
+
+    // release the objects which only the store references
+    // releasing an object can leave its children only referenced by the store, so repeat
+    void releaseUnused() {
+        while (std::erase_if(m_known, [](auto& e) { return e.second.obj.use_count() == 1; }));
+    }
+
+    const std::filesystem::path m_dir;
+    const SnapshotStoreConfig m_config;
+
+    mutable std::mutex m_mutex;
+
+    std::vector<Format::RootRecord> m_roots;
+
+    std::unordered_map<NodeId, Location, impl::NodeIdHash> m_index;
+
+    // segment -> size
+    std::map<uint64_t, uint64_t> m_segments;
+
+    // current segment
+    std::FILE* m_segFile = nullptr;
+    uint64_t m_segment = 0;
+    uint64_t m_nextSegment = 1;
+    uint64_t m_segSynced = 0; // size of its synced part
+
+    // persisted objects
+    struct Known {
+        std::shared_ptr<const void> obj;
+        NodeId id;
+    };
+    std::unordered_map<const void*, Known> m_known;
+    size_t m_knownAfterPrune = 1024;
+
+    CheckpointStats m_stats;
+
+    // set while loading
+    impl::SnapshotLoadContext* m_loadCtx = nullptr;
+};
+
+} // namespace kuzco
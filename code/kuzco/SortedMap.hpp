@@ -0,0 +1,654 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include "Node.hpp"
+
+#include <vector>
+#include <optional>
+#include <iterator>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace kuzco {
+
+// Persistent ordered containers: SortedMap, SortedSet, and SortedNodeMap
+//
+// A sorted StdVector is copied in full on any insert into a shared snapshot. These are B+trees
+// with wide nodes (up to B entries per leaf and B children per inner node) instead.
+// Copies share the tree. A write copies the O(log n) nodes on the path to the modified leaf
+// (copy-on-write), but modifies nodes in place when they're unique (like Node does).
+// Thus they can be stored by value in state objects.
+//
+// * ordered iteration, lower_bound, upper_bound and range scans
+// * bulk loading of sorted input in O(n)
+//
+// Iterators are invalidated by modifications of the container they were obtained from.
+// Iterators of a copy (snapshot) are unaffected by modifications of the original.
+// Compare must be stateless.
+
+// tag for constructors from sorted input with unique keys
+struct sorted_unique_t { explicit sorted_unique_t() = default; };
+inline constexpr sorted_unique_t sorted_unique{};
+
+namespace impl {
+
+template <typename K, typename Entry>
+struct BTreeNode {
+    bool leaf = true;
+
+    // leaves only
+    std::vector<Entry> entries;
+
+    // inner nodes only
+    // keys[i] separates children[i] and children[i+1]: all keys in children[i+1] are >= keys[i]
+    std::vector<K> keys;
+    std::vector<itlib::ref_ptr<BTreeNode>> children;
+
+    size_t fill() const noexcept { return leaf ? entries.size() : children.size(); }
+};
+
+struct KeyOfPair {
+    template <typename P>
+    const auto& operator()(const P& p) const noexcept { return p.first; }
+};
+
+struct KeyOfSelf {
+    template <typename K>
+    const K& operator()(const K& k) const noexcept { return k; }
+};
+
+template <typename K, typename Entry, typename KeyOf, typename Compare, size_t B>
+class BTree {
+    static_assert(B >= 4, "B-tree nodes must have a capacity of at least 4");
+protected:
+    using Node = BTreeNode<K, Entry>;
+    using NodePtr = itlib::ref_ptr<Node>;
+    static constexpr size_t MinFill = B / 2;
+public:
+    using key_type = K;
+    using value_type = Entry;
+    using size_type = size_t;
+    using key_compare = Compare;
+    static constexpr size_t nodeCapacity = B;
+
+    BTree() = default;
+
+    // copies are cheap (and shallow)
+    BTree(const BTree&) = default;
+    BTree& operator=(const BTree&) = default;
+    BTree(BTree&& other) noexcept
+        : m_root(std::exchange(other.m_root, {}))
+        , m_size(std::exchange(other.m_size, 0))
+    {}
+    BTree& operator=(BTree&& other) noexcept {
+        m_root = std::exchange(other.m_root, {});
+        m_size = std::exchange(other.m_size, 0);
+        return *this;
+    }
+
+    size_type size() const noexcept { return m_size; }
+    bool empty() const noexcept { return !m_size; }
+
+    void clear() noexcept {
+        m_root.reset();
+        m_size = 0;
+    }
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Entry*;
+        using reference = const Entry&;
+
+        const_iterator() = default;
+
+        reference operator*() const noexcept {
+            auto& s = m_path.back();
+            return s.node->entries[s.index];
+        }
+        pointer operator->() const noexcept { return &**this; }
+
+        const_iterator& operator++() {
+            auto& s = m_path.back();
+            if (++s.index < s.node->entries.size()) return *this;
+
+            // go up until there is a next child and then to its leftmost leaf
+            m_path.pop_back();
+            while (!m_path.empty()) {
+                auto& p = m_path.back();
+                if (++p.index < p.node->children.size()) {
+                    descendLeft(p.node->children[p.index].get());
+                    return *this;
+                }
+                m_path.pop_back();
+            }
+            return *this;
+        }
+        const_iterator operator++(int) { auto ret = *this; ++*this; return ret; }
+
+        bool operator==(const const_iterator& other) const noexcept {
+            if (m_path.empty() || other.m_path.empty()) return m_path.empty() == other.m_path.empty();
+            auto& a = m_path.back();
+            auto& b = other.m_path.back();
+            return a.node == b.node && a.index == b.index;
+        }
+    private:
+        friend class BTree;
+
+        void descendLeft(const Node* n) {
+            while (!n->leaf) {
+                m_path.push_back({n, 0});
+                n = n->children.front().get();
+            }
+            m_path.push_back({n, 0});
+        }
+
+        struct Step {
+            const Node* node;
+            size_t index; // of child for inner nodes, of entry for leaves
+        };
+        std::vector<Step> m_path; // from the root, empty for end
+    };
+    using iterator = const_iterator;
+
+    const_iterator begin() const {
+        const_iterator ret;
+        if (m_root) ret.descendLeft(m_root.get());
+        return ret;
+    }
+    const_iterator end() const noexcept { return {}; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    // first element whose key is not less than k
+    const_iterator lower_bound(const K& k) const {
+        return bound(k, [&](const Node& leaf) {
+            return std::lower_bound(leaf.entries.begin(), leaf.entries.end(), k, [&](const Entry& e, const K& key) {
+                return less(KeyOf{}(e), key);
+            }) - leaf.entries.begin();
+        });
+    }
+
+    // first element whose key is greater than k
+    const_iterator upper_bound(const K& k) const {
+        return bound(k, [&](const Node& leaf) {
+            return std::upper_bound(leaf.entries.begin(), leaf.entries.end(), k, [&](const K& key, const Entry& e) {
+                return less(key, KeyOf{}(e));
+            }) - leaf.entries.begin();
+        });
+    }
+
+    const_iterator find(const K& k) const {
+        auto ret = lower_bound(k);
+        if (ret == end() || less(k, KeyOf{}(*ret))) return end();
+        return ret;
+    }
+
+    const Entry* findEntry(const K& k) const noexcept {
+        if (!m_root) return nullptr;
+        auto& leaf = findLeaf(k);
+        auto i = leafIndex(leaf, k);
+        if (i == leaf.entries.size() || less(k, KeyOf{}(leaf.entries[i]))) return nullptr;
+        return &leaf.entries[i];
+    }
+
+    bool contains(const K& k) const noexcept { return !!findEntry(k); }
+    size_type count(const K& k) const noexcept { return contains(k) ? 1 : 0; }
+
+    struct Range {
+        const_iterator b, e;
+        const_iterator begin() const { return b; }
+        const_iterator end() const { return e; }
+    };
+
+    // elements with keys in [lo, hi)
+    Range range(const K& lo, const K& hi) const {
+        if (!less(lo, hi)) return {};
+        return {lower_bound(lo), lower_bound(hi)};
+    }
+
+    // remove the element with key k
+    // returns the number of removed elements (0 or 1)
+    size_type erase(const K& k) {
+        if (!contains(k)) return 0; // don't copy the path for nothing
+        eraseRec(m_root, k);
+        --m_size;
+
+        if (m_root->leaf) {
+            if (m_root->entries.empty()) m_root.reset();
+        }
+        else if (m_root->children.size() == 1) {
+            NodePtr child = m_root->children.front();
+            m_root = std::move(child);
+        }
+        return 1;
+    }
+
+    // whether the two share the entire tree
+    bool sameAs(const BTree& other) const noexcept { return m_root == other.m_root; }
+
+    // 0 for an empty tree
+    size_t height() const noexcept {
+        size_t ret = 0;
+        for (auto n = m_root.get(); n; n = n->leaf ? nullptr : n->children.front().get()) {
+            ++ret;
+        }
+        return ret;
+    }
+
+    friend bool operator==(const BTree& a, const BTree& b) {
+        if (a.sameAs(b)) return true;
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+    }
+
+protected:
+    NodePtr m_root;
+    size_type m_size = 0;
+
+    static bool less(const K& a, const K& b) {
+        return Compare{}(a, b);
+    }
+
+    static Node& own(NodePtr& p) {
+        if (!p.unique()) {
+            p = itlib::make_ref_ptr<Node>(*p);
+        }
+        return *p;
+    }
+
+    static size_t childIndex(const Node& n, const K& k) {
+        return std::upper_bound(n.keys.begin(), n.keys.end(), k, [](const K& a, const K& b) { return less(a, b); }) - n.keys.begin();
+    }
+
+    static size_t leafIndex(const Node& leaf, const K& k) {
+        return std::lower_bound(leaf.entries.begin(), leaf.entries.end(), k, [](const Entry& e, const K& key) {
+            return less(KeyOf{}(e), key);
+        }) - leaf.entries.begin();
+    }
+
+    const Node& findLeaf(const K& k) const noexcept {
+        auto n = m_root.get();
+        while (!n->leaf) {
+            n = n->children[childIndex(*n, k)].get();
+        }
+        return *n;
+    }
+
+    template <typename LeafIndex>
+    const_iterator bound(const K& k, LeafIndex leafIndex) const {
+        const_iterator ret;
+        if (!m_root) return ret;
+        auto n = m_root.get();
+        while (!n->leaf) {
+            auto ci = childIndex(*n, k);
+            ret.m_path.push_back({n, ci});
+            n = n->children[ci].get();
+        }
+        size_t i = leafIndex(*n);
+        if (i < n->entries.size()) {
+            ret.m_path.push_back({n, i});
+        }
+        else {
+            // the bound is in the next leaf
+            ret.m_path.push_back({n, n->entries.size() - 1});
+            ++ret;
+        }
+        return ret;
+    }
+
+    // returns a mutable entry with key k, copying the path to it (if needed), or null if there's none
+    Entry* modifyEntry(const K& k) {
+        if (!contains(k)) return nullptr;
+        auto p = &m_root;
+        while (true) {
+            auto& n = own(*p);
+            if (n.leaf) return &n.entries[leafIndex(n, k)];
+            p = &n.children[childIndex(n, k)];
+        }
+    }
+
+    // insert an entry
+    // if there is an entry with the same key, it's replaced if assign is true
+    // returns whether a new entry was inserted
+    template <typename E>
+    bool insertEntry(E&& e, bool assign) {
+        if (!m_root) {
+            auto root = itlib::make_ref_ptr<Node>();
+            root->entries.reserve(B);
+            root->entries.emplace_back(std::forward<E>(e));
+            m_root = std::move(root);
+            m_size = 1;
+            return true;
+        }
+
+        if (!assign && contains(KeyOf{}(e))) return false; // don't copy the path for nothing
+
+        std::optional<std::pair<K, NodePtr>> split;
+        bool inserted = insertRec(m_root, std::forward<E>(e), split);
+        if (split) {
+            auto root = itlib::make_ref_ptr<Node>();
+            root->leaf = false;
+            root->keys.reserve(B - 1);
+            root->children.reserve(B);
+            root->keys.push_back(std::move(split->first));
+            root->children.push_back(std::move(m_root));
+            root->children.push_back(std::move(split->second));
+            m_root = std::move(root);
+        }
+        if (inserted) ++m_size;
+        return inserted;
+    }
+
+    // bulk load entries which are sorted by key with no duplicates
+    template <typename InputIt>
+    void assignSorted(InputIt first, InputIt last) {
+        clear();
+
+        std::vector<Entry> entries(first, last);
+        for (size_t i = 1; i < entries.size(); ++i) {
+            if (!less(KeyOf{}(entries[i - 1]), KeyOf{}(entries[i]))) {
+                throw std::invalid_argument("kuzco::SortedMap: input is not sorted or has duplicates");
+            }
+        }
+        if (entries.empty()) return;
+        m_size = entries.size();
+
+        // build leaves, distributing the entries evenly
+        std::vector<NodePtr> level;
+        std::vector<K> mins; // min keys of nodes in level
+        forEachGroup(entries.size(), [&](size_t b, size_t e) {
+            auto leaf = itlib::make_ref_ptr<Node>();
+            leaf->entries.reserve(B);
+            leaf->entries.insert(leaf->entries.end(), std::make_move_iterator(entries.begin() + b), std::make_move_iterator(entries.begin() + e));
+            mins.push_back(KeyOf{}(leaf->entries.front()));
+            level.push_back(std::move(leaf));
+        });
+
+        // build inner levels
+        while (level.size() > 1) {
+            std::vector<NodePtr> parents;
+            std::vector<K> parentMins;
+            forEachGroup(level.size(), [&](size_t b, size_t e) {
+                auto n = itlib::make_ref_ptr<Node>();
+                n->leaf = false;
+                n->keys.reserve(B - 1);
+                n->children.reserve(B);
+                for (auto i = b; i < e; ++i) {
+                    if (i != b) n->keys.push_back(std::move(mins[i]));
+                    n->children.push_back(std::move(level[i]));
+                }
+                parentMins.push_back(std::move(mins[b]));
+                parents.push_back(std::move(n));
+            });
+            level.swap(parents);
+            mins.swap(parentMins);
+        }
+
+        m_root = std::move(level.front());
+    }
+
+private:
+    // split count items in the fewest groups of at most B with even sizes
+    // (thus all groups are at least half-full, unless there is a single one)
+    template <typename F>
+    static void forEachGroup(size_t count, F f) {
+        auto groups = (count + B - 1) / B;
+        auto base = count / groups;
+        auto extra = count % groups;
+        size_t b = 0;
+        for (size_t g = 0; g < groups; ++g) {
+            auto e = b + base + (g < extra);
+            f(b, e);
+            b = e;
+        }
+    }
+
+    template <typename E>
+    static bool insertRec(NodePtr& p, E&& e, std::optional<std::pair<K, NodePtr>>& split) {
+        auto& n = own(p);
+        if (n.leaf) {
+            auto i = leafIndex(n, KeyOf{}(e));
+            if (i < n.entries.size() && !less(KeyOf{}(e), KeyOf{}(n.entries[i]))) {
+                n.entries[i] = std::forward<E>(e);
+                return false;
+            }
+            n.entries.insert(n.entries.begin() + i, std::forward<E>(e));
+            if (n.entries.size() > B) {
+                auto right = itlib::make_ref_ptr<Node>();
+                right->entries.reserve(B);
+                auto mid = n.entries.begin() + n.entries.size() / 2;
+                right->entries.insert(right->entries.end(), std::make_move_iterator(mid), std::make_move_iterator(n.entries.end()));
+                n.entries.erase(mid, n.entries.end());
+                split.emplace(KeyOf{}(right->entries.front()), std::move(right));
+            }
+            return true;
+        }
+
+        auto ci = childIndex(n, KeyOf{}(e));
+        std::optional<std::pair<K, NodePtr>> childSplit;
+        bool ret = insertRec(n.children[ci], std::forward<E>(e), childSplit);
+        if (childSplit) {
+            n.keys.insert(n.keys.begin() + ci, std::move(childSplit->first));
+            n.children.insert(n.children.begin() + ci + 1, std::move(childSplit->second));
+            if (n.children.size() > B) {
+                auto right = itlib::make_ref_ptr<Node>();
+                right->leaf = false;
+                right->keys.reserve(B - 1);
+                right->children.reserve(B);
+                auto mid = n.children.size() / 2;
+                // keys[mid - 1] goes up
+                right->keys.insert(right->keys.end(), std::make_move_iterator(n.keys.begin() + mid), std::make_move_iterator(n.keys.end()));
+                right->children.insert(right->children.end(), std::make_move_iterator(n.children.begin() + mid), std::make_move_iterator(n.children.end()));
+                split.emplace(std::move(n.keys[mid - 1]), std::move(right));
+                n.keys.erase(n.keys.begin() + mid - 1, n.keys.end());
+                n.children.erase(n.children.begin() + mid, n.children.end());
+            }
+        }
+        return ret;
+    }
+
+    static void eraseRec(NodePtr& p, const K& k) {
+        auto& n = own(p);
+        if (n.leaf) {
+            n.entries.erase(n.entries.begin() + leafIndex(n, k));
+            return;
+        }
+
+        auto ci = childIndex(n, k);
+        eraseRec(n.children[ci], k);
+        if (n.children[ci]->fill() < MinFill) {
+            rebalance(n, ci);
+        }
+    }
+
+    // fix an underfull child by borrowing from or merging with a sibling
+    static void rebalance(Node& n, size_t ci) {
+        if (ci > 0 && n.children[ci - 1]->fill() > MinFill) {
+            auto& left = own(n.children[ci - 1]);
+            auto& child = own(n.children[ci]);
+            if (child.leaf) {
+                child.entries.insert(child.entries.begin(), std::move(left.entries.back()));
+                left.entries.pop_back();
+                n.keys[ci - 1] = KeyOf{}(child.entries.front());
+            }
+            else {
+                child.keys.insert(child.keys.begin(), std::move(n.keys[ci - 1]));
+                child.children.insert(child.children.begin(), std::move(left.children.back()));
+                n.keys[ci - 1] = std::move(left.keys.back());
+                left.keys.pop_back();
+                left.children.pop_back();
+            }
+            return;
+        }
+
+        if (ci + 1 < n.children.size() && n.children[ci + 1]->fill() > MinFill) {
+            auto& right = own(n.children[ci + 1]);
+            auto& child = own(n.children[ci]);
+            if (child.leaf) {
+                child.entries.push_back(std::move(right.entries.front()));
+                right.entries.erase(right.entries.begin());
+                n.keys[ci] = KeyOf{}(right.entries.front());
+            }
+            else {
+                child.keys.push_back(std::move(n.keys[ci]));
+                child.children.push_back(std::move(right.children.front()));
+                n.keys[ci] = std::move(right.keys.front());
+                right.keys.erase(right.keys.begin());
+                right.children.erase(right.children.begin());
+            }
+            return;
+        }
+
+        // merge with a sibling: i and i + 1
+        auto i = ci > 0 ? ci - 1 : ci;
+        auto& left = own(n.children[i]);
+        auto& rightPtr = n.children[i + 1];
+        if (left.leaf) {
+            appendFrom(left.entries, rightPtr, &Node::entries);
+        }
+        else {
+            left.keys.push_back(std::move(n.keys[i]));
+            appendFrom(left.keys, rightPtr, &Node::keys);
+            appendFrom(left.children, rightPtr, &Node::children);
+        }
+        n.keys.erase(n.keys.begin() + i);
+        n.children.erase(n.children.begin() + i + 1);
+    }
+
+    // append the elements of a member vector of src to dst, moving them if src is unique
+    template <typename Vec>
+    static void appendFrom(Vec& dst, NodePtr& src, Vec Node::* member) {
+        auto& s = (*src).*member;
+        if (src.unique()) {
+            dst.insert(dst.end(), std::make_move_iterator(s.begin()), std::make_move_iterator(s.end()));
+        }
+        else {
+            dst.insert(dst.end(), s.begin(), s.end());
+        }
+    }
+};
+
+} // namespace impl
+
+template <typename K, typename V, typename Compare = std::less<K>, size_t B = 32>
+class SortedMap : public impl::BTree<K, std::pair<K, V>, impl::KeyOfPair, Compare, B> {
+    using Super = impl::BTree<K, std::pair<K, V>, impl::KeyOfPair, Compare, B>;
+public:
+    using mapped_type = V;
+    using typename Super::value_type;
+
+    SortedMap() = default;
+
+    // keys must be sorted and unique
+    template <std::input_iterator InputIt>
+    SortedMap(sorted_unique_t, InputIt first, InputIt last) {
+        this->assignSorted(first, last);
+    }
+
+    // any order
+    // for duplicate keys the first element is used
+    template <std::input_iterator InputIt>
+    SortedMap(InputIt first, InputIt last) {
+        std::vector<value_type> entries(first, last);
+        auto byKey = [](const value_type& a, const value_type& b) { return Compare{}(a.first, b.first); };
+        std::stable_sort(entries.begin(), entries.end(), byKey);
+        entries.erase(std::unique(entries.begin(), entries.end(), [&](const value_type& a, const value_type& b) {
+            return !byKey(a, b);
+        }), entries.end());
+        this->assignSorted(std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+    }
+
+    SortedMap(std::initializer_list<value_type> ilist)
+        : SortedMap(ilist.begin(), ilist.end())
+    {}
+
+    // returns whether the value was inserted (false if the key exists)
+    bool insert(K k, V v) {
+        return this->insertEntry(value_type(std::move(k), std::move(v)), false);
+    }
+    bool insert(value_type e) {
+        return this->insertEntry(std::move(e), false);
+    }
+
+    // returns whether the value was inserted (false if it was assigned)
+    bool insert_or_assign(K k, V v) {
+        return this->insertEntry(value_type(std::move(k), std::move(v)), true);
+    }
+
+    // null if there is no such key
+    const V* get(const K& k) const noexcept {
+        auto e = this->findEntry(k);
+        return e ? &e->second : nullptr;
+    }
+
+    const V& at(const K& k) const {
+        auto v = get(k);
+        if (!v) throw std::out_of_range("kuzco::SortedMap::at");
+        return *v;
+    }
+
+    // item mutator
+    // copies the path to the item on write
+    V& modify(const K& k) {
+        auto e = this->modifyEntry(k);
+        if (!e) throw std::out_of_range("kuzco::SortedMap::modify");
+        return e->second;
+    }
+};
+
+template <typename K, typename Compare = std::less<K>, size_t B = 32>
+class SortedSet : public impl::BTree<K, K, impl::KeyOfSelf, Compare, B> {
+public:
+    SortedSet() = default;
+
+    // keys must be sorted and unique
+    template <std::input_iterator InputIt>
+    SortedSet(sorted_unique_t, InputIt first, InputIt last) {
+        this->assignSorted(first, last);
+    }
+
+    // any order
+    template <std::input_iterator InputIt>
+    SortedSet(InputIt first, InputIt last) {
+        std::vector<K> keys(first, last);
+        std::sort(keys.begin(), keys.end(), Compare{});
+        keys.erase(std::unique(keys.begin(), keys.end(), [](const K& a, const K& b) {
+            return !Compare{}(a, b);
+        }), keys.end());
+        this->assignSorted(std::make_move_iterator(keys.begin()), std::make_move_iterator(keys.end()));
+    }
+
+    SortedSet(std::initializer_list<K> ilist)
+        : SortedSet(ilist.begin(), ilist.end())
+    {}
+
+    // returns whether the key was inserted (false if it exists)
+    bool insert(K k) {
+        return this->insertEntry(std::move(k), false);
+    }
+};
+
+// a sorted map of nodes
+// copy-on-write of the map copies the paths in the tree, but not the values (only refs to them)
+template <typename K, typename V, typename Compare = std::less<K>, size_t B = 32>
+class SortedNodeMap : public SortedMap<K, Node<V>, Compare, B> {
+    using Super = SortedMap<K, Node<V>, Compare, B>;
+public:
+    using Super::Super;
+
+    const V& r(const K& k) const {
+        return this->at(k).r();
+    }
+
+    Detached<V> detach(const K& k) const {
+        return this->at(k).detach();
+    }
+};
+
+} // namespace kuzco
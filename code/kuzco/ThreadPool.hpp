@@ -0,0 +1,228 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <optional>
+#include <cstddef>
+
+namespace kuzco {
+
+// a fixed-size work-stealing thread pool
+// used for parallel copies and algorithms
+//
+// each worker has its own queue
+// tasks posted from a worker go to its own queue and it executes them LIFO
+// tasks posted from other threads go to a shared queue
+// idle workers steal from the shared queue and from the other workers (FIFO)
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned numThreads = std::max(1u, std::thread::hardware_concurrency())) {
+        // the last queue is the shared one
+        for (unsigned i = 0; i <= numThreads; ++i) {
+            m_queues.push_back(std::make_unique<Queue>());
+        }
+        m_threads.reserve(numThreads);
+        for (unsigned i = 0; i < numThreads; ++i) {
+            m_threads.emplace_back([this, i]() { run(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_stop = true;
+        }
+        m_sleepCv.notify_all();
+        for (auto& t : m_threads) {
+            t.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // the queues are all created before the threads, so this is safe to call from the workers
+    unsigned numThreads() const noexcept { return unsigned(m_queues.size() - 1); }
+
+    // fire and forget
+    // the task must not throw
+    void post(std::function<void()> task) {
+        auto& q = *m_queues[currentWorker().value_or(numThreads())];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        {
+            // increment under the lock, so that sleeping workers don't miss the notification
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            ++m_pending;
+        }
+        m_sleepCv.notify_one();
+    }
+
+    // index of the current thread in this pool or nullopt if it's not a worker of this pool
+    std::optional<unsigned> currentWorker() const noexcept {
+        auto& tl = tlWorker();
+        if (tl.pool != this) return std::nullopt;
+        return tl.index;
+    }
+
+    // fork-join
+    // splits [0, count) into chunks of at least grain elements and calls f(begin, end) for each
+    // the calling thread also processes chunks, so this can be safely called from within a task
+    // blocks until all chunks are processed
+    // if a chunk throws, the first exception is rethrown here after all chunks are done
+    // returns the number of chunks
+    template <typename F>
+    size_t parallelFor(size_t count, size_t grain, F&& f) {
+        if (count == 0) return 0;
+        grain = std::max(grain, size_t(1));
+
+        auto state = std::make_shared<ForState>();
+        state->count = count;
+        state->numChunks = std::min((count + grain - 1) / grain, size_t(numThreads()) + 1);
+        state->chunkSize = (count + state->numChunks - 1) / state->numChunks;
+        // rounding the chunk size up may leave fewer chunks than planned (5 in 4 chunks is 3 of size 2)
+        state->numChunks = (count + state->chunkSize - 1) / state->chunkSize;
+        state->func = &f;
+        state->invoke = [](void* func, size_t b, size_t e) {
+            (*static_cast<std::remove_reference_t<F>*>(func))(b, e);
+        };
+
+        for (size_t i = 1; i < state->numChunks; ++i) {
+            // helpers which start after all chunks are taken exit immediately
+            // they never touch func (which lives on our stack)
+            post([state]() { state->work(); });
+        }
+
+        state->work();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cv.wait(lock, [&]() { return state->done == state->numChunks; });
+
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+
+        return state->numChunks;
+    }
+
+private:
+    struct ForState {
+        size_t count = 0;
+        size_t numChunks = 0;
+        size_t chunkSize = 0;
+        void* func = nullptr;
+        void (*invoke)(void*, size_t, size_t) = nullptr;
+
+        std::atomic<size_t> next = 0;
+        std::atomic<size_t> done = 0;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::exception_ptr error;
+
+        void work() {
+            while (true) {
+                auto i = next.fetch_add(1);
+                if (i >= numChunks) return;
+
+                auto b = i * chunkSize;
+                auto e = std::min(b + chunkSize, count);
+                try {
+                    invoke(func, b, e);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) error = std::current_exception();
+                }
+
+                if (done.fetch_add(1) + 1 == numChunks) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    cv.notify_all();
+                }
+            }
+        }
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    struct WorkerId {
+        const ThreadPool* pool = nullptr;
+        unsigned index = 0;
+    };
+    static WorkerId& tlWorker() noexcept {
+        static thread_local WorkerId id;
+        return id;
+    }
+
+    bool popBack(Queue& q, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) return false;
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+    }
+
+    bool popFront(Queue& q, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) return false;
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    }
+
+    bool findTask(unsigned self, std::function<void()>& task) {
+        if (popBack(*m_queues[self], task)) return true;
+
+        const auto n = numThreads();
+        if (popFront(*m_queues[n], task)) return true;
+
+        for (unsigned i = 1; i < n; ++i) {
+            if (popFront(*m_queues[(self + i) % n], task)) return true;
+        }
+        return false;
+    }
+
+    void run(unsigned self) {
+        tlWorker() = {this, self};
+
+        std::function<void()> task;
+        while (true) {
+            if (findTask(self, task)) {
+                m_pending.fetch_sub(1);
+                task();
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_sleepCv.wait(lock, [this]() { return m_stop || m_pending > 0; });
+            if (m_stop && m_pending == 0) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+
+    std::atomic<std::ptrdiff_t> m_pending = 0; // signed, as a task may be taken before it was counted
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCv;
+    bool m_stop = false;
+
+    std::vector<std::thread> m_threads;
+};
+
+} // namespace kuzco
@@ -4,10 +4,18 @@
 #pragma once
 
 #include "Node.hpp"
+#include "ParallelCopy.hpp"
 
 #include <itlib/type_traits.hpp>
 
 #include <initializer_list>
+#include <concepts>
+#include <type_traits>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <memory>
 
 namespace kuzco {
 
@@ -43,29 +51,29 @@ public:
     size_t capacity() const { return this->get()->capacity(); }
     bool empty() const { return this->get()->empty(); }
 
-    pointer data() { return this->get()->data(); }
+    pointer data() { return own().data(); }
     const_pointer data() const { return this->get()->data(); }
 
     const value_type& operator[](size_type i) const { return this->get()->operator[](i); }
-    value_type& operator[](size_type i) { return this->get()->operator[](i); }
+    value_type& operator[](size_type i) { return own()[i]; }
 
-    iterator begin() { return this->get()->begin(); }
-    iterator end() { return this->get()->end(); }
+    iterator begin() { return own().begin(); }
+    iterator end() { return own().end(); }
     const_iterator begin() const { return this->get()->begin(); }
     const_iterator end() const { return this->get()->end(); }
     const_iterator cbegin() const { return begin(); }
     const_iterator cend() const { return end(); }
 
-    reverse_iterator rbegin() { return this->get()->rbegin(); }
-    reverse_iterator rend() { return this->get()->rend(); }
+    reverse_iterator rbegin() { return own().rbegin(); }
+    reverse_iterator rend() { return own().rend(); }
     const_reverse_iterator rbegin() const { return this->get()->rbegin(); }
     const_reverse_iterator rend() const { return this->get()->rend(); }
     const_reverse_iterator crbegin() const { return rbegin(); }
     const_reverse_iterator crend() const { return rend(); }
 
-    reference front() { return this->get()->front(); }
+    reference front() { return own().front(); }
     const_reference front() const { return this->get()->front(); }
-    reference back() { return this->get()->back(); }
+    reference back() { return own().back(); }
     const_reference back() const { return this->get()->back(); }
 
     template <typename... Fwd>
@@ -107,6 +115,43 @@ public:
         }
     }
 
+    template <std::input_iterator InputIt>
+    iterator insert(const_iterator pos, InputIt first, InputIt last) {
+        // std::vector doesn't allow inserting its own elements, but the copy keeps them alive
+        if (!this->unique() || inSelf(first, last)) {
+            // for single-pass ranges we can't know the count, so reserve will be for the existing elements only
+            size_type count = 0;
+            if constexpr (std::forward_iterator<InputIt>) {
+                count = size_type(std::distance(first, last));
+            }
+            auto offset = pos - this->m_ptr->cbegin();
+            {
+                inserter i(*this, pos, count);
+                append_to(i.v(), first, last);
+            }
+            return this->m_ptr->begin() + offset;
+        }
+        else {
+            return this->m_ptr->insert(pos, first, last);
+        }
+    }
+
+    template <typename Range>
+    void append_range(Range&& range) {
+        insert(this->m_ptr->cend(), std::begin(range), std::end(range));
+    }
+
+    template <typename... Args>
+    iterator emplace(const_iterator pos, Args&&... args) {
+        if (!this->unique()) {
+            inserter i(*this, pos, 1);
+            return i.v().emplace(i.v().end(), std::forward<Args>(args)...);
+        }
+        else {
+            return this->m_ptr->emplace(pos, std::forward<Args>(args)...);
+        }
+    }
+
     iterator erase(const_iterator pos) {
         if (!this->unique()) {
             return shrink(pos, 1);
@@ -125,15 +170,55 @@ public:
         }
     }
 
-    void reserve(size_type cap) {
+    // erase all elements for which pred returns true
+    // returns the number of erased elements
+    // the predicate is called exactly once per element
+    // if the vector is not unique, it's copied only if at least one element is erased
+    template <typename Pred>
+    size_type erase_if(Pred pred) {
+        auto& src = *this->m_ptr;
+        auto first = std::find_if(src.cbegin(), src.cend(), pred);
+        if (first == src.cend()) return 0; // nothing to do (and no need to copy)
+
         if (!this->unique()) {
             auto oldVec = this->m_ptr;
-            if (oldVec->capacity() >= cap) return; // nothing to do
+            CopyMeter meter(oldVec->size(), sizeof(value_type));
             this->m_ptr = itlib::make_ref_ptr<Wrapped>();
-            this->m_ptr->reserve(cap);
-            for (auto& e : *oldVec) {
-                this->m_ptr->emplace_back(e);
+            auto& v = *this->m_ptr;
+            v.reserve(oldVec->size() - 1);
+            append_to(v, oldVec->cbegin(), first);
+            for (auto i = std::next(first); i != oldVec->cend(); ++i) {
+                if (!pred(*i)) {
+                    v.emplace_back(*i);
+                }
             }
+            return oldVec->size() - v.size();
+        }
+        else {
+            auto& v = src;
+            auto out = v.begin() + (first - v.cbegin());
+            for (auto i = std::next(out); i != v.end(); ++i) {
+                if (!pred(std::as_const(*i))) {
+                    *out++ = std::move(*i);
+                }
+            }
+            auto ret = size_type(v.end() - out);
+            v.erase(out, v.end());
+            return ret;
+        }
+    }
+
+    // opposite of erase_if: keep only the elements for which pred returns true
+    // returns the number of erased elements
+    template <typename Pred>
+    size_type retain(Pred pred) {
+        return erase_if([&](const value_type& e) { return !pred(e); });
+    }
+
+    void reserve(size_type cap) {
+        if (!this->unique()) {
+            if (this->m_ptr->capacity() >= cap) return; // nothing to do
+            this->m_ptr = copy_of(*this->m_ptr, cap);
         }
         else {
             this->m_ptr->reserve(cap);
@@ -141,48 +226,40 @@ public:
     }
 
     void resize(size_type count) {
-        auto oldVec = this->m_ptr;
         if (!this->unique()) {
-            if (oldVec->size() == count) return; // nothing to do
-            if (count < oldVec->size()) {
-                auto diff = oldVec->size() - count;
-                shrink(end() - diff, diff);
+            auto& oldVec = *this->m_ptr;
+            if (oldVec.size() == count) return; // nothing to do
+            if (count < oldVec.size()) {
+                auto diff = oldVec.size() - count;
+                shrink(oldVec.cend() - diff, diff);
             }
             else {
-                this->m_ptr = itlib::make_ref_ptr<Wrapped>();
-                this->m_ptr->reserve(count);
-                for (auto& e : *oldVec) {
-                    this->m_ptr->emplace_back(e);
-                }
+                this->m_ptr = copy_of(oldVec, count);
                 this->m_ptr->resize(count);
             }
         }
         else {
-            oldVec->resize(count);
+            this->m_ptr->resize(count);
         }
     }
 
     void resize(size_type count, const value_type& val) {
-        auto oldVec = this->m_ptr;
         if (!this->unique()) {
-            if (oldVec->size() == count) return; // nothing to do
-            if (count < oldVec->size()) {
-                auto diff = oldVec->size() - count;
-                shrink(end() - diff, diff);
+            auto& oldVec = *this->m_ptr;
+            if (oldVec.size() == count) return; // nothing to do
+            if (count < oldVec.size()) {
+                auto diff = oldVec.size() - count;
+                shrink(oldVec.cend() - diff, diff);
             }
             else {
-                this->m_ptr = itlib::make_ref_ptr<Wrapped>();
-                this->m_ptr->reserve(count);
-                for (auto& e : *oldVec) {
-                    this->m_ptr->emplace_back(e);
-                }
-                while (this->m_ptr->size() != count) {
-                    this->m_ptr->push_back(val);
-                }
+                // val may be an element of the old vector, so keep it alive until we're done
+                auto oldPtr = this->m_ptr;
+                this->m_ptr = copy_of(oldVec, count);
+                this->m_ptr->resize(count, val);
             }
         }
         else {
-            oldVec->resize(count, val);
+            this->m_ptr->resize(count, val);
         }
     }
 
@@ -207,25 +284,137 @@ public:
     }
 
     void pop_back() {
-        auto oldVec = this->m_ptr;
         if (!this->unique()) {
-            shrink(end() - 1, 1);
+            shrink(this->m_ptr->cend() - 1, 1);
         }
         else {
-            oldVec->pop_back();
+            this->m_ptr->pop_back();
+        }
+    }
+
+    // Transient (builder) mode for bulk construction
+    //
+    // Each mutation of the vector checks for uniqueness and potentially copies. When a vector is
+    // built with many operations whose intermediate states are never observed, this is overhead.
+    //
+    //     auto t = vec.transient();
+    //     for (...) t->push_back(x); // plain std::vector operations, no checks
+    //     t.persistent();
+    //
+    // transient() makes the storage owned (copying it at most once) and moves it into the builder.
+    // The builder is the only owner of the storage: it is the edit token. The storage can be
+    // mutated freely through it and persistent() moves it back into the vector in O(1).
+    // The destructor calls persistent() if it hasn't been called.
+    // Calling persistent() again (or on a moved-from builder) does nothing.
+    //
+    // While a transient is active, the vector is empty and must not be modified (such
+    // modifications are lost when the transient is persisted)
+    class Transient {
+    public:
+        Transient(Transient&& other) noexcept
+            : m_target(other.m_target)
+            , m_ptr(std::move(other.m_ptr))
+            , m_done(std::exchange(other.m_done, true))
+        {}
+        Transient(const Transient&) = delete;
+        Transient& operator=(const Transient&) = delete;
+        Transient& operator=(Transient&&) = delete;
+
+        ~Transient() {
+            persistent();
+        }
+
+        Wrapped& operator*() noexcept { return *m_ptr; }
+        Wrapped* operator->() noexcept { return m_ptr.get(); }
+
+        // false after persistent() and after being moved from
+        bool active() const noexcept { return !m_done; }
+
+        // freeze the storage back into the vector
+        VectorImpl& persistent() noexcept {
+            if (!std::exchange(m_done, true)) {
+                m_target->m_ptr = std::move(m_ptr);
+            }
+            return *m_target;
         }
+
+    private:
+        friend class VectorImpl;
+        Transient(VectorImpl& target, itlib::ref_ptr<Wrapped> ptr) noexcept
+            : m_target(&target)
+            , m_ptr(std::move(ptr))
+        {}
+
+        VectorImpl* m_target;
+        itlib::ref_ptr<Wrapped> m_ptr;
+        bool m_done = false;
+    };
+
+    [[nodiscard]] Transient transient() {
+        auto ptr = std::exchange(this->m_ptr, emptyPlaceholder());
+        if (!ptr.unique()) {
+            ptr = copy_of(*ptr, 0);
+        }
+        return Transient(*this, std::move(ptr));
     }
 
 private:
-    static void append_to(Wrapped& t, typename Wrapped::const_iterator sbegin, typename Wrapped::const_iterator send) {
+    // the contents of vectors with active transients
+    // it's never unique, so modifying such vectors doesn't affect it
+    static const itlib::ref_ptr<Wrapped>& emptyPlaceholder() {
+        static const itlib::ref_ptr<Wrapped> empty = itlib::make_ref_ptr<Wrapped>();
+        return empty;
+    }
+
+    template <typename InputIt>
+    static void append_to(Wrapped& t, InputIt sbegin, InputIt send) {
+        if constexpr (std::is_trivially_copyable_v<value_type> && std::forward_iterator<InputIt>) {
+            // the destination is grown with resize before the parallel copy, which requires
+            // default construction (and zero-fills the new elements: a serial memset)
+            // sources of other types (say int into double) are converted by the range insert below
+            if constexpr (std::contiguous_iterator<InputIt>
+                && std::same_as<std::remove_cv_t<std::iter_value_t<InputIt>>, value_type>
+                && std::is_default_constructible_v<value_type>
+            ) {
+                auto count = size_type(send - sbegin);
+                if (ParallelCopyScope::splits(count * sizeof(value_type))) {
+                    auto offset = t.size();
+                    t.resize(offset + count);
+                    parallelCopy(t.data() + offset, std::to_address(sbegin), count);
+                    return;
+                }
+            }
+            // trivially copyable values are not affected by the bug below
+            // a range insert grows the destination once and copies everything with a single memmove
+            t.insert(t.cend(), sbegin, send);
+        }
+        else {
 #if defined _MSC_VER
-        t.insert(t.cend(), sbegin, send);
+            t.insert(t.cend(), sbegin, send);
 #else
-        // unfortunately we can't use the simpler gcc and clang until https://bugs.llvm.org/show_bug.cgi?id=48619 is fixed
-        for (auto i = sbegin; i != send; ++i) {
-            t.emplace_back(*i);
-        }
+            // unfortunately we can't use the simpler gcc and clang until https://bugs.llvm.org/show_bug.cgi?id=48619 is fixed
+            for (auto i = sbegin; i != send; ++i) {
+                t.emplace_back(*i);
+            }
 #endif
+        }
+    }
+
+    // a copy of src with at least the given capacity
+    static itlib::ref_ptr<Wrapped> copy_of(const Wrapped& src, size_type cap) {
+        CopyMeter meter(src.size(), sizeof(value_type));
+        auto ret = itlib::make_ref_ptr<Wrapped>();
+        ret->reserve(std::max(cap, src.size()));
+        append_to(*ret, src.cbegin(), src.cend());
+        return ret;
+    }
+
+    // non-const access to the vector, copying it if it's shared
+    Wrapped& own() {
+        if (!this->unique()) {
+            this->m_ptr = copy_of(*this->m_ptr, 0);
+        }
+        return *this->m_ptr;
     }
 
     // used by push/emplace_back()
@@ -236,9 +425,28 @@ private:
     }
 
     // used by insert/emplace
+    // whether the range is of elements of this vector
+    template <typename InputIt>
+    bool inSelf(InputIt first, InputIt last) const {
+        if constexpr (std::forward_iterator<InputIt>
+            && std::is_lvalue_reference_v<std::iter_reference_t<InputIt>>
+            && std::same_as<std::remove_cvref_t<std::iter_reference_t<InputIt>>, value_type>
+        ) {
+            if (first == last) return false;
+            auto& v = *this->m_ptr;
+            const value_type* p = std::addressof(*first);
+            std::less<const value_type*> less;
+            return !less(p, v.data()) && less(p, v.data() + v.size());
+        }
+        else {
+            return false;
+        }
+    }
+
     struct inserter {
         inserter(VectorImpl& b, typename Wrapped::const_iterator pos, size_type count)
-            : m_v(b)
+            : m_meter(b.m_ptr->size(), sizeof(value_type))
+            , m_v(b)
             , m_oldVec(b.m_ptr.get())
             , m_pos(pos)
             , m_count(count)
@@ -257,6 +465,7 @@ private:
             return *m_newVec;
         }
 
+        CopyMeter m_meter; // first, so that it's destroyed last
         VectorImpl& m_v;
         Wrapped* m_oldVec;
         typename Wrapped::const_iterator m_pos;
@@ -267,6 +476,7 @@ private:
     iterator shrink(const_iterator pos, size_type by) {
         auto oldVec = this->m_ptr;
         if (pos + by > oldVec->cend()) throw 0;
+        CopyMeter meter(oldVec->size() - by, sizeof(value_type));
         this->m_ptr = itlib::make_ref_ptr<Wrapped>();
         auto& v = *this->m_ptr;
         v.reserve(oldVec->size() - by);
@@ -0,0 +1,78 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+namespace kuzco {
+
+// a monotonic version counter which can be polled with a single atomic load
+// and waited on until it advances
+// the publisher only takes a lock when there are blocked waiters
+class VersionSignal {
+public:
+    explicit VersionSignal(uint64_t initial = 0) noexcept
+        : m_version(initial)
+    {}
+
+    VersionSignal(const VersionSignal&) = delete;
+    VersionSignal& operator=(const VersionSignal&) = delete;
+
+    uint64_t version() const noexcept {
+        return m_version.load(std::memory_order_acquire);
+    }
+
+    // increment the version and wake up waiters
+    void bump() {
+        // seq_cst, so that we don't miss waiters which don't see the new version (see wait)
+        m_version.fetch_add(1);
+        if (m_waiters.load()) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cv.notify_all();
+        }
+    }
+
+    // block until the version is newer than the provided one or the timeout expires
+    // return the current version
+    template <typename Rep, typename Period>
+    uint64_t waitFor(uint64_t version, std::chrono::duration<Rep, Period> timeout) const {
+        return wait(version, [&](std::unique_lock<std::mutex>& lock, auto pred) {
+            m_cv.wait_for(lock, timeout, pred);
+        });
+    }
+
+    uint64_t waitFor(uint64_t version) const {
+        return wait(version, [&](std::unique_lock<std::mutex>& lock, auto pred) {
+            m_cv.wait(lock, pred);
+        });
+    }
+
+private:
+    template <typename Wait>
+    uint64_t wait(uint64_t version, Wait w) const {
+        auto v = this->version();
+        if (v > version) return v;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiters.fetch_add(1);
+        w(lock, [&]() {
+            v = m_version.load();
+            return v > version;
+        });
+        m_waiters.fetch_sub(1);
+        return v;
+    }
+
+    std::atomic<uint64_t> m_version;
+
+    // only touched by blocking waits
+    mutable std::atomic<uint32_t> m_waiters = 0;
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_cv;
+};
+
+} // namespace kuzco
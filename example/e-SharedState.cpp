@@ -1,119 +1,9 @@
 // Copyright (c) Borislav Stanimirov
 // SPDX-License-Identifier: MIT
 //
-#include <kuzco/Node.hpp>
-#include <kuzco/NodeTransaction.hpp>
-#include <kuzco/AtomicDetachedStorage.hpp>
-#include <mutex>
-#include <utility>
+#include <kuzco/SharedState.hpp>
 
-// an example of a shared state which multiple threads can
-// * read: atomically load
-// * write: transaction which atomically stores the new state on commit
-
-template <typename T>
-class SharedState {
-public:
-    SharedState(kuzco::Node<T> obj)
-        : m_sharedNode(obj)
-        , m_root(std::move(obj))
-    {}
-
-    SharedState(const SharedState&) = delete;
-    SharedState& operator=(const SharedState&) = delete;
-    SharedState(SharedState&&) = delete;
-    SharedState& operator=(SharedState&&) = delete;
-
-    class Transaction : private std::unique_lock<std::mutex>, private kuzco::NodeTransaction<T> {
-        // NOTE:
-        // since m_root is never unique at the beginning of a transaction (there is a strong ref in m_sharedNode).
-        // the restore state from NodeTransaction comes at practically no additional cost
-
-        kuzco::AtomicDetachedStorage<T>& m_sharedNode;
-
-        using NT = kuzco::NodeTransaction<T>;
-    public:
-        Transaction(SharedState& state)
-            : std::unique_lock<std::mutex>(state.m_transactionMutex)
-            , NT(state.m_root)
-            , m_sharedNode(state.m_sharedNode)
-        {}
-
-        Transaction(const Transaction&) = delete;
-        Transaction& operator=(const Transaction&) = delete;
-
-        using NT::done;
-        using NT::active;
-        using NT::revert;
-        using NT::restoreState;
-
-        // complete reverting changes
-        void abort() {
-            NT::abort();
-            this->unlock();
-        }
-
-        // complete committing changes
-        // return value: pair of (new detached state, whether state changed)
-        std::pair<kuzco::Detached<T>, bool> commit() {
-            auto ret = std::make_pair(this->detach(), NT::commit());
-
-            if (ret.second) {
-                // store state
-                m_sharedNode.store(ret.first);
-            }
-
-            this->unlock();
-            return ret;
-        }
-
-        // complete, either committing or aborting based on commit flag
-        // return value: pair of (new detached state, whether state changed)
-        std::pair<kuzco::Detached<T>, bool> complete(bool commit = true) {
-            if (!commit) {
-                auto ret = std::make_pair(restoreState(), false);
-                abort();
-                return ret;
-            }
-            return this->commit();
-        }
-
-        using NT::operator->;
-        using NT::r;
-        using NT::cow;
-
-        ~Transaction() {
-            if (!active()) {
-                // explicitly or implicitly completed
-                return;
-            }
-
-            if (std::uncaught_exceptions()) {
-                // something bad is happening, abort
-                abort();
-            }
-            else {
-                commit();
-            }
-        }
-    };
-
-    Transaction transaction() {
-        return Transaction(*this);
-    }
-
-    // atomic snapshot of the current state
-    kuzco::Detached<T> detach() const {
-        return m_sharedNode.detach();
-    }
-
-protected:
-    kuzco::AtomicDetachedStorage<T> m_sharedNode;
-
-    std::mutex m_transactionMutex;
-    // mutable root, modified during transaction, not thread safe
-    kuzco::Node<T> m_root;
-};
+// an example of a state which multiple threads read and write through a SharedState
 
 struct PersonData {
     PersonData() = default;
@@ -170,7 +60,7 @@ int main() {
     acme->staff.emplace_back(Employee{{"Alfonse", 21}, "mar", 15});
     acme->staff.emplace_back(Employee{{"Adelaide", 31}, "mar", 20});
 
-    SharedState<Company> state(std::move(acme));
+    kuzco::SharedState<Company> state(std::move(acme));
 
     const std::vector<std::function<void(Company&)>> writes = {
         [](Company& c) {
@@ -0,0 +1,62 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#pragma once
+#include <kuzco/Persist.hpp>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// types with PersistTraits for the tests of the stores, publishers, and deltas
+
+struct Item {
+    std::string name;
+    int value = 0;
+};
+
+struct Doc {
+    std::vector<kuzco::Node<Item>> items;
+    kuzco::OptNode<Item> extra;
+    std::vector<int> raw;
+};
+
+template <>
+struct kuzco::PersistTraits<Item> {
+    static void save(const Item& i, PersistWriter& w) {
+        w.value(i.name);
+        w.value(i.value);
+    }
+    static Item load(PersistReader& r) {
+        Item i;
+        i.name = r.value<std::string>();
+        i.value = r.value<int>();
+        return i;
+    }
+};
+
+template <>
+struct kuzco::PersistTraits<Doc> {
+    static void save(const Doc& d, PersistWriter& w) {
+        w.value(d.items);
+        w.node(d.extra);
+        w.value(d.raw);
+    }
+    static Doc load(PersistReader& r) {
+        Doc d;
+        d.items = r.value<std::vector<kuzco::Node<Item>>>();
+        d.extra = r.optNode<Item>();
+        d.raw = r.value<std::vector<int>>();
+        return d;
+    }
+};
+
+// a doc with n items named itemN with the value N
+inline kuzco::Node<Doc> makeDoc(int n) {
+    Doc d;
+    for (int i = 0; i < n; ++i) {
+        d.items.emplace_back(Item{"item" + std::to_string(i), i});
+    }
+    d.raw = {1, 2, 3};
+    return kuzco::Node<Doc>(std::move(d));
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+
+// a fire-and-forget coroutine
+// starts eagerly and destroys itself when done
+struct Spawn {
+    struct promise_type {
+        Spawn get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
@@ -0,0 +1,85 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TestTypes.hpp"
+#include <kuzco/CachedReader.hpp>
+#include <kuzco/SharedState.hpp>
+
+#include <doctest/doctest.h>
+
+#include <thread>
+#include <vector>
+#include <atomic>
+
+using namespace kuzco;
+
+TEST_CASE("basic") {
+    SharedState<PersonData> state({"Alice", 0});
+
+    CachedReader reader(state);
+    CHECK_FALSE(reader.cached());
+    CHECK(reader.version() == 0);
+
+    auto& d = reader.get();
+    CHECK(d->age == 0);
+    CHECK(reader.version() == 1);
+
+    // no new refs are created for an unchanged state
+    auto rc = d.use_count();
+    CHECK(reader->age == 0);
+    CHECK((*reader).name == "Alice");
+    CHECK_FALSE(reader.refresh());
+    CHECK(reader.get().use_count() == rc);
+    CHECK(reader.get() == state.detach());
+
+    {
+        auto t = state.transaction();
+        t->age = 5;
+    }
+
+    // the old snapshot is still cached
+    CHECK(reader.cached()->age == 0);
+    CHECK(reader->age == 5);
+    CHECK(reader.version() == 2);
+    CHECK_FALSE(reader.refresh());
+
+    reader.release();
+    CHECK_FALSE(reader.cached());
+    CHECK(reader->age == 5);
+
+    // also works with storages
+    AtomicDetachedStorage<PersonData> storage(Node<PersonData>("Bob", 3));
+    CachedReader sreader(storage);
+    CHECK(sreader->name == "Bob");
+    storage.store(Node<PersonData>("Bob", 4));
+    CHECK(sreader->age == 4);
+}
+
+TEST_CASE("MT") {
+    SharedState<PersonData> state({"Alice", 0});
+    constexpr int numWrites = 1000;
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i) {
+        readers.emplace_back([&]() {
+            thread_local CachedReader reader(state);
+            int prev = 0;
+            bool ordered = true;
+            while (prev < numWrites) {
+                auto age = reader->age;
+                ordered = ordered && age >= prev;
+                prev = age;
+            }
+            CHECK(ordered);
+        });
+    }
+
+    for (int i = 1; i <= numWrites; ++i) {
+        auto t = state.transaction();
+        t->age = i;
+    }
+
+    for (auto& t : readers) {
+        t.join();
+    }
+}
@@ -0,0 +1,144 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TestTypes.hpp"
+
+#include <kuzco/DeepEqual.hpp>
+#include <kuzco/NodeVector.hpp>
+
+#include <doctest/doctest.h>
+
+#include <string>
+#include <vector>
+
+using namespace kuzco;
+
+template <>
+inline constexpr auto kuzco::fields<PersonData> = makeFields(
+    field("name", &PersonData::name),
+    field("age", &PersonData::age)
+);
+
+template <>
+inline constexpr auto kuzco::fields<Employee> = makeFields(
+    field("data", &Employee::data),
+    field("department", &Employee::department),
+    field("salary", &Employee::salary)
+);
+
+namespace {
+struct Tree {
+    int value = 0;
+    NodeVector<Tree, std::vector> children;
+};
+
+// counts the compared values
+int comparedValues = 0;
+struct Value {
+    int v = 0;
+    bool operator==(const Value& other) const {
+        ++comparedValues;
+        return v == other.v;
+    }
+};
+
+struct Leaf {
+    Value value;
+};
+}
+
+template <>
+inline constexpr auto kuzco::fields<Tree> = makeFields(
+    field("value", &Tree::value),
+    field("children", &Tree::children)
+);
+
+template <>
+inline constexpr auto kuzco::fields<Leaf> = makeFields(
+    field("value", &Leaf::value)
+);
+
+static_assert(DeepEqualityComparable<Employee>);
+static_assert(DeepEqualityComparable<std::vector<Node<Employee>>>);
+static_assert(DeepEqualityComparable<Tree>);
+static_assert(!DeepEqualityComparable<Pair>);
+static_assert(!DeepEqualityComparable<std::vector<Boss>>);
+static_assert(!DeepEqualityComparable<Node<Pair>>);
+static_assert(!DeepEqualityComparable<std::vector<Node<Pair>>>);
+static_assert(!DeepEqualityComparable<Detached<Pair>>);
+
+TEST_CASE("values") {
+    CHECK(deepEqual(1, 1));
+    CHECK(!deepEqual(std::string("a"), std::string("b")));
+
+    PersonData a("Alice", 30), b("Alice", 30);
+    CHECK(deepEqual(a, b));
+    b.age = 31;
+    CHECK(!deepEqual(a, b));
+
+    Employee e1({"Alice", 30}, "eng", 100);
+    Employee e2({"Alice", 30}, "eng", 100);
+    CHECK(deepEqual(e1, e2));
+    e2.department = std::string("sales");
+    CHECK(!deepEqual(e1, e2));
+
+    OptNode<PersonData> n1, n2;
+    CHECK(deepEqual(n1, n2));
+    n1 = PersonData("x", 1);
+    CHECK(!deepEqual(n1, n2));
+    CHECK(!deepEqual(n2, n1));
+    n2 = PersonData("x", 1);
+    CHECK(deepEqual(n1, n2));
+    CHECK(deepEqual(n1.detach(), n2.detach()));
+    CHECK(!deepEqual(n1.detach(), Detached<PersonData>{}));
+
+    std::vector<Node<PersonData>> v1(2), v2(2);
+    CHECK(deepEqual(v1, v2));
+    v2.emplace_back();
+    CHECK(!deepEqual(v1, v2));
+}
+
+TEST_CASE("identity") {
+    std::vector<Node<Leaf>> v1;
+    for (int i = 0; i < 100; ++i) {
+        v1.emplace_back(Leaf{{i}});
+    }
+    auto v2 = v1;
+
+    comparedValues = 0;
+    CHECK(deepEqual(v1, v2));
+    CHECK(comparedValues == 0);
+
+    v2[50] = Leaf{{50}};
+    CHECK(deepEqual(v1, v2));
+    CHECK(comparedValues == 1);
+
+    v2[60] = Leaf{{-1}};
+    comparedValues = 0;
+    CHECK(!deepEqual(v1, v2));
+    CHECK(comparedValues == 2);
+}
+
+TEST_CASE("recursive") {
+    Node<Tree> t1;
+    t1->value = 1;
+    for (int i = 0; i < 3; ++i) {
+        Node<Tree> c;
+        c->value = 10 + i;
+        c->children.push_back(Node<Tree>());
+        t1->children.push_back(c);
+    }
+
+    auto t2 = t1;
+    CHECK(deepEqual(t1, t2));
+
+    // copies
+    Node<Tree> t3(Tree(t1.r()));
+    CHECK(t3.detach() != t1.detach());
+    CHECK(deepEqual(t1, t3));
+
+    t3->children.modify(1)->children.modify(0)->value = 5;
+    CHECK(!deepEqual(t1, t3));
+    t3->children.modify(1)->children.modify(0)->value = 0;
+    CHECK(deepEqual(t1, t3));
+}
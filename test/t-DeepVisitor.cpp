@@ -0,0 +1,231 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TestTypes.hpp"
+
+#include <kuzco/DeepVisitor.hpp>
+#include <kuzco/NodeVector.hpp>
+
+#include <doctest/doctest.h>
+#include <doctest/util/lifetime_counter.hpp>
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+using namespace kuzco;
+namespace tu = doctest::util;
+
+template <>
+inline constexpr auto kuzco::fields<PersonData> = makeFields(
+    field("name", &PersonData::name),
+    field("age", &PersonData::age)
+);
+
+template <>
+inline constexpr auto kuzco::fields<Employee> = makeFields(
+    field("data", &Employee::data),
+    field("department", &Employee::department),
+    field("salary", &Employee::salary)
+);
+
+template <>
+inline constexpr auto kuzco::fields<Boss> = makeFields(
+    field("data", &Boss::data)
+);
+
+template <>
+inline constexpr auto kuzco::fields<Company> = makeFields(
+    field("name", &Company::name),
+    field("staff", &Company::staff),
+    field("ceo", &Company::ceo),
+    field("cto", &Company::cto)
+);
+
+static_assert(HasFields<Employee>);
+static_assert(!HasFields<Pair>);
+static_assert(numFields<Employee> == 3);
+static_assert(numFields<Pair> == 0);
+static_assert(std::get<1>(fields<Employee>).name == "department");
+static_assert(std::is_same_v<std::remove_cvref_t<decltype(std::get<2>(fields<Employee>))>::value_type, double>);
+
+TEST_CASE("fields") {
+    PersonData p("Alice", 30);
+    std::string names;
+    forEachField(p, [&](std::string_view name, auto& value) {
+        names += name;
+        names += ' ';
+        if constexpr (std::is_same_v<std::decay_t<decltype(value)>, int>) {
+            value += 1;
+        }
+    });
+    CHECK(names == "name age ");
+    CHECK(p.age == 31);
+}
+
+namespace {
+Node<Company> makeCompany() {
+    Company c;
+    c.name = "ACME";
+    c.staff.emplace_back(Employee({"Alice", 30}, "eng", 100));
+    c.staff.emplace_back(Employee({"Bob", 40}, "eng", 200));
+    c.staff.emplace_back(Employee({"Charlie", 50}, "sales", 300));
+    c.ceo->data = PersonData("Dave", 60);
+    return Node<Company>(std::move(c));
+}
+
+struct Counter {
+    int nodes = 0;
+    double salaries = 0;
+    int ages = 0;
+    std::vector<std::string> strings;
+
+    template <typename T>
+    bool enterNode(const T&) {
+        ++nodes;
+        return true;
+    }
+
+    void value(double d) { salaries += d; }
+    void value(int i) { ages += i; }
+    void value(const std::string& s) { strings.push_back(s); }
+};
+
+// visits shared nodes once
+struct Unique {
+    std::unordered_set<const void*> seen;
+    template <typename T>
+    bool enterNode(const T& value) {
+        return seen.insert(&value).second;
+    }
+};
+
+struct NodesOnly {
+    int& n;
+    template <typename T>
+    bool enterNode(const T&) { ++n; return true; }
+};
+
+// skips the nodes of a previous version
+struct Changed {
+    const std::unordered_set<const void*>& old;
+    int changed = 0;
+    template <typename T>
+    bool enterNode(const T& value) {
+        if (old.count(&value)) return false;
+        ++changed;
+        return true;
+    }
+};
+
+struct Sum {
+    int sum = 0;
+    int nodes = 0;
+    template <typename T>
+    bool enterNode(const T&) { ++nodes; return true; }
+    void value(int i) { sum += i; }
+};
+
+struct Paths {
+    std::string path;
+    std::vector<std::string> leaves;
+
+    void enterField(std::string_view name) {
+        path += '/';
+        path += name;
+    }
+    void leaveField(std::string_view) {
+        path.resize(path.rfind('/'));
+    }
+    template <typename T>
+    void value(const T&) {
+        leaves.push_back(path);
+    }
+};
+}
+
+TEST_CASE("visit") {
+    auto company = makeCompany();
+
+    Company::lifetime_stats sComp;
+    Employee::lifetime_stats sEmp;
+    PersonData::lifetime_stats sPers;
+    tu::lifetime_counter_sentry lsc(sComp), lse(sEmp), lsp(sPers);
+
+    Counter c;
+    visitDeep(company, c);
+    CHECK(c.nodes == 1 + 3 * 3 + 2); // company, employees with data and department, ceo with data
+    CHECK(c.salaries == 600);
+    CHECK(c.ages == 180);
+    CHECK(c.strings == std::vector<std::string>{
+        "ACME", "Alice", "eng", "Bob", "eng", "Charlie", "sales", "Dave"
+    });
+
+    // no copies
+    CHECK(sComp.total == 0);
+    CHECK(sEmp.total == 0);
+    CHECK(sPers.total == 0);
+    CHECK(company.unique());
+
+    Paths p;
+    visitDeep(company.r(), p);
+    CHECK(p.path.empty());
+    CHECK(p.leaves == std::vector<std::string>{
+        "/name",
+        "/staff/data/name", "/staff/data/age", "/staff/department", "/staff/salary",
+        "/staff/data/name", "/staff/data/age", "/staff/department", "/staff/salary",
+        "/staff/data/name", "/staff/data/age", "/staff/department", "/staff/salary",
+        "/ceo/data/name", "/ceo/data/age",
+    });
+
+    // leaves which the visitor doesn't accept are skipped
+    int nodes = 0;
+    visitDeep(company, NodesOnly{nodes});
+    CHECK(nodes == c.nodes);
+}
+
+TEST_CASE("skip by identity") {
+    auto company = makeCompany();
+
+    // shared nodes
+    company->staff[1]->department = company.r().staff[0].r().department;
+    company->cto = company.r().ceo;
+
+    Unique u;
+    visitDeep(company, u);
+    CHECK(u.seen.size() == 1 + 3 * 2 + 2 + 2);
+
+    // a later version only differs in the nodes which are not in the previous one
+    auto prev = company.detach();
+    Unique old;
+    visitDeep(prev, old);
+    company->staff[2]->salary = 1000;
+
+    Changed ch{old.seen};
+    visitDeep(company, ch);
+    CHECK(ch.changed == 2); // the company and the employee
+}
+
+TEST_CASE("containers") {
+    struct Doc {
+        NodeVector<PersonData, std::vector> people;
+        Vector<std::vector<int>> numbers;
+        std::vector<std::vector<int>> nested;
+    };
+
+    Doc d;
+    d.people.push_back(Node<PersonData>("x", 1));
+    d.people.push_back(Node<PersonData>("y", 2));
+    d.numbers.push_back(10);
+    d.numbers.push_back(20);
+    d.nested = {{100}, {200, 300}};
+
+    Sum s;
+    visitDeep(d.people, s);
+    CHECK(s.nodes == 3); // the vector and the items
+    CHECK(s.sum == 3);
+    visitDeep(d.numbers, s);
+    CHECK(s.sum == 33);
+    visitDeep(d.nested, s);
+    CHECK(s.sum == 633);
+}
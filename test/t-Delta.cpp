@@ -0,0 +1,211 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "PersistTestTypes.hpp"
+
+#include <kuzco/Delta.hpp>
+#include <kuzco/NodeVector.hpp>
+#include <kuzco/SharedState.hpp>
+
+#include <doctest/doctest.h>
+
+#include <string>
+#include <vector>
+
+using namespace kuzco;
+
+namespace {
+using Items = NodeVector<Item, std::vector>;
+
+// the items are a node (as opposed to the Doc of PersistTestTypes.hpp)
+struct ListDoc {
+    Items items;
+    OptNode<Item> extra;
+    int version = 0;
+};
+}
+
+template <>
+struct kuzco::PersistTraits<ListDoc> {
+    static void save(const ListDoc& d, PersistWriter& w) {
+        w.node(d.items); // a NodeVector is a node of its std::vector
+        w.node(d.extra);
+        w.value(d.version);
+    }
+    static ListDoc load(PersistReader& r) {
+        ListDoc d;
+        d.items = Items(r.optNode<Items::Wrapped>());
+        d.extra = r.optNode<Item>();
+        d.version = r.value<int>();
+        return d;
+    }
+};
+
+namespace {
+Node<ListDoc> makeListDoc(int n) {
+    ListDoc d;
+    for (int i = 0; i < n; ++i) {
+        d.items.emplace_back(Item{"item" + std::to_string(i), i});
+    }
+    return Node<ListDoc>(std::move(d));
+}
+
+void checkEqual(const ListDoc& a, const ListDoc& b) {
+    REQUIRE(a.items.size() == b.items.size());
+    for (size_t i = 0; i < a.items.size(); ++i) {
+        CHECK(a.items[i].r().name == b.items[i].r().name);
+        CHECK(a.items[i].r().value == b.items[i].r().value);
+    }
+    CHECK(!!a.extra == !!b.extra);
+    if (a.extra) {
+        CHECK(a.extra.r().name == b.extra.r().name);
+    }
+    CHECK(a.version == b.version);
+}
+}
+
+TEST_CASE("full") {
+    auto doc = makeListDoc(10);
+
+    DeltaStats stats;
+    auto delta = encodeDelta({}, doc.detach(), &stats);
+    CHECK(stats.nodesEncoded == 12); // the doc, the vector, and the items
+    CHECK(stats.nodesReused == 0);
+    CHECK(stats.bytes == delta.size());
+
+    auto copy = applyDelta(Detached<ListDoc>{}, delta);
+    REQUIRE(copy);
+    checkEqual(copy.r(), doc.r());
+
+    // null
+    CHECK(!applyDelta(copy.detach(), encodeDelta(doc.detach(), Detached<ListDoc>{})));
+}
+
+TEST_CASE("incremental") {
+    SharedState<ListDoc> leader(makeListDoc(1000));
+    auto prev = leader.detach();
+
+    // the follower starts from a full copy
+    auto follower = applyDelta(Detached<ListDoc>{}, encodeDelta({}, prev));
+    auto full = encodeDelta({}, prev).size();
+
+    // unchanged
+    {
+        DeltaStats stats;
+        auto delta = encodeDelta(prev, prev, &stats);
+        CHECK(delta.size() < 10);
+        CHECK(stats.nodesEncoded == 0);
+        auto next = applyDelta(follower.detach(), delta);
+        CHECK(next.detach() == follower.detach());
+    }
+
+    auto step = [&](DeltaStats& stats) {
+        auto cur = leader.detach();
+        auto delta = encodeDelta(prev, cur, &stats);
+        auto next = applyDelta(follower.detach(), delta);
+        REQUIRE(next);
+        checkEqual(next.r(), *cur);
+        prev = cur;
+        auto old = follower;
+        follower = next;
+        return old;
+    };
+
+    SUBCASE("update") {
+        leader.transaction()->items.modify(500)->value = -1;
+        DeltaStats stats;
+        auto old = step(stats);
+        CHECK(stats.nodesEncoded == 3); // the doc, the vector, and the item
+        CHECK(stats.nodesReused == 999);
+        CHECK(stats.bytes < full / 50);
+
+        // maximal sharing with the previous snapshot of the follower
+        auto& items = follower.r().items;
+        auto& oldItems = old.r().items;
+        CHECK(items[499].detach() == oldItems[499].detach());
+        CHECK(items[501].detach() == oldItems[501].detach());
+        CHECK(items[500].detach() != oldItems[500].detach());
+        CHECK(items[500].r().value == -1);
+    }
+
+    SUBCASE("insert and erase") {
+        {
+            auto t = leader.transaction();
+            t->items.insert(t->items.begin() + 10, Node<Item>(Item{"new", 1}));
+            t->items.erase(t->items.begin() + 900);
+            t->items.push_back(Node<Item>(Item{"last", 2}));
+        }
+        DeltaStats stats;
+        auto old = step(stats);
+        CHECK(stats.nodesEncoded == 4); // the doc, the vector, and the two new items
+        CHECK(stats.bytes < 100);
+
+        auto& items = follower.r().items;
+        auto& oldItems = old.r().items;
+        REQUIRE(items.size() == 1001);
+        CHECK(items[9].detach() == oldItems[9].detach());
+        CHECK(items[10].r().name == "new");
+        CHECK(items[11].detach() == oldItems[10].detach());
+        CHECK(items[899].detach() == oldItems[898].detach());
+        CHECK(items[900].detach() == oldItems[900].detach());
+        CHECK(items[999].detach() == oldItems[999].detach());
+        CHECK(items[1000].r().name == "last");
+    }
+
+    SUBCASE("shared and restored") {
+        {
+            auto t = leader.transaction();
+            t->extra = Node<Item>(Item{"shared", 5});
+            t->items.modify(3) = Node<Item>(t->extra);
+            ++t->version;
+        }
+        DeltaStats stats;
+        step(stats);
+        CHECK(follower.r().extra.r().name == "shared");
+        // shared in the leader, shared in the follower
+        CHECK(follower.r().items[3].detach() == follower.r().extra.detach());
+
+        // modified and restored
+        {
+            auto t = leader.transaction();
+            t->items.modify(7)->value = 100;
+        }
+        step(stats);
+        auto old = follower;
+        {
+            auto t = leader.transaction();
+            t->items.modify(7)->value = 7;
+            t->items.modify(8)->value = 8; // a copy with the same contents
+        }
+        step(stats);
+        CHECK(stats.nodesEncoded == 3); // the doc, the vector, and item 7
+        CHECK(follower.r().items[8].detach() == old.r().items[8].detach());
+        CHECK(follower.r().items[7].r().value == 7);
+    }
+}
+
+TEST_CASE("bad delta") {
+    auto doc = makeListDoc(5);
+    auto delta = encodeDelta({}, doc.detach());
+
+    CHECK_THROWS_AS(applyDelta(Detached<ListDoc>{}, std::string_view(delta).substr(0, delta.size() - 3)), std::runtime_error);
+    CHECK_THROWS_AS(applyDelta(Detached<ListDoc>{}, delta + "x"), std::runtime_error);
+    CHECK_THROWS_AS(applyDelta(Detached<ListDoc>{}, "hello"), std::runtime_error);
+
+    // copies from a missing base
+    auto next = doc;
+    next->version = 10;
+    auto d2 = encodeDelta(doc.detach(), next.detach());
+    CHECK_THROWS_AS(applyDelta(Detached<ListDoc>{}, d2), std::runtime_error);
+
+    // a copy of a base child of a different type
+    doc->extra = Item{"extra", 1};
+    next = doc;
+    next->items.modify(2)->value = 20;
+    auto d3 = encodeDelta(doc.detach(), next.detach());
+    // extra is the last child: a copy of child 1 of the base
+    REQUIRE(d3.substr(d3.size() - 3) == std::string("\x01\x01\x01", 3));
+    CHECK(applyDelta(doc.detach(), d3).r().extra.r().name == "extra");
+    d3[d3.size() - 2] = 0; // the items
+    CHECK_THROWS_AS(applyDelta(doc.detach(), d3), std::runtime_error);
+}
@@ -0,0 +1,123 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TestCoro.hpp"
+#include <kuzco/FifoMutex.hpp>
+#include <kuzco/SimpleExecutor.hpp>
+
+#include <doctest/doctest.h>
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+using namespace kuzco;
+
+TEST_CASE("executor") {
+    SimpleExecutor ex;
+    std::vector<int> log;
+    ex.post([&]() { log.push_back(1); });
+    ex.post([&]() {
+        log.push_back(2);
+        ex.post([&]() { log.push_back(3); });
+    });
+    CHECK(log.empty());
+    CHECK(ex.poll() == 3);
+    CHECK(log == std::vector<int>{1, 2, 3});
+    CHECK(ex.poll() == 0);
+
+    std::thread t([&]() { ex.run(); });
+    ex.post([&]() { log.push_back(4); });
+    ex.post([&]() { ex.stop(); });
+    t.join();
+    CHECK(log == std::vector<int>{1, 2, 3, 4});
+}
+
+TEST_CASE("sync") {
+    FifoMutex m;
+    CHECK(m.try_lock());
+    CHECK_FALSE(m.try_lock());
+    m.unlock();
+    CHECK(m.try_lock());
+    m.unlock();
+
+    // waiters are served in order
+    std::vector<int> order;
+    std::atomic<int> waiting = 0;
+    m.lock();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&, i]() {
+            ++waiting;
+            std::lock_guard<FifoMutex> l(m);
+            order.push_back(i);
+        });
+        // make sure the thread is queued before starting the next one
+        while (waiting != i + 1) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    m.unlock();
+    for (auto& t : threads) t.join();
+    CHECK(order == std::vector<int>{0, 1, 2, 3});
+}
+
+Spawn locker(FifoMutex& m, SimpleExecutor& ex, std::vector<int>& log, int id) {
+    co_await m.lockAsync(ex);
+    log.push_back(id);
+    m.unlock();
+}
+
+TEST_CASE("async") {
+    FifoMutex m;
+    SimpleExecutor ex;
+    std::vector<int> log;
+
+    // not locked: no suspension
+    locker(m, ex, log, 0);
+    CHECK(log == std::vector<int>{0});
+    CHECK(ex.poll() == 0);
+
+    m.lock();
+    for (int i = 1; i <= 3; ++i) {
+        locker(m, ex, log, i);
+    }
+    CHECK(ex.poll() == 0);
+    CHECK(log.size() == 1);
+
+    // ownership is handed off to the first coroutine, which is posted to the executor
+    m.unlock();
+    CHECK_FALSE(m.try_lock());
+    CHECK(log.size() == 1);
+
+    CHECK(ex.poll() == 3);
+    CHECK(log == std::vector<int>{0, 1, 2, 3});
+    CHECK(m.try_lock());
+    m.unlock();
+}
+
+TEST_CASE("mixed") {
+    FifoMutex m;
+    SimpleExecutor ex;
+    std::vector<int> log;
+
+    m.lock();
+    locker(m, ex, log, 1);
+
+    std::atomic<bool> started = false;
+    std::thread t([&]() {
+        started = true;
+        std::lock_guard<FifoMutex> l(m);
+        log.push_back(2);
+    });
+    while (!started) std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    locker(m, ex, log, 3);
+
+    m.unlock();
+    ex.poll(); // 1, hands off to the thread
+    t.join(); // 2, hands off to 3
+    ex.poll(); // 3
+    CHECK(log == std::vector<int>{1, 2, 3});
+}
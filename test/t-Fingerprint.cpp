@@ -6,6 +6,8 @@
 #include <doctest/doctest.h>
 #include <doctest/util/lifetime_counter.hpp>
 
+#include <concepts>
+
 using namespace kuzco;
 namespace tu = doctest::util;
 
@@ -53,3 +55,78 @@ TEST_CASE("basic") {
     fp.reset();
     CHECK_FALSE(fp);
 }
+
+namespace {
+struct Stamped : public GenerationStamp {
+    Stamped() = default;
+    Stamped(int v) : value(v) {}
+    int value = 0;
+    bool operator==(const Stamped&) const = default;
+};
+}
+
+static_assert(HasGenerationStamp<Stamped>);
+static_assert(std::equality_comparable<Stamped>);
+static_assert(!HasGenerationStamp<PersonData>);
+
+TEST_CASE("versioned") {
+    VersionedFingerprint vfp;
+    CHECK_FALSE(vfp);
+
+    Node<Stamped> n(1);
+    vfp = n.versionedFingerprint();
+    CHECK(vfp);
+    CHECK(vfp == n);
+    CHECK(n.r().value == 1); // reading doesn't bump the generation
+    CHECK(vfp == n);
+
+    // in-place change of a unique node
+    auto fp = n.fingerprint();
+    n->value = 2;
+    CHECK(n.unique());
+    CHECK(fp == n); // plain fingerprints don't notice
+    CHECK(vfp != n);
+    CHECK(vfp.fingerprint() == fp);
+
+    vfp = n.versionedFingerprint();
+    CHECK(vfp == n);
+    n = Stamped(3);
+    CHECK(n.unique());
+    CHECK(vfp != n);
+
+    vfp = n.versionedFingerprint();
+    n.cow();
+    CHECK(vfp != n);
+
+    // copy on write
+    vfp = n.versionedFingerprint();
+    auto d = n.detach();
+    CHECK(vfp == d);
+    VersionedFingerprint vfp2 = d;
+    CHECK(vfp == vfp2);
+    n->value = 4;
+    CHECK(vfp != n);
+    CHECK(vfp == d);
+    CHECK(d->value == 3);
+
+    // the generation of a copy is independent
+    auto vn = n.versionedFingerprint();
+    CHECK(vn != vfp);
+    CHECK(vn.generation() == 1);
+
+    vfp.reset();
+    CHECK_FALSE(vfp);
+    CHECK(vfp != vfp2);
+
+    OptNode<Stamped> on;
+    vfp = on.versionedFingerprint();
+    CHECK(vfp == on);
+    CHECK(on.get() == nullptr);
+    on = Stamped(5);
+    CHECK(vfp != on);
+
+    // the generation is not compared
+    CHECK(n.r().generation() != Stamped(4).generation());
+    CHECK(n.r() == Stamped(4));
+    CHECK_FALSE(n.r() == Stamped(5));
+}
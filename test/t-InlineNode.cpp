@@ -0,0 +1,102 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/InlineNode.hpp>
+#include <kuzco/NodeTransaction.hpp>
+#include <kuzco/NodeStdVector.hpp>
+
+#include <doctest/doctest.h>
+
+#include <string>
+
+using namespace kuzco;
+
+namespace {
+struct Point {
+    int x = 0;
+    int y = 0;
+    bool operator==(const Point&) const = default;
+};
+
+struct Person {
+    Node<std::string> name;
+    InlineNode<int> age;
+    InlineNode<Point> pos;
+};
+}
+
+TEST_CASE("inline node") {
+    static_assert(sizeof(InlineNode<int>) == sizeof(int));
+    static_assert(sizeof(InlineNode<Point>) == sizeof(Point));
+    static_assert(std::is_trivially_copyable_v<InlineNode<Point>>);
+
+    InlineNode<int> i;
+    CHECK(i.r() == 0);
+    CHECK(*i == 0);
+    CHECK(i.unique());
+
+    InlineNode<Point> p(1, 2);
+    CHECK(p->x == 1);
+    CHECK(p.r().y == 2);
+
+    auto p2 = p;
+    p2->x = 10;
+    CHECK(p.r().x == 1);
+    CHECK(p2.r().x == 10);
+    CHECK(p != p2);
+
+    p2.cow().x = 1;
+    CHECK(p == p2);
+
+    p = Point{5, 6};
+    CHECK(p->x == 5);
+
+    auto d = p.detach();
+    p->y = 7;
+    CHECK(d.y == 6);
+}
+
+TEST_CASE("inline node member") {
+    Node<Person> n;
+    n->name = "Alice";
+    n->age = 30;
+    n->pos = Point{3, 4};
+
+    NodeTransaction t(n);
+    t->age.cow() += 1;
+    t->pos->x = 0;
+    auto restore = t.restoreState();
+    CHECK(restore->age.r() == 30);
+    CHECK(restore->pos->x == 3);
+    CHECK(t.r().age.r() == 31);
+
+    // the string node is shared between the states
+    CHECK(restore->name == t.r().name.detach());
+    t.abort();
+
+    CHECK(n->age.r() == 30);
+}
+
+TEST_CASE("inline node vector") {
+    NodeVector<int, std::vector, InlineNode> vec;
+    static_assert(sizeof(decltype(vec)::value_type) == sizeof(int));
+
+    for (int i = 0; i < 10; ++i) {
+        vec.emplace_back(i);
+    }
+
+    auto copy = vec;
+    copy.modify(3) = 33;
+    CHECK(copy[3].r() == 33);
+    CHECK(vec[3].r() == 3);
+
+    auto f = copy.find_if([](int i) { return i == 5; });
+    CHECK(!!f);
+    f = 55;
+    CHECK(copy[5].r() == 55);
+    CHECK(vec[5].r() == 5);
+
+    CHECK(copy.erase_if([](int i) { return i > 30; }) == 2);
+    CHECK(copy.size() == 8);
+    CHECK(vec.size() == 10);
+}
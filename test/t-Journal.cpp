@@ -0,0 +1,346 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/Journal.hpp>
+#include <kuzco/SharedState.hpp>
+
+#include <doctest/doctest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#include <csignal>
+#endif
+
+using namespace kuzco;
+namespace fs = std::filesystem;
+
+namespace {
+// a journal file path in the temp dir which is removed when done
+struct TempPath {
+    fs::path path;
+    explicit TempPath(const char* name)
+        : path(fs::temp_directory_path() / name)
+    {
+        fs::remove(path);
+    }
+    ~TempPath() {
+        fs::remove(path);
+        fs::remove(fs::path(path) += ".tmp");
+    }
+};
+
+std::vector<std::string> readAll(const fs::path& path, uint64_t afterLsn = 0) {
+    std::vector<std::string> ret;
+    Journal::replay(path, [&](std::string_view rec) { ret.emplace_back(rec); }, afterLsn);
+    return ret;
+}
+}
+
+TEST_CASE("append and replay") {
+    for (auto sync : {JournalSync::None, JournalSync::EveryCommit, JournalSync::Batched}) {
+        TempPath tmp("kuzco-t-journal-basic.kzj");
+
+        JournalConfig config;
+        config.sync = sync;
+        config.maxDelay = std::chrono::microseconds(100);
+        {
+            Journal j(tmp.path, config);
+            CHECK(j.lastLsn() == 0);
+            uint64_t lsn = 0;
+            for (int i = 0; i < 100; ++i) {
+                lsn = j.append("rec" + std::to_string(i));
+            }
+            CHECK(lsn == 100);
+            j.append({}); // empty records are allowed
+            j.waitDurable(101);
+            CHECK(j.durableLsn() == 101);
+
+            auto m = j.metrics();
+            CHECK(m.records == 101);
+            CHECK(m.bytes == 101 * 16 + 10 * 4 + 90 * 5);
+            if (sync == JournalSync::EveryCommit) {
+                CHECK(m.syncs == 101);
+            }
+            if (sync == JournalSync::Batched) {
+                CHECK(m.syncs >= 1);
+                CHECK(m.syncs <= 101);
+            }
+            CHECK(m.maxAppendTime.count() > 0);
+            CHECK(m.appendTime >= m.maxAppendTime);
+        }
+
+        auto recs = readAll(tmp.path);
+        REQUIRE(recs.size() == 101);
+        CHECK(recs[0] == "rec0");
+        CHECK(recs[99] == "rec99");
+        CHECK(recs[100].empty());
+
+        CHECK(readAll(tmp.path, 98).size() == 3);
+        CHECK(Journal::replay(tmp.path, [](std::string_view) {}, 50) == 101);
+
+        // reopen and continue
+        {
+            Journal j(tmp.path, config);
+            CHECK(j.lastLsn() == 101);
+            CHECK(j.append("more") == 102);
+        }
+        recs = readAll(tmp.path);
+        REQUIRE(recs.size() == 102);
+        CHECK(recs.back() == "more");
+    }
+}
+
+TEST_CASE("missing and torn") {
+    TempPath tmp("kuzco-t-journal-torn.kzj");
+
+    CHECK(readAll(tmp.path).empty());
+    CHECK(Journal::replay(tmp.path, [](std::string_view) {}, 5) == 5);
+
+    {
+        Journal j(tmp.path, {JournalSync::None});
+        j.append("a");
+        j.append("bb");
+        j.append("ccc");
+    }
+
+    auto size = fs::file_size(tmp.path);
+
+    // crash in the middle of a record
+    {
+        std::ofstream f(tmp.path, std::ios::binary | std::ios::app);
+        f.write("\x04\x00\x00\x00\x00\x00\x00\x00\x10\x00", 10);
+    }
+    CHECK(readAll(tmp.path).size() == 3);
+
+    {
+        Journal j(tmp.path, {JournalSync::None});
+        CHECK(fs::file_size(tmp.path) == size);
+        CHECK(j.lastLsn() == 3);
+        CHECK(j.append("dddd") == 4);
+    }
+
+    auto recs = readAll(tmp.path);
+    REQUIRE(recs.size() == 4);
+    CHECK(recs[3] == "dddd");
+
+    // corrupted data
+    {
+        std::fstream f(tmp.path, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(-1, std::ios::end);
+        f.put('x');
+    }
+    CHECK(readAll(tmp.path).size() == 3);
+
+    // not a journal
+    {
+        std::ofstream f(tmp.path, std::ios::binary | std::ios::trunc);
+        f << "hello, world, this is not a journal";
+    }
+    CHECK_THROWS_AS(readAll(tmp.path), std::runtime_error);
+    CHECK_THROWS_AS(Journal(tmp.path), std::runtime_error);
+}
+
+TEST_CASE("checkpoint") {
+    TempPath tmp("kuzco-t-journal-checkpoint.kzj");
+
+    {
+        Journal j(tmp.path, {JournalSync::EveryCommit});
+        for (int i = 1; i <= 5; ++i) {
+            j.append(std::to_string(i));
+        }
+        j.checkpoint(3);
+        CHECK(readAll(tmp.path) == std::vector<std::string>{"4", "5"});
+        CHECK(j.lastLsn() == 5);
+        CHECK(j.append("6") == 6);
+        CHECK(readAll(tmp.path, 4) == std::vector<std::string>{"5", "6"});
+
+        j.checkpoint(6);
+        CHECK(readAll(tmp.path).empty());
+        CHECK(j.append("7") == 7);
+        j.checkpoint(7);
+    }
+
+    // lsns continue after a restart with an empty journal
+    {
+        Journal j(tmp.path);
+        CHECK(j.lastLsn() == 7);
+        CHECK(j.append("8") == 8);
+    }
+    CHECK(readAll(tmp.path) == std::vector<std::string>{"8"});
+}
+
+TEST_CASE("failed checkpoint") {
+    TempPath tmp("kuzco-t-journal-failed-checkpoint.kzj");
+    auto tmpPath = fs::path(tmp.path) += ".tmp";
+
+    {
+        Journal j(tmp.path, {JournalSync::EveryCommit});
+        j.append("1");
+        j.append("2");
+
+        // the temp file can't be created
+        fs::create_directory(tmpPath);
+        CHECK_THROWS_AS(j.checkpoint(1), std::runtime_error);
+        fs::remove(tmpPath);
+
+        // the journal is intact and usable
+        CHECK(j.append("3") == 3);
+        CHECK(readAll(tmp.path) == std::vector<std::string>{"1", "2", "3"});
+
+        j.checkpoint(1);
+        CHECK(j.append("4") == 4);
+    }
+    CHECK(readAll(tmp.path) == std::vector<std::string>{"2", "3", "4"});
+}
+
+#if !defined(_WIN32)
+namespace {
+// writes beyond the given file size fail
+struct FileSizeLimit {
+    rlimit prev;
+    explicit FileSizeLimit(rlim_t size) {
+        std::signal(SIGXFSZ, SIG_IGN);
+        getrlimit(RLIMIT_FSIZE, &prev);
+        rlimit lim = prev;
+        lim.rlim_cur = size;
+        setrlimit(RLIMIT_FSIZE, &lim);
+    }
+    ~FileSizeLimit() {
+        setrlimit(RLIMIT_FSIZE, &prev);
+        std::signal(SIGXFSZ, SIG_DFL);
+    }
+};
+}
+
+TEST_CASE("failed append") {
+    for (auto sync : {JournalSync::None, JournalSync::EveryCommit, JournalSync::Batched}) {
+        TempPath tmp("kuzco-t-journal-failed-append.kzj");
+
+        {
+            Journal j(tmp.path, {sync});
+            j.append("1");
+            j.sync();
+            auto size = fs::file_size(tmp.path);
+
+            // a part of the record fits
+            // (for batched sync the buffer is written when the record doesn't fit in it)
+            {
+                FileSizeLimit limit(size + 100);
+                CHECK_THROWS_AS(j.append(std::string(100000, 'x')), std::runtime_error);
+            }
+            CHECK(fs::file_size(tmp.path) == size);
+            CHECK(j.lastLsn() == 1);
+
+            // the journal is usable and the following records are not lost
+            CHECK(j.append("2") == 2);
+            j.waitDurable(2);
+        }
+        CHECK(readAll(tmp.path) == std::vector<std::string>{"1", "2"});
+    }
+}
+#endif
+
+namespace {
+struct Log {
+    std::vector<int> values;
+};
+
+int parse(std::string_view rec) {
+    return std::stoi(std::string(rec));
+}
+}
+
+TEST_CASE("shared state") {
+    TempPath tmp("kuzco-t-journal-state.kzj");
+
+    Detached<Log> saved;
+    uint64_t savedLsn = 0;
+    Detached<Log> final;
+
+    {
+        Journal j(tmp.path, {JournalSync::Batched});
+        SharedState<Log> state({});
+
+        // no journal
+        {
+            auto t = state.transaction();
+            t.journal("0");
+            t->values.push_back(0);
+            t.commit();
+            CHECK(t.lsn() == 0);
+        }
+
+        state.setJournal(&j);
+        // the state at the time of the journal is the base snapshot
+        state.checkpoint([&](Detached<Log> s, uint64_t lsn) {
+            saved = s;
+            savedLsn = lsn;
+        });
+        CHECK(savedLsn == 0);
+
+        for (int i = 1; i <= 5; ++i) {
+            auto t = state.transaction();
+            t.journal(std::to_string(i));
+            t->values.push_back(i);
+            auto [d, changed] = t.commit();
+            CHECK(changed);
+            CHECK(t.lsn() == uint64_t(i));
+        }
+
+        // aborted
+        {
+            auto t = state.transaction();
+            t.journal("100");
+            t->values.push_back(100);
+            t.abort();
+            CHECK(t.lsn() == 0);
+        }
+
+        // unchanged
+        {
+            auto t = state.transaction();
+            t.journal("200");
+            t.commit();
+            CHECK(t.lsn() == 0);
+        }
+
+        // implicit commit
+        {
+            auto t = state.transaction();
+            t.journal("6");
+            t->values.push_back(6);
+        }
+        CHECK(j.lastLsn() == 6);
+
+        state.checkpoint([&](Detached<Log> s, uint64_t lsn) {
+            saved = s;
+            savedLsn = lsn;
+        });
+        CHECK(savedLsn == 6);
+        CHECK(saved->values.size() == 7);
+        CHECK(readAll(tmp.path).empty());
+
+        for (int i = 7; i <= 9; ++i) {
+            auto t = state.transaction();
+            t.journal(std::to_string(i));
+            t->values.push_back(i);
+        }
+        j.waitDurable(j.lastLsn());
+        final = state.detach();
+    }
+
+    // restart: replay on top of the saved snapshot
+    SharedState<Log> state(Node<Log>{Log(*saved)});
+    auto lsn = Journal::replay(tmp.path, [&](std::string_view rec) {
+        auto t = state.transaction();
+        t->values.push_back(parse(rec));
+    }, savedLsn);
+    CHECK(lsn == 9);
+    CHECK(state.detach()->values == final->values);
+    CHECK(final->values == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+}
@@ -0,0 +1,78 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/MpscQueue.hpp>
+
+#include <doctest/doctest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace kuzco;
+
+struct Item : public MpscQueueHook {
+    int producer = 0;
+    int value = 0;
+};
+
+TEST_CASE("basic") {
+    MpscQueue<Item> q;
+    CHECK_FALSE(q.pop());
+
+    Item items[3];
+    for (int i = 0; i < 3; ++i) {
+        items[i].value = i;
+        q.push(items + i);
+    }
+
+    CHECK(q.pop() == items);
+    q.push(items);
+    CHECK(q.pop() == items + 1);
+    CHECK(q.pop() == items + 2);
+    CHECK(q.pop() == items);
+    CHECK_FALSE(q.pop());
+    CHECK_FALSE(q.pop());
+
+    q.push(items + 1);
+    CHECK(q.pop() == items + 1);
+    CHECK_FALSE(q.pop());
+}
+
+TEST_CASE("MT") {
+    constexpr int numProducers = 4;
+    constexpr int numItems = 10000;
+
+    std::vector<Item> items(numProducers * numItems);
+    MpscQueue<Item> q;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < numProducers; ++p) {
+        producers.emplace_back([&, p]() {
+            for (int i = 0; i < numItems; ++i) {
+                auto& item = items[p * numItems + i];
+                item.producer = p;
+                item.value = i;
+                q.push(&item);
+            }
+        });
+    }
+
+    // items from each producer must arrive in order
+    int next[numProducers] = {};
+    int total = 0;
+    while (total < numProducers * numItems) {
+        auto item = q.pop();
+        if (!item) {
+            std::this_thread::yield();
+            continue;
+        }
+        CHECK(item->value == next[item->producer]);
+        ++next[item->producer];
+        ++total;
+    }
+
+    for (auto& t : producers) {
+        t.join();
+    }
+    CHECK_FALSE(q.pop());
+}
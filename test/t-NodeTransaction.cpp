@@ -9,6 +9,12 @@
 
 using namespace kuzco;
 
+template <>
+inline constexpr auto kuzco::fields<PersonData> = makeFields(
+    field("name", &PersonData::name),
+    field("age", &PersonData::age)
+);
+
 TEST_CASE("basic") {
     PersonData::lifetime_stats stats;
     doctest::util::lifetime_counter_sentry sentry(stats);
@@ -143,3 +149,27 @@ TEST_CASE("basic") {
     CHECK(r->name == "alice");
     CHECK(r->age == 55);
 }
+
+TEST_CASE("commitIfChanged") {
+    Node<PersonData> state("alice", 30);
+    auto r = state.detach();
+
+    {
+        NodeTransaction t(state);
+        t->age = 30;
+        CHECK(t.detach() != r); // copied
+        CHECK(t.revertIfEqual());
+        CHECK(t.detach() == r);
+        CHECK_FALSE(t.revertIfEqual());
+        CHECK_FALSE(t.commitIfChanged());
+    }
+    CHECK(state.detach() == r);
+
+    {
+        NodeTransaction t(state);
+        t->age = 31;
+        CHECK(t.commitIfChanged());
+    }
+    CHECK(state.detach() != r);
+    CHECK(state.r().age == 31);
+}
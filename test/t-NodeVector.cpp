@@ -135,4 +135,89 @@ TEST_CASE("resize")
         CHECK(stats.c_ctr == 6);
         CHECK(stats.living == 5);
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("bulk")
+{
+    X::lifetime_stats stats;
+    doctest::util::lifetime_counter_sentry sentry(stats);
+
+    kuzco::NodeStdVector<X> src;
+    for (int i = 0; i < 10; ++i)
+    {
+        src.emplace_back(i);
+    }
+    CHECK(stats.living == 10);
+
+    {
+        auto v = src;
+        CHECK(v.erase_if([](const X& x) { return x.val >= 5; }) == 5);
+        CHECK(v.size() == 5);
+        CHECK(v.back().r().val == 4);
+        CHECK(src.size() == 10);
+
+        // no item copies, only nodes
+        CHECK(stats.c_ctr == 0);
+        CHECK(stats.living == 10);
+
+        CHECK(v.retain([](const X& x) { return x.val % 2 == 0; }) == 2);
+        CHECK(v.size() == 3);
+        CHECK(v[1].r().val == 2);
+        CHECK(stats.c_ctr == 0);
+    }
+
+    {
+        auto v = src;
+        auto i = v.emplace(v.cbegin() + 3, 42);
+        CHECK(i->r().val == 42);
+        CHECK(v.size() == 11);
+        CHECK(v[4].r().val == 3);
+        CHECK(stats.living == 11);
+
+        X xs[] = {X{100}, X{101}};
+        v.append_range(xs);
+        CHECK(v.size() == 13);
+        CHECK(v.back().r().val == 101);
+
+        i = v.insert(v.cbegin(), src.begin() + 8, src.end());
+        CHECK(i->r().val == 8);
+        CHECK(v.size() == 15);
+        CHECK(v[1].r().val == 9);
+        CHECK(v[1] == src[9].detach());
+    }
+
+    CHECK(stats.living == 10);
+}
+
+TEST_CASE("transient")
+{
+    X::lifetime_stats stats;
+    doctest::util::lifetime_counter_sentry sentry(stats);
+
+    kuzco::NodeStdVector<X> vec;
+    {
+        auto t = vec.transient();
+        for (int i = 0; i < 10; ++i) {
+            t->emplace_back(i);
+        }
+        t.persistent();
+    }
+    CHECK(vec.size() == 10);
+    CHECK(vec[9].r().val == 9);
+    CHECK(stats.living == 10);
+
+    auto snapshot = vec;
+    {
+        auto t = vec.transient();
+        // the nodes are shared with the snapshot, the items are not copied
+        CHECK(stats.c_ctr == 0);
+        t->erase(t->begin(), t->begin() + 5);
+        (*t)[0]->val = 50; // node CoW still applies
+        CHECK(stats.c_ctr == 1);
+    }
+    CHECK(vec.size() == 5);
+    CHECK(vec[0].r().val == 50);
+    CHECK(vec[1] == snapshot[6].detach());
+    CHECK(snapshot[5].r().val == 5);
+    CHECK(stats.living == 11);
+}
@@ -0,0 +1,157 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TestTypes.hpp"
+#include <kuzco/ParallelAlgorithms.hpp>
+#include <kuzco/NodeStdVector.hpp>
+#include <kuzco/StdVector.hpp>
+#include <kuzco/NodeTransaction.hpp>
+#include <kuzco/SharedState.hpp>
+
+#include <doctest/doctest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace kuzco;
+
+namespace {
+struct Staff {
+    NodeStdVector<Employee> staff;
+};
+
+Node<Staff> makeStaff(int count) {
+    Node<Staff> ret;
+    for (int i = 0; i < count; ++i) {
+        ret->staff.emplace_back(Employee{{"E" + std::to_string(i), 20 + i % 40}, i % 3 ? "dev" : "acc", double(i)});
+    }
+    return ret;
+}
+}
+
+TEST_CASE("parallel algorithms") {
+    ThreadPool pool(3);
+    auto state = makeStaff(10000);
+    Detached<Staff> snapshot = state.detach();
+    auto& staff = snapshot->staff;
+
+    auto first = staff[0].detach();
+    auto refs = first._as_shared_ptr_unsafe().use_count();
+
+    std::atomic<int> count = 0;
+    parallel_for_each(pool, staff, [&](const Employee& e) {
+        if (e.department.r() == "dev") ++count;
+    });
+    CHECK(count == 6666);
+
+    CHECK(parallel_count_if(pool, staff, [](const Employee& e) {
+        return e.department.r() == "acc";
+    }) == 3334);
+
+    auto total = parallel_reduce(pool, staff, 0.0, std::plus<double>{}, [](const Employee& e) {
+        return e.salary;
+    });
+    CHECK(total == 10000.0 * 9999 / 2);
+
+    // non commutative reduce
+    auto names = parallel_reduce(pool, staff, std::string(), [](std::string a, const std::string& b) {
+        return a.empty() ? b : a + "," + b;
+    }, [](const Employee& e) { return e.data.r().name; });
+    CHECK(names.substr(0, 12) == "E0,E1,E2,E3,");
+    CHECK(names.substr(names.size() - 11) == "E9998,E9999");
+
+    CHECK(parallel_find_if(pool, staff, [](const Employee& e) { return e.salary >= 7777; }) == 7777);
+    CHECK(parallel_find_if(pool, staff, [](const Employee& e) { return e.data.r().age == 59; }) == 39);
+    CHECK(parallel_find_if(pool, staff, [](const Employee& e) { return e.salary < 0; }) == staff.size());
+
+    std::vector<int> ages(staff.size());
+    parallel_transform_to(pool, staff, ages.begin(), [](const Employee& e) { return e.data.r().age; });
+    for (size_t i = 0; i < ages.size(); ++i) {
+        CHECK(ages[i] == 20 + int(i) % 40);
+    }
+
+    // no refcounts were touched
+    CHECK(first._as_shared_ptr_unsafe().use_count() == refs);
+}
+
+TEST_CASE("parallel algorithms detached") {
+    ThreadPool pool(2);
+
+    StdVector<int> vec;
+    for (int i = 0; i < 5000; ++i) {
+        vec.push_back(i);
+    }
+    auto d = vec.detach();
+
+    CHECK(parallel_reduce(pool, d, 0, std::plus<int>{}) == 5000 * 4999 / 2);
+    CHECK(parallel_count_if(pool, d, [](int i) { return i % 2 == 0; }) == 2500);
+    CHECK(parallel_find_if(pool, d, [](int i) { return i > 4000; }) == 4001);
+
+    std::atomic<int> sum = 0;
+    parallel_for_each(pool, d, [&](int i) { sum += i; });
+    CHECK(sum == 5000 * 4999 / 2);
+
+    std::vector<int> doubled(d->size());
+    parallel_transform_to(pool, d, doubled.begin(), [](int i) { return i * 2; });
+    CHECK(doubled[4999] == 9998);
+
+    Detached<std::vector<int>> empty = StdVector<int>().detach();
+    CHECK(parallel_reduce(pool, empty, 42, std::plus<int>{}) == 42);
+    CHECK(parallel_find_if(pool, empty, [](int) { return true; }) == 0);
+}
+
+TEST_CASE("parallel modify") {
+    ThreadPool pool(3);
+    auto state = makeStaff(5000);
+
+    Employee::lifetime_stats stats;
+    doctest::util::lifetime_counter_sentry sentry(stats);
+
+    {
+        NodeTransaction t(state);
+        parallel_modify_if(pool, t->staff, [](const Employee& e) {
+            return e.department.r() == "dev";
+        }, [](Employee& e) {
+            e.salary += 10;
+        });
+        CHECK(t.commit());
+    }
+
+    // only devs were copied
+    CHECK(stats.copies == 3333);
+
+    auto& staff = state.r().staff;
+    for (size_t i = 0; i < staff.size(); ++i) {
+        CHECK(staff[i].r().salary == double(i) + (i % 3 ? 10 : 0));
+    }
+
+    auto before = state.detach();
+    {
+        NodeTransaction t(state);
+        parallel_modify(pool, t->staff, [](Employee& e) {
+            e.data->age += 1;
+        });
+    }
+    CHECK(stats.copies == 3333 + 5000);
+    CHECK(state.r().staff[41].r().data->age == 22);
+    CHECK(before->staff[41].r().data->age == 21);
+}
+
+TEST_CASE("parallel modify abort") {
+    ThreadPool pool(3);
+    SharedState<Staff> shared(makeStaff(5000));
+    auto before = shared.detach();
+
+    CHECK_THROWS_AS([&]() {
+        auto t = shared.transaction();
+        parallel_modify(pool, t.cow().staff, [](Employee& e) {
+            if (e.salary == 4000) throw std::runtime_error("bad employee");
+            e.salary = -1;
+        });
+    }(), std::runtime_error);
+
+    // the transaction was aborted
+    CHECK(shared.detach() == before);
+    CHECK(shared.transaction().r().staff[0].r().salary == 0);
+}
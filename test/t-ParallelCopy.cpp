@@ -0,0 +1,111 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/ParallelCopy.hpp>
+#include <kuzco/StdVector.hpp>
+#include <kuzco/NodeStdVector.hpp>
+
+#include <doctest/doctest.h>
+
+#include <vector>
+
+using namespace kuzco;
+
+TEST_CASE("parallel copy") {
+    ThreadPool pool(3);
+
+    std::vector<CopyMetrics> metrics;
+    ParallelCopyConfig config;
+    config.pool = &pool;
+    config.threshold = 30000; // bytes
+    config.grain = 1000;
+    config.onCopy = [&](const CopyMetrics& m) { metrics.push_back(m); };
+
+    StdVector<int> src;
+    src.resize(10000);
+    for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = int(i);
+    }
+
+    {
+        // no scope - nothing reported
+        auto v = src;
+        v.push_back(5);
+        CHECK(metrics.empty());
+    }
+
+    ParallelCopyScope scope(config);
+
+    {
+        auto v = src;
+        v.push_back(10000);
+        REQUIRE(metrics.size() == 1);
+        CHECK(metrics[0].elements == 10000);
+        CHECK(metrics[0].bytes == 10000 * sizeof(int));
+        CHECK(metrics[0].chunks == 4);
+        CHECK(v.size() == 10001);
+        for (size_t i = 0; i < v.size(); ++i) {
+            CHECK(v[i] == int(i));
+        }
+        CHECK(src.size() == 10000);
+    }
+
+    metrics.clear();
+
+    {
+        // non-const access
+        auto v = src;
+        v[7] = 0;
+        REQUIRE(metrics.size() == 1);
+        CHECK(metrics[0].chunks == 4);
+        CHECK(v[6] == 6);
+        CHECK(src[7] == 7);
+
+        // erase in the middle copies two halves
+        // each of them is under the threshold
+        auto v2 = src;
+        v2.erase(v2.cbegin() + 5000);
+        REQUIRE(metrics.size() == 2);
+        CHECK(metrics[1].elements == 9999);
+        CHECK(metrics[1].chunks == 0);
+        CHECK(v2[5000] == 5001);
+    }
+
+    metrics.clear();
+
+    {
+        NodeStdVector<int> nodes;
+        nodes.resize(5000);
+        metrics.clear();
+
+        // nodes are copied serially, but measured
+        auto v = nodes;
+        v.modify(3) = 5;
+        REQUIRE(metrics.size() == 1);
+        CHECK(metrics[0].elements == 5000);
+        CHECK(metrics[0].chunks == 0);
+    }
+
+    metrics.clear();
+
+    {
+        // trivially copyable but not default constructible: copied serially
+        struct Point {
+            Point(int x, int y) : x(x), y(y) {}
+            int x, y;
+        };
+        StdVector<Point> points;
+        for (int i = 0; i < 5000; ++i) {
+            points.emplace_back(i, -i);
+        }
+        metrics.clear();
+
+        auto v = points;
+        v.emplace_back(5000, -5000);
+        REQUIRE(metrics.size() == 1);
+        CHECK(metrics[0].elements == 5000);
+        CHECK(metrics[0].chunks == 0);
+        CHECK(v.size() == 5001);
+        CHECK(v[4999].y == -4999);
+    }
+}
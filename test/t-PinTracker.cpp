@@ -0,0 +1,209 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/PinTracker.hpp>
+#include <kuzco/SharedState.hpp>
+
+#include <doctest/doctest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace kuzco;
+
+TEST_CASE("storage") {
+    PinTracker tracker;
+    AtomicDetachedStorage<int> storage(Node<int>(0));
+    storage.setPinTracker(&tracker);
+    CHECK(storage.pinTracker() == &tracker);
+
+    // the initial value is not tracked
+    CHECK(tracker.pinned().empty());
+
+    Node<int> n(1);
+    storage.store(n);
+    CHECK(storage.version() == 2);
+    auto p = tracker.pinned();
+    REQUIRE(p.size() == 1);
+    CHECK(p[0].version == 2);
+    CHECK(p[0].current);
+    CHECK(p[0].snapshots == 0);
+    CHECK(p[0].age.count() == 0);
+
+    auto d2 = storage.detach();
+    CHECK(n.sameAs(d2));
+    auto d2b = d2;
+    CHECK(tracker.pinned()[0].snapshots == 2);
+
+    storage.store(Node<int>(3));
+    storage.store(Node<int>(4));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+    // version 3 has no snapshots
+    p = tracker.pinned();
+    REQUIRE(p.size() == 2);
+    CHECK(p[0].version == 2);
+    CHECK_FALSE(p[0].current);
+    CHECK(p[0].snapshots == 2);
+    CHECK(p[0].age >= std::chrono::milliseconds(2));
+    CHECK(p[1].version == 4);
+    CHECK(p[1].current);
+
+    // the oldest
+    p = tracker.pinned(1);
+    REQUIRE(p.size() == 1);
+    CHECK(p[0].version == 2);
+
+    d2.reset();
+    CHECK(tracker.pinned()[0].snapshots == 1);
+    d2b.reset();
+    p = tracker.pinned();
+    REQUIRE(p.size() == 1);
+    CHECK(p[0].version == 4);
+
+    storage.setPinTracker(nullptr);
+    storage.store(Node<int>(5));
+    CHECK(tracker.pinned().empty());
+}
+
+TEST_CASE("sites") {
+    Detached<int> c; // outlives the tracker
+    PinTracker tracker;
+    SharedState<int> state(5);
+
+    // not tracked
+    auto d = state.detach("a");
+    CHECK(*d == 5);
+
+    state.setPinTracker(&tracker);
+    CHECK(state.version() == 2);
+
+    auto a1 = state.detach("a");
+    auto a2 = state.detach("a");
+    auto a3 = a2; // copies count as one
+    auto b = state.detach("b");
+    CHECK(a1.get() == d.get());
+
+    auto p = tracker.pinned();
+    REQUIRE(p.size() == 1);
+    CHECK(p[0].snapshots == 3);
+    REQUIRE(p[0].sites.size() == 2);
+    CHECK(p[0].sites[0].site == "a");
+    CHECK(p[0].sites[0].count == 2);
+    CHECK(p[0].sites[1].site == "b");
+    CHECK(p[0].sites[1].count == 1);
+
+    {
+        auto t = state.transaction();
+        t.cow() = 6;
+    }
+    c = state.detach("c");
+
+    p = tracker.pinned();
+    REQUIRE(p.size() == 2);
+    CHECK(p[0].version == 2);
+    CHECK(p[0].sites.size() == 2);
+    CHECK(p[1].version == 3);
+    REQUIRE(p[1].sites.size() == 1);
+    CHECK(p[1].sites[0].site == "c");
+
+    a1.reset();
+    a2.reset();
+    p = tracker.pinned();
+    REQUIRE(p[0].sites.size() == 2); // a3 is still alive
+    CHECK(p[0].sites[0].count == 1);
+    a3.reset();
+    p = tracker.pinned();
+    REQUIRE(p[0].sites.size() == 1);
+    CHECK(p[0].sites[0].site == "b");
+
+    b.reset();
+    p = tracker.pinned();
+    REQUIRE(p.size() == 1);
+    CHECK(p[0].version == 3);
+
+    state.setPinTracker(nullptr);
+}
+
+TEST_CASE("retained bytes") {
+    using Vec = std::vector<Node<int>>;
+    PinTracker tracker;
+    SharedState<Vec> state(Vec(10, Node<int>(1)));
+    state.setPinTracker(&tracker);
+
+    {
+        auto t = state.transaction();
+        auto& vec = t.cow();
+        vec.clear();
+        for (int i = 0; i < 10; ++i) {
+            vec.emplace_back(i);
+        }
+    }
+    auto old = state.detach("old");
+
+    {
+        auto t = state.transaction();
+        t->front() = Node<int>(-1);
+    }
+
+    auto p = tracker.pinned(size_t(-1), true);
+    REQUIRE(p.size() == 2);
+    CHECK(p[1].current);
+
+    // the entire current state
+    auto cur = state.detach();
+    CHECK(p[1].retainedBytes == sizeof(Vec) + cur->capacity() * sizeof(Node<int>) + 10 * sizeof(int));
+
+    // only the vector and the replaced element
+    CHECK(p[0].retainedBytes == sizeof(Vec) + old->capacity() * sizeof(Node<int>) + sizeof(int));
+
+    // the oldest with measuring
+    p = tracker.pinned(1, true);
+    REQUIRE(p.size() == 1);
+    CHECK(p[0].retainedBytes == sizeof(Vec) + old->capacity() * sizeof(Node<int>) + sizeof(int));
+
+    old.reset();
+    p = tracker.pinned(size_t(-1), true);
+    REQUIRE(p.size() == 1);
+}
+
+TEST_CASE("MT") {
+    PinTracker tracker;
+    SharedState<int> state(0);
+    state.setPinTracker(&tracker);
+
+    std::atomic_bool done = false;
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&, i]() {
+            std::vector<Detached<int>> held;
+            int prev = -1;
+            while (!done) {
+                auto d = i % 2 ? state.detach() : state.detach("reader");
+                CHECK(*d >= prev);
+                prev = *d;
+                held.push_back(std::move(d));
+                if (held.size() > 10) held.erase(held.begin());
+            }
+        });
+    }
+
+    for (int i = 1; i <= 1000; ++i) {
+        auto t = state.transaction();
+        t.cow() = i;
+        if (i % 100 == 0) {
+            auto p = tracker.pinned(size_t(-1), true);
+            CHECK_FALSE(p.empty());
+        }
+    }
+
+    done = true;
+    for (auto& r : readers) {
+        r.join();
+    }
+
+    auto p = tracker.pinned();
+    REQUIRE(p.size() == 1);
+    CHECK(p[0].current);
+    CHECK(p[0].sites.empty());
+}
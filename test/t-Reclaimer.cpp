@@ -0,0 +1,120 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/Reclaimer.hpp>
+#include <kuzco/SharedState.hpp>
+
+#include <doctest/doctest.h>
+
+#include <thread>
+#include <atomic>
+#include <vector>
+
+using namespace kuzco;
+
+std::thread::id mainThread = std::this_thread::get_id();
+std::atomic<int> destroyedOnMain = 0;
+
+struct List {
+    List() = default;
+    List(int v, OptNode<List> n) : value(v), next(std::move(n)) {}
+    ~List() {
+        if (std::this_thread::get_id() == mainThread) ++destroyedOnMain;
+    }
+    int value = 0;
+    OptNode<List> next;
+};
+
+template <>
+struct kuzco::ReclaimTraits<List> {
+    static void children(const List& l, ReclaimSink& sink) {
+        sink.add(l.next);
+    }
+};
+
+OptNode<List> makeList(int size) {
+    OptNode<List> ret;
+    for (int i = 0; i < size; ++i) {
+        ret = Node<List>(i, std::move(ret));
+    }
+    return ret;
+}
+
+TEST_CASE("wrap") {
+    Reclaimer reclaimer;
+    Node<int> n(5);
+    auto d = reclaimer.wrap(n.detach());
+    CHECK(d.get() == &n.r());
+    CHECK(n.sameAs(d));
+    CHECK(*d == 5);
+    d.reset();
+    reclaimer.waitIdle();
+
+    // the node still holds the object
+    auto m = reclaimer.metrics();
+    CHECK(m.queueDepth == 0);
+    CHECK(m.reclaimedObjects == 0);
+    CHECK(n.r() == 5);
+
+    reclaimer.retire(n.detach());
+    reclaimer.waitIdle();
+    CHECK(reclaimer.metrics().reclaimedObjects == 0);
+
+    Detached<std::vector<Node<int>>> vec = itlib::make_ref_ptr<std::vector<Node<int>>>(10, Node<int>(1));
+    reclaimer.retire(std::move(vec));
+    reclaimer.waitIdle();
+    m = reclaimer.metrics();
+    // the vector and the single shared int
+    CHECK(m.reclaimedObjects == 2);
+    CHECK(m.reclaimedBytes >= sizeof(std::vector<Node<int>>) + 10 * sizeof(Node<int>) + sizeof(int));
+}
+
+TEST_CASE("shared state") {
+    constexpr int size = 100000;
+
+    ReclaimerConfig config;
+    config.sliceSize = 1000;
+    config.slicePause = std::chrono::microseconds(1);
+    Reclaimer reclaimer(config);
+
+    SharedState<List> state(Node<List>(-1, makeList(size)));
+    state.setReclaimer(&reclaimer);
+
+    auto snapshot = state.detach();
+    CHECK(snapshot->value == -1);
+
+    {
+        auto t = state.transaction();
+        t.cow().next.reset();
+        t->value = -2;
+    }
+
+    CHECK(state.detach()->value == -2);
+    CHECK(snapshot->value == -1);
+
+    destroyedOnMain = 0;
+    snapshot.reset();
+    reclaimer.waitIdle();
+
+    // a recursive destruction of this would also likely overflow the stack
+    CHECK(destroyedOnMain == 0);
+
+    auto m = reclaimer.metrics();
+    CHECK(m.queueDepth == 0);
+    CHECK(m.peakQueueDepth >= 1);
+    CHECK(m.reclaimedObjects == size + 1);
+    CHECK(m.reclaimedBytes == (size + 1) * sizeof(List));
+    CHECK(m.slices >= (size + 1) / 1000);
+
+    // the current root is still held by the state, so the reclaimer only drops its ref
+    state.setReclaimer(nullptr);
+    reclaimer.waitIdle();
+    CHECK(reclaimer.metrics().reclaimedObjects == size + 1);
+
+    {
+        auto t = state.transaction();
+        t->value = -3;
+    }
+    CHECK(destroyedOnMain == 1);
+    CHECK(reclaimer.metrics().reclaimedObjects == size + 1);
+}
@@ -0,0 +1,164 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/Rope.hpp>
+
+#include <doctest/doctest.h>
+
+#include <random>
+#include <string>
+#include <cmath>
+
+using namespace kuzco;
+
+TEST_CASE("basic") {
+    Rope e;
+    CHECK(e.empty());
+    CHECK(e.size() == 0);
+    CHECK(e.height() == 0);
+    CHECK(e == "");
+    CHECK(e.str().empty());
+    CHECK(e.chunks().begin() == e.chunks().end());
+
+    Rope r("hello world");
+    CHECK(r.size() == 11);
+    CHECK(r.numChunks() == 1);
+    CHECK(r == "hello world");
+    CHECK(r[4] == 'o');
+    CHECK(r.front() == 'h');
+    CHECK(r.back() == 'd');
+    CHECK_THROWS_AS(r.at(11), std::out_of_range);
+
+    auto copy = r;
+    CHECK(copy.sameAs(r));
+
+    r.insert(5, ",");
+    CHECK(r == "hello, world");
+    CHECK(copy == "hello world");
+    CHECK_FALSE(copy.sameAs(r));
+
+    r.erase(0, 7);
+    CHECK(r == "world");
+    r += "!";
+    r.push_back('?');
+    CHECK(r == "world!?");
+
+    auto hw = copy.substr(0, 6) + r;
+    CHECK(hw == "hello world!?");
+    CHECK(hw == Rope("hello world!?"));
+    CHECK_FALSE(hw == "hello world!!");
+
+    CHECK_THROWS_AS(r.insert(100, "x"), std::out_of_range);
+    CHECK_THROWS_AS(r.substr(100), std::out_of_range);
+}
+
+using SmallRope = BasicRope<4>;
+
+void checkBalanced(const SmallRope& r) {
+    // AVL height bound
+    auto bound = 1.45 * std::log2(double(r.numChunks()) + 2) + 1;
+    CHECK(r.height() <= bound);
+}
+
+TEST_CASE("chunks") {
+    SmallRope r("0123456789");
+    CHECK(r.numChunks() == 3);
+    CHECK(r.height() == 3);
+    auto spans = r.spans();
+    REQUIRE(spans.size() == 3);
+    CHECK(spans[0] == "0123");
+    CHECK(spans[1] == "4567");
+    CHECK(spans[2] == "89");
+
+    // structural sharing: chunks which are not edited are not copied
+    auto copy = r;
+    r.insert(9, "x");
+    auto nspans = r.spans();
+    CHECK(nspans[0].data() == spans[0].data());
+    CHECK(copy.spans()[2] == "89");
+
+    // small leaves are merged
+    SmallRope s;
+    for (char c : std::string("abcdefgh")) {
+        s.push_back(c);
+    }
+    CHECK(s == "abcdefgh");
+    CHECK(s.numChunks() == 2);
+}
+
+TEST_CASE("self concat") {
+    // the same subtree is both the left and the right child
+    SmallRope r("0123456789");
+    auto rr = r + r;
+    CHECK(rr.size() == 20);
+    CHECK(rr.numChunks() == 6);
+    CHECK(rr.str() == "01234567890123456789");
+    CHECK(rr.spans().size() == 6);
+    CHECK(rr == "01234567890123456789");
+    CHECK(rr == SmallRope("01234567890123456789"));
+
+    rr += rr;
+    CHECK(rr.str() == "0123456789012345678901234567890123456789");
+
+    // iterators at different positions of the same chunk are not equal
+    auto i = rr.chunks().begin();
+    auto j = i;
+    for (int n = 0; n < 3; ++n) ++j;
+    CHECK(*i == *j);
+    CHECK_FALSE(i == j);
+}
+
+TEST_CASE("random") {
+    std::minstd_rand rnd(42);
+    std::string ref;
+    SmallRope r;
+    std::vector<std::pair<std::string, SmallRope>> history;
+
+    auto randomString = [&]() {
+        std::string ret(rnd() % 20, 'a');
+        for (auto& c : ret) c = char('a' + rnd() % 26);
+        return ret;
+    };
+
+    for (int i = 0; i < 2000; ++i) {
+        auto op = rnd() % 4;
+        auto pos = ref.empty() ? 0 : rnd() % (ref.size() + 1);
+        if (op == 0 || ref.size() < 50) {
+            auto s = randomString();
+            ref.insert(pos, s);
+            r.insert(pos, s);
+        }
+        else if (op == 1) {
+            auto n = rnd() % 30;
+            ref.erase(pos, n);
+            r.erase(pos, n);
+        }
+        else if (op == 2) {
+            auto n = rnd() % 50;
+            auto sub = r.substr(pos, n);
+            CHECK(sub == ref.substr(pos, n));
+            ref += ref.substr(pos, n);
+            r += sub;
+        }
+        else {
+            if (!ref.empty()) {
+                auto i = rnd() % ref.size();
+                CHECK(r[i] == ref[i]);
+            }
+        }
+
+        if (i % 100 == 0) {
+            history.emplace_back(ref, r);
+            CHECK(r.str() == ref);
+            checkBalanced(r);
+        }
+    }
+
+    CHECK(r.str() == ref);
+    CHECK(r.size() == ref.size());
+
+    // old versions are unchanged
+    for (auto& [s, h] : history) {
+        CHECK(h == s);
+    }
+}
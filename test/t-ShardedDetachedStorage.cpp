@@ -0,0 +1,121 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TestTypes.hpp"
+#include <kuzco/ShardedDetachedStorage.hpp>
+#include <kuzco/SharedState.hpp>
+#include <kuzco/CachedReader.hpp>
+
+#include <doctest/doctest.h>
+
+#include <thread>
+#include <vector>
+#include <set>
+#include <mutex>
+
+using namespace kuzco;
+
+namespace {
+template <typename State>
+concept SetsPinTracker = requires(State& s) { s.setPinTracker(nullptr); };
+template <typename State>
+concept DetachesWithSite = requires(State& s) { s.detach("site"); };
+using ShardedState = SharedState<PersonData, ShardedDetachedStorage<PersonData>>;
+}
+
+// pin tracking is not supported
+static_assert(SetsPinTracker<SharedState<PersonData>>);
+static_assert(!SetsPinTracker<ShardedState>);
+static_assert(DetachesWithSite<SharedState<PersonData>>);
+static_assert(!DetachesWithSite<ShardedState>);
+
+TEST_CASE("shards") {
+    PersonData::lifetime_stats stats;
+    doctest::util::lifetime_counter_sentry sentry(stats);
+
+    using Storage = ShardedDetachedStorage<PersonData, 4>;
+    static_assert(Storage::numShards() == 4);
+
+    Node<PersonData> alice("Alice", 30);
+    Storage storage(alice);
+    CHECK(storage.version() == 1);
+
+    auto d = storage.load();
+    CHECK(alice.sameAs(d));
+    CHECK(d.use_count() == 2); // shard + d
+
+    // each thread gets a snapshot from its shard
+    struct Snapshot {
+        Detached<PersonData> d;
+        size_t shard;
+    };
+    std::vector<Snapshot> snapshots;
+    std::set<size_t> shards;
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&]() {
+            auto s = storage.load();
+            std::lock_guard<std::mutex> lock(mutex);
+            shards.insert(Storage::currentShard());
+            snapshots.push_back({std::move(s), Storage::currentShard()});
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    CHECK(shards.size() == 4);
+
+    // copies on other shards don't touch our refcount
+    for (auto& s : snapshots) {
+        CHECK(s.d.get() == d.get());
+        if (s.shard == Storage::currentShard()) continue;
+        auto rc = s.d.use_count();
+        auto copy = d;
+        CHECK(s.d.use_count() == rc);
+    }
+
+    // reconciliation
+    storage.store(Node<PersonData>("Bob", 40));
+    CHECK(storage.version() == 2);
+    CHECK(storage.load()->name == "Bob");
+    CHECK(d->name == "Alice");
+
+    // the old value is only held by the shards with living snapshots
+    CHECK(alice.detach().use_count() == 1 + 4 + 1);
+    snapshots.clear();
+    CHECK(alice.detach().use_count() == 1 + 1 + 1);
+    d.reset();
+    CHECK(alice.unique());
+    CHECK(stats.living == 2);
+}
+
+TEST_CASE("shared state") {
+    SharedState<PersonData, ShardedDetachedStorage<PersonData>> state({"Alice", 0});
+    {
+        auto t = state.transaction();
+        t->age = 1;
+    }
+    CHECK(state.version() == 2);
+    CHECK(state.detach()->age == 1);
+
+    CachedReader reader(state);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&]() {
+            CachedReader r(state);
+            while (r->age < 100);
+            CHECK(r->age == 100);
+        });
+    }
+
+    for (int i = 2; i <= 100; ++i) {
+        auto t = state.transaction();
+        t->age = i;
+    }
+
+    for (auto& t : readers) {
+        t.join();
+    }
+    CHECK(reader->age == 100);
+}
@@ -2,122 +2,49 @@
 // SPDX-License-Identifier: MIT
 //
 #include "TestTypes.hpp"
-#include <kuzco/NodeTransaction.hpp>
-#include <kuzco/AtomicDetachedStorage.hpp>
+#include "TestCoro.hpp"
+#include <kuzco/SharedState.hpp>
+#include <kuzco/SimpleExecutor.hpp>
 
 #include <doctest/doctest.h>
 #include <doctest/util/lifetime_counter.hpp>
 
-#include <mutex>
 #include <random>
 #include <thread>
 #include <functional>
 
 using namespace kuzco;
 
-template <typename T>
-class SharedState {
-public:
-    SharedState(Node<T> obj)
-        : m_sharedNode(obj)
-        , m_root(std::move(obj))
-    {}
-
-    SharedState(const SharedState&) = delete;
-    SharedState& operator=(const SharedState&) = delete;
-    SharedState(SharedState&&) = delete;
-    SharedState& operator=(SharedState&&) = delete;
-
-    class Transaction : private std::unique_lock<std::mutex>, private NodeTransaction<T> {
-        // NOTE:
-        // since m_root is never unique at the beginning of a transaction (there is a strong ref in m_sharedNode).
-        // the restore state from NodeTransaction comes at practically no additional cost
-
-        AtomicDetachedStorage<T>& m_sharedNode;
-
-        using NT = NodeTransaction<T>;
-    public:
-        Transaction(SharedState& state)
-            : std::unique_lock<std::mutex>(state.m_transactionMutex)
-            , NT(state.m_root)
-            , m_sharedNode(state.m_sharedNode)
-        {}
-
-        Transaction(const Transaction&) = delete;
-        Transaction& operator=(const Transaction&) = delete;
-
-        using NT::done;
-        using NT::active;
-        using NT::revert;
-        using NT::restoreState;
-
-        // complete reverting changes
-        void abort() {
-            NT::abort();
-            this->unlock();
-        }
-
-        // complete committing changes
-        // return value: pair of (new detached state, whether state changed)
-        std::pair<Detached<T>, bool> commit() {
-            auto ret = std::make_pair(this->detach(), NT::commit());
-
-            if (ret.second) {
-                // store state
-                m_sharedNode.store(ret.first);
-            }
-
-            this->unlock();
-            return ret;
-        }
-
-        // complete, either committing or aborting based on commit flag
-        // return value: pair of (new detached state, whether state changed)
-        std::pair<Detached<T>, bool> complete(bool commit = true) {
-            if (!commit) {
-                auto ret = std::make_pair(restoreState(), false);
-                abort();
-                return ret;
-            }
-            return this->commit();
-        }
-
-        using NT::operator->;
-        using NT::r;
-        using NT::cow;
-
-        ~Transaction() {
-            if (!active()) {
-                // explicitly or implicitly completed
-                return;
-            }
-
-            if (std::uncaught_exceptions()) {
-                // something bad is happening, abort
-                abort();
-            }
-            else {
-                commit();
-            }
-        }
-    };
-
-    Transaction transaction() {
-        return Transaction(*this);
-    }
+template <>
+inline constexpr auto kuzco::fields<PersonData> = makeFields(
+    field("name", &PersonData::name),
+    field("age", &PersonData::age)
+);
+
+namespace {
+// lastSeen is not described
+struct Profile {
+    std::string name;
+    int lastSeen = 0;
+};
 
-    // atomic snapshot of the current state
-    Detached<T> detach() const {
-        return m_sharedNode.detach();
-    }
+// described, but with its own operator==
+struct Settings {
+    std::string name;
+    int level = 0;
+    bool operator==(const Settings&) const = default;
+};
+}
 
-protected:
-    AtomicDetachedStorage<T> m_sharedNode;
+template <>
+inline constexpr auto kuzco::fields<Profile> = makeFields(
+    field("name", &Profile::name)
+);
 
-    std::mutex m_transactionMutex;
-    // mutable root, modified during transaction, not thread safe
-    Node<T> m_root;
-};
+template <>
+inline constexpr auto kuzco::fields<Settings> = makeFields(
+    field("name", &Settings::name)
+);
 
 TEST_CASE("basic") {
     PersonData::lifetime_stats stats;
@@ -184,6 +111,195 @@ TEST_CASE("basic") {
     CHECK(r->age == 456);
 }
 
+TEST_CASE("version") {
+    SharedState<PersonData> state({"Alice", 0});
+    CHECK(state.version() == 1);
+
+    uint64_t v = 0;
+    auto d = state.detachIfNewer(v);
+    CHECK(v == 1);
+    CHECK(d->age == 0);
+    CHECK_FALSE(state.detachIfNewer(v));
+
+    // no change, no new version
+    {
+        auto t = state.transaction();
+        CHECK(t.r().age == 0);
+    }
+    CHECK(state.version() == 1);
+    CHECK_FALSE(state.detachIfNewer(v));
+
+    {
+        auto t = state.transaction();
+        t->age = 1;
+    }
+    CHECK(state.version() == 2);
+    d = state.detachIfNewer(v);
+    CHECK(v == 2);
+    CHECK(d->age == 1);
+
+    CHECK(state.waitForVersion(1) == 2);
+    CHECK(state.waitForVersion(2, std::chrono::milliseconds(10)) == 2);
+
+    std::thread waiter([&]() {
+        auto nv = state.waitForVersion(v);
+        CHECK(nv > 2);
+        uint64_t wv = 2;
+        auto wd = state.detachIfNewer(wv);
+        CHECK(wv == nv);
+        CHECK(wd->age == 2);
+    });
+    std::thread timedWaiter([&]() {
+        auto nv = state.waitForVersion(v, std::chrono::seconds(10));
+        CHECK(nv > 2);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    {
+        auto t = state.transaction();
+        t->age = 2;
+    }
+
+    waiter.join();
+    timedWaiter.join();
+    CHECK(state.version() == 3);
+}
+
+TEST_CASE("skip equal commits") {
+    SharedState<PersonData> state({"Alice", 0});
+    state.setSkipEqualCommits(true);
+    auto d = state.detach();
+
+    // idempotent write: no new version
+    {
+        auto t = state.transaction();
+        t->name = "Alice";
+        auto [cd, changed] = t.commit();
+        CHECK_FALSE(changed);
+        CHECK(cd == d);
+    }
+    CHECK(state.version() == 1);
+    CHECK(state.detach() == d);
+
+    {
+        auto t = state.transaction();
+        t->age = 1;
+        t->age = 0;
+    }
+    CHECK(state.version() == 1);
+    CHECK(state.detach() == d);
+
+    {
+        auto t = state.transaction();
+        t->age = 1;
+    }
+    CHECK(state.version() == 2);
+    CHECK(state.detach()->age == 1);
+
+    // disabled: copies are published
+    state.setSkipEqualCommits(false);
+    d = state.detach();
+    {
+        auto t = state.transaction();
+        t->age = 1;
+    }
+    CHECK(state.version() == 3);
+    CHECK(state.detach() != d);
+
+    // states of types which can't be compared don't need deepEqual
+    struct NoEq { int x = 0; };
+    static_assert(!DeepEqualityComparable<std::vector<Node<NoEq>>>);
+    SharedState<std::vector<Node<NoEq>>> ns({});
+    {
+        auto t = ns.transaction();
+        t->emplace_back();
+    }
+    CHECK(ns.detach()->size() == 1);
+}
+
+TEST_CASE("skip equal commits of partially described types") {
+    // members which are not described are not compared, so writes to them alone are lost
+    SharedState<Profile> profile(Profile{"Alice", 0});
+    profile.setSkipEqualCommits(true);
+    {
+        auto t = profile.transaction();
+        t->lastSeen = 1;
+    }
+    CHECK(profile.version() == 1);
+    CHECK(profile.detach()->lastSeen == 0);
+
+    // operator== takes priority over the fields
+    SharedState<Settings> settings(Settings{"default", 0});
+    settings.setSkipEqualCommits(true);
+    {
+        auto t = settings.transaction();
+        t->level = 1;
+    }
+    CHECK(settings.version() == 2);
+    CHECK(settings.detach()->level == 1);
+    {
+        auto t = settings.transaction();
+        t->level = 1;
+    }
+    CHECK(settings.version() == 2);
+}
+
+Spawn asyncWriter(SharedState<PersonData>& state, SimpleExecutor& ex, std::vector<int>& log, int age) {
+    auto t = co_await state.transactionAsync(ex);
+    log.push_back(age);
+    CHECK(t.r().age == age - 1);
+    t->age = age;
+    auto [d, changed] = co_await t.commitAsync();
+    CHECK(changed);
+    CHECK(d->age == age);
+    CHECK_FALSE(t.active());
+}
+
+TEST_CASE("async") {
+    SharedState<PersonData> state({"Alice", 0});
+    SimpleExecutor ex;
+    std::vector<int> log;
+
+    // not locked: no suspension
+    asyncWriter(state, ex, log, 1);
+    CHECK(state.detach()->age == 1);
+
+    {
+        auto t = state.transaction();
+        t->age = 2;
+
+        for (int i = 3; i <= 5; ++i) {
+            asyncWriter(state, ex, log, i);
+        }
+        CHECK(ex.poll() == 0);
+        CHECK(log == std::vector<int>{1});
+    }
+    CHECK(state.detach()->age == 2);
+
+    CHECK(ex.poll() == 3);
+    CHECK(log == std::vector<int>{1, 3, 4, 5});
+    CHECK(state.detach()->age == 5);
+
+    // sync writers wait for async ones
+    std::thread executor([&]() { ex.run(); });
+    {
+        auto t = state.transaction();
+        t->age = 5;
+        for (int i = 6; i <= 8; ++i) {
+            asyncWriter(state, ex, log, i);
+        }
+    }
+    {
+        auto t = state.transaction();
+        t->age += 1;
+    }
+    ex.post([&]() { ex.stop(); });
+    executor.join();
+
+    CHECK(log == std::vector<int>{1, 3, 4, 5, 6, 7, 8});
+    CHECK(state.detach()->age == 9);
+}
+
 struct MtTest {
     void shuffleAndWrite(std::minstd_rand& rnd) {
         auto localWrites = writes;
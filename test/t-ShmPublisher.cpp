@@ -0,0 +1,279 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+
+#if !defined(_WIN32)
+#include "PersistTestTypes.hpp"
+
+#include <kuzco/ShmPublisher.hpp>
+#include <kuzco/SharedState.hpp>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+using namespace kuzco;
+
+namespace {
+// a region name which is removed when done
+struct TempShm {
+    std::string name;
+    explicit TempShm(const char* n) : name(n) {
+        ShmRegion::unlink(name);
+    }
+    ~TempShm() {
+        ShmRegion::unlink(name);
+    }
+};
+
+int parseValue(std::string_view payload) {
+    // the value follows the size and the chars of the name
+    uint64_t size;
+    std::memcpy(&size, payload.data(), sizeof(size));
+    int value;
+    std::memcpy(&value, payload.data() + sizeof(size) + size, sizeof(value));
+    return value;
+}
+}
+
+TEST_CASE("publish and read") {
+    TempShm shm("/kuzco-t-shm-publisher-basic");
+
+    ShmPublisher pub(shm.name, 1024 * 1024);
+    ShmReader reader(shm.name);
+    CHECK(!reader.region().writable());
+
+    CHECK(reader.version() == 0);
+    CHECK(!reader.snapshot().root);
+    CHECK(!reader.load<Doc>());
+
+    SharedState<Doc> state(makeDoc(100));
+    auto s = pub.publish(state.detach());
+    CHECK(s.version == 1);
+    CHECK(s.nodesWritten == 101);
+    CHECK(s.nodesReused == 0);
+    CHECK(!s.switched);
+    CHECK(reader.version() == 1);
+
+    uint64_t version = 0;
+    auto d1 = reader.loadIfNewer<Doc>(version);
+    REQUIRE(d1);
+    CHECK(version == 1);
+    REQUIRE(d1.r().items.size() == 100);
+    CHECK(d1.r().items[42].r().name == "item42");
+    CHECK(!d1.r().extra);
+    CHECK(!reader.loadIfNewer<Doc>(version));
+
+    // zero-copy views
+    {
+        auto snap = reader.snapshot();
+        CHECK(snap.version == 1);
+        REQUIRE(snap.root);
+        CHECK(snap.root.numChildren() == 101); // the items and extra
+        CHECK(!snap.root.child(100));
+        auto item = snap.root.child(42);
+        CHECK(item.numChildren() == 0);
+        CHECK(parseValue(item.payload()) == 42);
+        CHECK(reader.valid(snap));
+        CHECK_THROWS_AS(snap.root.child(101), std::out_of_range);
+    }
+
+    // only the changed item and the root are written
+    state.transaction()->items[5]->value = 500;
+    s = pub.publish(state.detach());
+    CHECK(s.version == 2);
+    CHECK(s.nodesWritten == 2);
+    CHECK(s.nodesReused == 99);
+
+    auto d2 = reader.loadIfNewer<Doc>(version);
+    REQUIRE(d2);
+    CHECK(version == 2);
+    CHECK(d2.r().items[5].r().value == 500);
+    CHECK(d1.r().items[5].r().value == 5);
+
+    // unchanged nodes are shared with the previous version
+    CHECK(d2.r().items[4].detach() == d1.r().items[4].detach());
+    CHECK(d2.r().items[5].detach() != d1.r().items[5].detach());
+
+    // a reader which attaches later
+    ShmReader late(shm.name);
+    auto d = late.load<Doc>(&version);
+    CHECK(version == 2);
+    CHECK(d.r().items[5].r().value == 500);
+    CHECK(d.r().items[99].r().value == 99);
+}
+
+TEST_CASE("modified after publish") {
+    TempShm shm("/kuzco-t-shm-publisher-modified");
+
+    ShmPublisher pub(shm.name, 64 * 1024);
+    ShmReader reader(shm.name);
+
+    auto n = makeDoc(10);
+    pub.publish(n);
+
+    // the publisher references the written nodes, so they're copied on write
+    n->items[3]->value = -1;
+    auto s = pub.publish(n);
+    CHECK(s.nodesWritten == 2);
+    CHECK(s.nodesReused == 9);
+    CHECK(reader.load<Doc>().r().items[3].r().value == -1);
+}
+
+TEST_CASE("switch halves") {
+    TempShm shm("/kuzco-t-shm-publisher-switch");
+
+    ShmPublisher pub(shm.name, 16 * 1024);
+    ShmReader reader(shm.name);
+
+    SharedState<Doc> state(makeDoc(50));
+    auto s = pub.publish(state.detach());
+    CHECK(!s.switched);
+    auto first = reader.snapshot();
+
+    uint64_t version = 0;
+    auto prev = reader.loadIfNewer<Doc>(version);
+
+    int switches = 0;
+    for (int i = 0; i < 200; ++i) {
+        state.transaction()->items[size_t(i % 50)]->value = 1000 + i;
+        s = pub.publish(state.detach());
+        if (s.switched) {
+            ++switches;
+            CHECK(s.nodesWritten == 51);
+        }
+        else {
+            CHECK(s.nodesWritten == 2);
+        }
+
+        auto cur = reader.loadIfNewer<Doc>(version);
+        REQUIRE(cur);
+        CHECK(version == s.version);
+        auto& items = cur.r().items;
+        CHECK(items[size_t(i % 50)].r().value == 1000 + i);
+        if (!s.switched) {
+            CHECK(items[size_t((i + 1) % 50)].detach() == prev.r().items[size_t((i + 1) % 50)].detach());
+        }
+        prev = cur;
+    }
+    CHECK(switches >= 2);
+
+    // the first snapshot has been overwritten
+    CHECK(!reader.valid(first));
+
+    // too big
+    CHECK_THROWS_AS(pub.publish(makeDoc(1000)), std::length_error);
+    CHECK(reader.version() == 201);
+}
+
+TEST_CASE("restart publisher") {
+    TempShm shm("/kuzco-t-shm-publisher-restart");
+
+    std::unique_ptr<ShmReader> reader;
+    {
+        ShmPublisher pub(shm.name, 64 * 1024);
+        pub.publish(makeDoc(10));
+        pub.publish(makeDoc(11));
+        reader = std::make_unique<ShmReader>(shm.name);
+        CHECK(reader->load<Doc>().r().items.size() == 11);
+    }
+
+    // readers remain attached and versions continue
+    ShmPublisher pub(shm.name, 64 * 1024);
+    CHECK(pub.version() == 2);
+    CHECK(reader->version() == 2);
+    auto s = pub.publish(makeDoc(12));
+    CHECK(s.version == 3);
+    CHECK(s.nodesWritten == 13);
+    CHECK(reader->load<Doc>().r().items.size() == 12);
+
+    CHECK_THROWS_AS(ShmPublisher(shm.name, 128 * 1024), std::runtime_error);
+}
+
+TEST_CASE("restart after a crash while switching") {
+    TempShm shm("/kuzco-t-shm-publisher-crash");
+
+    {
+        ShmPublisher pub(shm.name, 64 * 1024);
+        pub.publish(makeDoc(10));
+    }
+
+    // the publisher started writing the other half and crashed before publishing
+    {
+        auto region = ShmRegion::create(shm.name, 64 * 1024);
+        auto& h = *reinterpret_cast<impl::ShmFormat::Header*>(region.data());
+        impl::ShmFormat::store(h.fillEpoch, impl::ShmFormat::load(h.epoch) + 1);
+    }
+
+    ShmReader reader(shm.name);
+    ShmPublisher pub(shm.name, 64 * 1024);
+
+    // the published snapshot is not overwritten
+    auto s = reader.snapshot();
+    CHECK(s.version == 1);
+    CHECK(reader.valid(s));
+    CHECK(reader.load<Doc>().r().items.size() == 10);
+
+    CHECK(pub.publish(makeDoc(11)).version == 2);
+    CHECK(reader.load<Doc>().r().items.size() == 11);
+}
+
+TEST_CASE("concurrent") {
+    TempShm shm("/kuzco-t-shm-publisher-concurrent");
+
+    // small, so that halves are switched often while reading
+    ShmPublisher pub(shm.name, 8 * 1024);
+    ShmReader reader(shm.name);
+
+    constexpr int numItems = 20;
+    std::atomic_bool done = false;
+    std::thread publisher([&] {
+        SharedState<Doc> state(makeDoc(numItems));
+        for (int i = 1; i <= 3000; ++i) {
+            state.transaction()->items[size_t(i % numItems)]->value = i;
+            pub.publish(state.detach());
+        }
+        done = true;
+    });
+
+    uint64_t version = 0;
+    int loads = 0;
+    while (!done) {
+        auto prevVersion = version;
+        auto d = reader.loadIfNewer<Doc>(version);
+        if (!d) continue;
+        ++loads;
+        CHECK(version > prevVersion);
+        auto& items = d.r().items;
+        REQUIRE(items.size() == numItems);
+        for (int j = 0; j < numItems; ++j) {
+            CHECK(items[size_t(j)].r().name == "item" + std::to_string(j));
+            CHECK(items[size_t(j)].r().value <= int(version));
+        }
+        CHECK(items[version % numItems].r().value == int(version));
+    }
+    publisher.join();
+
+    CHECK(loads > 0);
+    CHECK(reader.load<Doc>().r().items[0].r().value == 3000);
+}
+
+#if defined(__linux__)
+TEST_CASE("anonymous") {
+    ShmPublisher pub(ShmRegion::createAnonymous(64 * 1024));
+
+    // the readers of other processes would get the descriptor through fork or a unix socket
+    ShmReader reader(ShmRegion::fromFd(::dup(pub.region().fd()), false));
+
+    pub.publish(makeDoc(3));
+    auto d = reader.load<Doc>();
+    REQUIRE(d);
+    CHECK(d.r().items[2].r().name == "item2");
+}
+#endif
+
+#endif
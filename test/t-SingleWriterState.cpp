@@ -0,0 +1,184 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TestTypes.hpp"
+#include <kuzco/SingleWriterState.hpp>
+
+#include <doctest/doctest.h>
+
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+using namespace kuzco;
+
+TEST_CASE("basic") {
+    SingleWriterState<PersonData> state({"Alice", 0});
+    CHECK(state.maxBatch() == 1);
+
+    auto f = state.post([&](PersonData& p) {
+        CHECK(std::this_thread::get_id() == state.writerThreadId());
+        p.age = 10;
+    });
+    auto [d, changed] = f.get();
+    CHECK(changed);
+    CHECK(d->age == 10);
+    CHECK(state.detach() == d);
+
+    // no CoW, no change
+    auto r = state.post([](NodeTransaction<PersonData>& t) {
+        CHECK(t.r().age == 10);
+    }).get();
+    CHECK_FALSE(r.second);
+    CHECK(r.first == d);
+
+    // a throwing mutation is reverted
+    auto fe = state.post([](PersonData& p) {
+        p.age = 100;
+        throw std::runtime_error("nope");
+    });
+    CHECK_THROWS_AS(fe.get(), std::runtime_error);
+    CHECK(state.detach()->age == 10);
+
+    // transactions are still possible
+    {
+        auto t = state.transaction();
+        t->name = "Bob";
+    }
+    CHECK(state.post([](PersonData& p) { p.age += 1; }).get().first->name == "Bob");
+    CHECK(state.detach()->age == 11);
+}
+
+TEST_CASE("batch") {
+    std::vector<std::future<SingleWriterState<PersonData>::Result>> futures;
+    {
+        SingleWriterState<PersonData> state({"Alice", 0}, 8);
+        CHECK(state.maxBatch() == 8);
+
+        // block the writer, so that mutations pile up
+        std::promise<void> started, release;
+        auto blocker = state.post([&](NodeTransaction<PersonData>&) {
+            started.set_value();
+            release.get_future().wait();
+        });
+        started.get_future().wait();
+
+        for (int i = 0; i < 10; ++i) {
+            futures.push_back(state.post([i](PersonData& p) {
+                if (i == 3) throw std::runtime_error("three");
+                CHECK(p.age == (i > 3 ? i - 1 : i));
+                p.age += 1;
+            }));
+        }
+
+        release.set_value();
+        CHECK_FALSE(blocker.get().second);
+
+        // the destructor waits for all posted mutations
+    }
+
+    Detached<PersonData> firstBatch;
+    for (int i = 0; i < 10; ++i) {
+        if (i == 3) {
+            CHECK_THROWS_AS(futures[i].get(), std::runtime_error);
+            continue;
+        }
+        auto [d, changed] = futures[i].get();
+        CHECK(changed);
+        if (i < 8) {
+            // the first batch publishes 7 changes
+            CHECK(d->age == 7);
+            if (!firstBatch) firstBatch = d;
+            CHECK(d == firstBatch);
+        }
+        else {
+            CHECK(d->age == 9);
+        }
+    }
+}
+
+TEST_CASE("MT") {
+    SingleWriterState<PersonData> state({"Alice", 0}, 4);
+
+    constexpr int numThreads = 4;
+    constexpr int numPosts = 1000;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&]() {
+            std::vector<std::future<SingleWriterState<PersonData>::Result>> futures;
+            for (int j = 0; j < numPosts; ++j) {
+                futures.push_back(state.post([](PersonData& p) { ++p.age; }));
+            }
+            int prev = 0;
+            for (auto& f : futures) {
+                auto d = f.get().first;
+                // a thread's mutations are applied in order (several may be in the same batch)
+                CHECK(d->age >= prev);
+                prev = d->age;
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    CHECK(state.detach()->age == numThreads * numPosts);
+}
+
+namespace {
+// comparison of negative values throws, failing the commit
+struct Counter {
+    int value = 0;
+    bool operator==(const Counter& other) const {
+        if (value < 0 || other.value < 0) throw std::runtime_error("negative");
+        return value == other.value;
+    }
+};
+}
+
+TEST_CASE("commit") {
+    SingleWriterState<Counter> state(Counter{}, 8);
+    state.setSkipEqualCommits(true);
+
+    // a reverted batch changes nothing
+    auto r = state.post([](Counter& c) { c.value = 0; }).get();
+    CHECK_FALSE(r.second);
+    CHECK(r.first == state.detach());
+
+    r = state.post([](Counter& c) { c.value = 1; }).get();
+    CHECK(r.second);
+    CHECK(r.first->value == 1);
+
+    std::future<SingleWriterState<Counter>::Result> f1, f2, f3;
+    {
+        // block the writer, so that the mutations are in the same batch
+        std::promise<void> started, release;
+        auto blocker = state.post([&](NodeTransaction<Counter>&) {
+            started.set_value();
+            release.get_future().wait();
+        });
+        started.get_future().wait();
+
+        // the first changes the value, the second restores it
+        f1 = state.post([](Counter& c) { c.value = 2; });
+        f2 = state.post([](Counter& c) { c.value = 1; });
+        release.set_value();
+        blocker.get();
+    }
+    r = f1.get();
+    CHECK_FALSE(r.second);
+    CHECK(r.first == state.detach());
+    CHECK_FALSE(f2.get().second);
+
+    // a failed commit fails the batch
+    f3 = state.post([](Counter& c) { c.value = -1; });
+    CHECK_THROWS_AS(f3.get(), std::runtime_error);
+    CHECK(state.detach()->value == 1);
+
+    // the writer is still running
+    r = state.post([](Counter& c) { c.value = 5; }).get();
+    CHECK(r.second);
+    CHECK(state.detach()->value == 5);
+}
@@ -0,0 +1,188 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <doctest/doctest.h>
+#include <doctest/util/lifetime_counter.hpp>
+#include <kuzco/SlabNodeVector.hpp>
+
+#include <vector>
+
+TEST_SUITE_BEGIN("Kuzco slab node vector");
+
+namespace
+{
+
+struct X : public doctest::util::lifetime_counter<X>
+{
+    X() = default;
+    explicit X(int v) : val(v) {}
+    int val = 0;
+};
+
+std::vector<X> makeXs(int count, int offset = 0)
+{
+    std::vector<X> ret;
+    for (int i = 0; i < count; ++i)
+    {
+        ret.emplace_back(i + offset);
+    }
+    return ret;
+}
+
+}
+
+TEST_CASE("slab layout")
+{
+    X::lifetime_stats stats;
+    doctest::util::lifetime_counter_sentry sentry(stats);
+
+    auto xs = makeXs(10);
+    CHECK(stats.living == 10);
+
+    kuzco::SlabNodeVector<X> src(xs.begin(), xs.end());
+    CHECK(src.size() == 10);
+    CHECK(src.slabCount() == 1);
+    CHECK(src.overflowSize() == 0);
+    CHECK(stats.living == 20);
+
+    // contiguous
+    for (size_t i = 1; i < src.size(); ++i)
+    {
+        CHECK(&src[i] == &src[i - 1] + 1);
+    }
+
+    int sum = 0;
+    for (auto& x : src)
+    {
+        sum += x.val;
+    }
+    CHECK(sum == 45);
+
+    CHECK(sizeof(kuzco::SlabHandle) == 8);
+    CHECK(src.handle(3).slab == 0);
+    CHECK(src.handle(3).index == 3);
+
+    auto d = src.detach(3);
+    CHECK(d->val == 3);
+    CHECK(d.get() == &src[3]);
+    CHECK(src.detach(3) == d);
+
+    {
+        auto v = src;
+        CHECK(stats.living == 20);
+
+        v.modify(3).val = 33;
+        CHECK(stats.living == 21);
+        CHECK(stats.c_ctr == 11);
+        CHECK(v[3].val == 33);
+        CHECK(src[3].val == 3);
+        CHECK(v.overflowSize() == 1);
+        CHECK(v.handle(3).slab == kuzco::SlabHandle::Overflow);
+        CHECK(src.overflowSize() == 0);
+
+        // modifying a unique element from the overflow doesn't copy it
+        v.modify(3).val = 34;
+        CHECK(stats.c_ctr == 11);
+
+        // but a shared one does
+        auto v2 = v;
+        v2.modify(3).val = 35;
+        CHECK(stats.c_ctr == 12);
+        CHECK(v[3].val == 34);
+        CHECK(v2[3].val == 35);
+    }
+
+    CHECK(stats.living == 20);
+    CHECK(d->val == 3);
+}
+
+TEST_CASE("slab modifiers")
+{
+    X::lifetime_stats stats;
+    doctest::util::lifetime_counter_sentry sentry(stats);
+
+    kuzco::SlabNodeVector<X> v;
+    CHECK(v.empty());
+
+    v.emplace_back(100);
+    v.push_back(X{101});
+    CHECK(v.size() == 2);
+    CHECK(v.overflowSize() == 2);
+    CHECK(v.slabCount() == 0);
+
+    v.append_range(makeXs(5));
+    CHECK(v.size() == 7);
+    CHECK(v.slabCount() == 1);
+    CHECK(v.back().val == 4);
+
+    auto copy = v;
+
+    v.erase(0);
+    CHECK(v.size() == 6);
+    CHECK(v.front().val == 101);
+    CHECK(v.overflowSize() == 1);
+
+    v.erase(1, 3);
+    CHECK(v.size() == 4);
+    CHECK(v[1].val == 2);
+
+    v.pop_back();
+    CHECK(v.size() == 3);
+
+    CHECK(v.find_if([](const X& x) { return x.val == 3; }) == 2);
+    CHECK(v.find_if([](const X& x) { return x.val == 300; }) == v.size());
+
+    // the overflow slot is reused
+    v.emplace_back(102);
+    CHECK(v.overflowSize() == 2);
+    CHECK(v.handle(3).index == 0);
+
+    CHECK(copy.size() == 7);
+    CHECK(copy.front().val == 100);
+
+    auto d = v.detach(2);
+    v.compact();
+    CHECK(v.size() == 4);
+    CHECK(v.slabCount() == 1);
+    CHECK(v.overflowSize() == 0);
+    CHECK(v[0].val == 101);
+    CHECK(v[1].val == 2);
+    CHECK(v[2].val == 3);
+    CHECK(v[3].val == 102);
+    CHECK(&v[3] == &v[0] + 3);
+    CHECK(d->val == 3);
+    CHECK(d != v.detach(2));
+
+    // already compact, even though the overflow has a free slot
+    v.push_back(X{103});
+    v.pop_back();
+    CHECK(v.overflowSize() == 0);
+    d = v.detach(2);
+    v.compact();
+    CHECK(v.size() == 4);
+    CHECK(d == v.detach(2));
+
+    v.clear();
+    CHECK(v.empty());
+    CHECK(copy.size() == 7);
+}
+
+TEST_CASE("slab element identity")
+{
+    kuzco::SlabNodeVector<X> v;
+    v.append_range(makeXs(3));
+    v.emplace_back(3);
+
+    auto d0 = v.detach(0);
+    auto d1 = v.detach(1);
+    CHECK(d0.get() != d1.get());
+
+    // elements of a slab share the fingerprint of the slab
+    CHECK(kuzco::Fingerprint(d0) == kuzco::Fingerprint(d1));
+    CHECK(kuzco::Fingerprint(d0) == kuzco::Fingerprint(v.detach(2)));
+
+    // overflow elements have their own
+    CHECK(kuzco::Fingerprint(d0) != kuzco::Fingerprint(v.detach(3)));
+    v.modify(1).val = 10;
+    CHECK(kuzco::Fingerprint(d0) != kuzco::Fingerprint(v.detach(1)));
+}
@@ -0,0 +1,360 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "PersistTestTypes.hpp"
+
+#include <kuzco/SnapshotStore.hpp>
+#include <kuzco/SharedState.hpp>
+
+#include <doctest/doctest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#include <csignal>
+#endif
+
+using namespace kuzco;
+namespace fs = std::filesystem;
+
+namespace {
+struct TempDir {
+    fs::path path;
+    explicit TempDir(const char* name)
+        : path(fs::temp_directory_path() / name)
+    {
+        fs::remove_all(path);
+    }
+    ~TempDir() {
+        fs::remove_all(path);
+    }
+};
+
+void checkDoc(const Doc& d, int n, int changed = -1, int changedValue = 0) {
+    REQUIRE(d.items.size() == size_t(n));
+    for (int i = 0; i < n; ++i) {
+        CHECK(d.items[i].r().name == "item" + std::to_string(i));
+        CHECK(d.items[i].r().value == (i == changed ? changedValue : i));
+    }
+    CHECK(d.raw == std::vector<int>{1, 2, 3});
+}
+
+// nodes of different types with the same payload
+struct Mixed {
+    Node<std::string> str;
+    Node<std::vector<char>> vec;
+};
+}
+
+template <>
+struct kuzco::PersistTraits<Mixed> {
+    static void save(const Mixed& m, PersistWriter& w) {
+        w.node(m.str);
+        w.node(m.vec);
+    }
+    static Mixed load(PersistReader& r) {
+        return {r.node<std::string>(), r.node<std::vector<char>>()};
+    }
+};
+
+TEST_CASE("incremental") {
+    TempDir tmp("kuzco-t-snapshot-store-incremental");
+
+    SharedState<Doc> state(makeDoc(100));
+    {
+        SnapshotStore store(tmp.path);
+        CHECK(store.lastCheckpoint() == 0);
+        CHECK_THROWS_AS(store.load<Doc>(), std::out_of_range);
+
+        auto s = store.checkpoint(state.detach());
+        CHECK(s.checkpoint == 1);
+        CHECK(s.nodesWritten == 101);
+        CHECK(s.nodesReused == 0);
+        CHECK(store.numNodes() == 101);
+
+        // nothing changed
+        s = store.checkpoint(state.detach());
+        CHECK(s.checkpoint == 2);
+        CHECK(s.nodesWritten == 0);
+        CHECK(s.nodesReused == 1);
+        CHECK(s.bytesWritten == 0);
+
+        // only the changed item and the root are written
+        state.transaction()->items[5]->value = 500;
+        s = store.checkpoint(state.detach());
+        CHECK(s.nodesWritten == 2);
+        CHECK(s.nodesReused == 99);
+        CHECK(store.numNodes() == 103);
+
+        // equal contents are stored once
+        {
+            auto t = state.transaction();
+            t->items[5]->value = 5;
+            t->extra = Item{"item7", 7};
+        }
+        s = store.checkpoint(state.detach());
+        CHECK(s.checkpoint == 4);
+        CHECK(s.nodesWritten == 1);
+        CHECK(s.nodesDeduplicated == 2);
+        CHECK(store.checkpoints() == std::vector<uint64_t>{1, 2, 3, 4});
+
+        auto loaded = store.load<Doc>(3);
+        checkDoc(loaded.r(), 100, 5, 500);
+        CHECK(!loaded.r().extra);
+    }
+
+    // reopen
+    SnapshotStore store(tmp.path);
+    CHECK(store.lastCheckpoint() == 4);
+    CHECK(store.numNodes() == 104);
+
+    auto loaded = store.load<Doc>();
+    auto& doc = loaded.r();
+    checkDoc(doc, 100);
+    REQUIRE(doc.extra);
+    CHECK(doc.extra.r().name == "item7");
+    // shared in the store, so shared when loaded
+    CHECK(doc.extra.detach() == doc.items[7].detach());
+
+    // loaded nodes are known
+    SharedState<Doc> restored(loaded);
+    auto s = store.checkpoint(restored.detach());
+    CHECK(s.checkpoint == 5);
+    CHECK(s.nodesWritten == 0);
+    CHECK(s.nodesReused == 1);
+
+    restored.transaction()->items[0]->value = -1;
+    s = store.checkpoint(restored.detach());
+    CHECK(s.nodesWritten == 2);
+    CHECK(s.nodesReused == 100);
+}
+
+TEST_CASE("modified after checkpoint") {
+    TempDir tmp("kuzco-t-snapshot-store-modified");
+
+    SnapshotStore store(tmp.path);
+    auto n = makeDoc(10);
+    store.checkpoint(n);
+
+    // the store references the persisted nodes, so they're copied on write
+    auto root = n.detach().get();
+    n->items[3]->value = -1;
+    CHECK(n.detach().get() != root);
+    auto s = store.checkpoint(n);
+    CHECK(s.nodesWritten == 2);
+    CHECK(s.nodesReused == 9);
+    checkDoc(store.load<Doc>().r(), 10, 3, -1);
+
+    // loaded nodes too
+    auto loaded = store.load<Doc>();
+    loaded->items[5]->value = -2;
+    s = store.checkpoint(loaded);
+    CHECK(s.nodesWritten == 2);
+    auto d = store.load<Doc>();
+    CHECK(d.r().items[3].r().value == -1);
+    CHECK(d.r().items[5].r().value == -2);
+}
+
+TEST_CASE("torn") {
+    TempDir tmp("kuzco-t-snapshot-store-torn");
+
+    {
+        SnapshotStore store(tmp.path);
+        store.checkpoint(makeDoc(10));
+    }
+
+    // crash while writing a checkpoint
+    for (auto& e : fs::directory_iterator(tmp.path)) {
+        std::ofstream f(e.path(), std::ios::binary | std::ios::app);
+        f.write("\x01\x02\x03\x04\x05", 5);
+    }
+
+    SnapshotStore store(tmp.path);
+    CHECK(store.lastCheckpoint() == 1);
+    CHECK(store.numNodes() == 11);
+    checkDoc(store.load<Doc>().r(), 10);
+
+    auto s = store.checkpoint(makeDoc(11));
+    CHECK(s.checkpoint == 2);
+    CHECK(s.nodesWritten == 2); // the new item and the root
+    CHECK(s.nodesDeduplicated == 10);
+    checkDoc(store.load<Doc>().r(), 11);
+}
+
+#if !defined(_WIN32)
+namespace {
+// writes beyond the given file size fail
+struct FileSizeLimit {
+    rlimit prev;
+    explicit FileSizeLimit(rlim_t size) {
+        std::signal(SIGXFSZ, SIG_IGN);
+        getrlimit(RLIMIT_FSIZE, &prev);
+        rlimit lim = prev;
+        lim.rlim_cur = size;
+        setrlimit(RLIMIT_FSIZE, &lim);
+    }
+    ~FileSizeLimit() {
+        setrlimit(RLIMIT_FSIZE, &prev);
+        std::signal(SIGXFSZ, SIG_DFL);
+    }
+};
+}
+
+TEST_CASE("failed write") {
+    TempDir tmp("kuzco-t-snapshot-store-failed-write");
+
+    {
+        SnapshotStore store(tmp.path);
+        store.checkpoint(makeDoc(10));
+        auto bytes = store.segmentBytes();
+
+        // a part of the records fits
+        {
+            FileSizeLimit limit(bytes + 1000);
+            CHECK_THROWS_AS(store.checkpoint(makeDoc(2000)), std::runtime_error);
+        }
+        CHECK(store.lastCheckpoint() == 1);
+        CHECK(store.segmentBytes() == bytes);
+        CHECK(store.numNodes() == 11);
+
+        // the following records start a new segment
+        auto s = store.checkpoint(makeDoc(2000));
+        CHECK(s.nodesWritten == 1991);
+        CHECK(store.numSegments() == 2);
+        checkDoc(store.load<Doc>().r(), 2000);
+        checkDoc(store.load<Doc>(1).r(), 10);
+    }
+
+    SnapshotStore store(tmp.path);
+    CHECK(store.lastCheckpoint() == 2);
+    checkDoc(store.load<Doc>().r(), 2000);
+}
+#endif
+
+TEST_CASE("compact") {
+    TempDir tmp("kuzco-t-snapshot-store-compact");
+
+    SnapshotStoreConfig config;
+    config.segmentSize = 512;
+
+    SharedState<Doc> state(makeDoc(20));
+    {
+        SnapshotStore store(tmp.path, config);
+        store.checkpoint(state.detach());
+        for (int i = 0; i < 50; ++i) {
+            state.transaction()->items[size_t(i % 3)]->value = 1000 + i;
+            store.checkpoint(state.detach());
+        }
+        CHECK(store.lastCheckpoint() == 51);
+
+        auto nodes = store.numNodes();
+        auto bytes = store.segmentBytes();
+        auto segments = store.numSegments();
+        CHECK(segments > 10);
+
+        auto s = store.compact(2);
+        CHECK(s.liveNodes == 23); // two roots, 20 shared items, and an item from the older one
+        CHECK(s.segmentsRemoved > 0);
+        CHECK(s.bytesFreed > 0);
+        CHECK(store.numNodes() == 23);
+        CHECK(store.numNodes() < nodes);
+        CHECK(store.segmentBytes() < bytes);
+        CHECK(store.numSegments() < segments);
+        CHECK(store.checkpoints() == std::vector<uint64_t>{50, 51});
+        CHECK_THROWS_AS(store.load<Doc>(49), std::out_of_range);
+
+        auto d = store.load<Doc>(50);
+        CHECK(d.r().items[0].r().value == 1048);
+        CHECK(d.r().items[1].r().value == 1046);
+        CHECK(d.r().items[2].r().value == 1047);
+
+        // checkpoints continue
+        state.transaction()->items[19]->value = 19000;
+        auto cs = store.checkpoint(state.detach());
+        CHECK(cs.checkpoint == 52);
+        CHECK(cs.nodesWritten == 2);
+    }
+
+    SnapshotStore store(tmp.path, config);
+    CHECK(store.checkpoints() == std::vector<uint64_t>{50, 51, 52});
+    auto d = store.load<Doc>();
+    auto& items = d.r().items;
+    CHECK(items[0].r().value == 1048);
+    CHECK(items[1].r().value == 1049);
+    CHECK(items[2].r().value == 1047);
+    CHECK(items[3].r().value == 3);
+    CHECK(items[19].r().value == 19000);
+
+    auto s = store.compact();
+    CHECK(s.liveNodes == 21);
+    CHECK(store.checkpoints() == std::vector<uint64_t>{52});
+    CHECK(store.load<Doc>().r().items[19].r().value == 19000);
+}
+
+TEST_CASE("failed compact") {
+    TempDir tmp("kuzco-t-snapshot-store-failed-compact");
+
+    SharedState<Doc> state(makeDoc(10));
+    SnapshotStore store(tmp.path);
+    store.checkpoint(state.detach());
+    state.transaction()->items[0]->value = -1;
+    store.checkpoint(state.detach());
+
+    // the new roots file can't be created
+    auto tmpRoots = tmp.path / "roots.kzr.tmp";
+    fs::create_directory(tmpRoots);
+    CHECK_THROWS_AS(store.compact(), std::runtime_error);
+    fs::remove(tmpRoots);
+
+    CHECK(store.checkpoints() == std::vector<uint64_t>{1, 2});
+    checkDoc(store.load<Doc>(1).r(), 10);
+    checkDoc(store.load<Doc>(2).r(), 10, 0, -1);
+
+    store.compact();
+    CHECK(store.checkpoints() == std::vector<uint64_t>{2});
+    checkDoc(store.load<Doc>().r(), 10, 0, -1);
+}
+
+TEST_CASE("types") {
+    TempDir tmp("kuzco-t-snapshot-store-types");
+
+    {
+        SnapshotStore store(tmp.path);
+        auto s = store.checkpoint(Node<Mixed>(Mixed{std::string("abc"), std::vector<char>{'a', 'b', 'c'}}));
+        CHECK(s.nodesWritten == 3);
+        CHECK(s.nodesDeduplicated == 0);
+    }
+
+    SnapshotStore store(tmp.path);
+    CHECK(store.numNodes() == 3);
+    auto loaded = store.load<Mixed>();
+    CHECK(loaded.r().str.r() == "abc");
+    CHECK(loaded.r().vec.r() == std::vector<char>{'a', 'b', 'c'});
+
+    CHECK_THROWS_AS(store.load<Doc>(), std::runtime_error);
+}
+
+namespace {
+enum class Color : uint8_t { Red, Green };
+struct Packed { int32_t a, b; };
+struct Padded { char c; int32_t i; };
+struct Pair { float x, y; };
+}
+
+TEST_CASE("bytes") {
+    // types saved as bytes by the default PersistTraits
+    static_assert(impl::persistAsBytes<int>);
+    static_assert(impl::persistAsBytes<double>);
+    static_assert(impl::persistAsBytes<Color>);
+    static_assert(impl::persistAsBytes<Packed>);
+    static_assert(impl::persistAsBytes<int[4]>);
+    static_assert(!impl::persistAsBytes<const char*>);
+    static_assert(!impl::persistAsBytes<int Packed::*>);
+    static_assert(!impl::persistAsBytes<Padded>);
+    static_assert(!impl::persistAsBytes<Pair>); // structs with floats must be specialized
+    static_assert(!impl::persistAsBytes<std::string>);
+}
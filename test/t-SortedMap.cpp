@@ -0,0 +1,188 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include "TestTypes.hpp"
+#include <kuzco/SortedMap.hpp>
+
+#include <doctest/doctest.h>
+
+#include <map>
+#include <set>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace kuzco;
+
+TEST_CASE("basic") {
+    SortedMap<int, std::string> m;
+    CHECK(m.empty());
+    CHECK(m.begin() == m.end());
+    CHECK(m.height() == 0);
+    CHECK_FALSE(m.contains(1));
+    CHECK(m.erase(1) == 0);
+
+    CHECK(m.insert(2, "two"));
+    CHECK(m.insert(1, "one"));
+    CHECK_FALSE(m.insert(1, "uno"));
+    CHECK(m.at(1) == "one");
+    CHECK_FALSE(m.insert_or_assign(1, "uno"));
+    CHECK(m.at(1) == "uno");
+    CHECK(m.insert_or_assign(3, "three"));
+    CHECK(m.size() == 3);
+    CHECK_THROWS_AS(m.at(5), std::out_of_range);
+    CHECK_FALSE(m.get(5));
+
+    std::vector<int> keys;
+    for (auto& [k, v] : m) keys.push_back(k);
+    CHECK(keys == std::vector<int>{1, 2, 3});
+
+    auto copy = m;
+    CHECK(copy.sameAs(m));
+    m.modify(2) = "dos";
+    CHECK_FALSE(copy.sameAs(m));
+    CHECK(m.at(2) == "dos");
+    CHECK(copy.at(2) == "two");
+
+    CHECK(m.erase(2) == 1);
+    CHECK(m.size() == 2);
+    CHECK(copy.size() == 3);
+    CHECK(m.find(2) == m.end());
+    CHECK(copy.find(2)->second == "two");
+
+    SortedMap<int, std::string> il = {{3, "c"}, {1, "a"}, {2, "b"}, {1, "x"}};
+    CHECK(il.size() == 3);
+    CHECK(il.at(1) == "a");
+}
+
+TEST_CASE("bounds and ranges") {
+    std::vector<std::pair<int, int>> sorted;
+    for (int i = 0; i < 1000; ++i) {
+        sorted.emplace_back(i * 2, i);
+    }
+
+    SortedMap<int, int, std::less<int>, 8> m(sorted_unique, sorted.begin(), sorted.end());
+    CHECK(m.size() == 1000);
+    CHECK(m.height() == 4);
+
+    CHECK(m.lower_bound(10)->first == 10);
+    CHECK(m.lower_bound(11)->first == 12);
+    CHECK(m.upper_bound(10)->first == 12);
+    CHECK(m.lower_bound(-5)->first == 0);
+    CHECK(m.lower_bound(1998)->first == 1998);
+    CHECK(m.lower_bound(1999) == m.end());
+    CHECK(m.upper_bound(1998) == m.end());
+
+    int sum = 0, count = 0;
+    for (auto& [k, v] : m.range(100, 200)) {
+        CHECK(k >= 100);
+        CHECK(k < 200);
+        sum += v;
+        ++count;
+    }
+    CHECK(count == 50);
+    CHECK(sum == (50 + 99) * 50 / 2);
+    CHECK(m.range(200, 100).begin() == m.end());
+
+    CHECK(std::equal(m.begin(), m.end(), sorted.begin(), sorted.end()));
+
+    sorted.push_back({5, 5});
+    CHECK_THROWS_AS((SortedMap<int, int>(sorted_unique, sorted.begin(), sorted.end())), std::invalid_argument);
+}
+
+template <typename A, typename B>
+bool equalEntries(const A& a, const B& b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](auto& x, auto& y) {
+        return x.first == y.first && x.second == y.second;
+    });
+}
+
+TEST_CASE("random") {
+    std::minstd_rand rnd(7);
+    std::map<int, int> ref;
+    SortedMap<int, int, std::less<int>, 4> m;
+    std::vector<std::pair<std::map<int, int>, SortedMap<int, int, std::less<int>, 4>>> history;
+
+    for (int i = 0; i < 5000; ++i) {
+        int k = rnd() % 500;
+        switch (rnd() % 4) {
+        case 0:
+        case 1:
+            CHECK(m.insert(k, i) == ref.emplace(k, i).second);
+            break;
+        case 2:
+            CHECK(m.erase(k) == ref.erase(k));
+            break;
+        case 3:
+            if (ref.count(k)) {
+                m.modify(k) = -i;
+                ref[k] = -i;
+            }
+            break;
+        }
+        if (i % 250 == 0) {
+            history.emplace_back(ref, m);
+            CHECK(m.size() == ref.size());
+            CHECK(equalEntries(m, ref));
+        }
+    }
+
+    CHECK(equalEntries(m, ref));
+
+    // snapshots are unaffected
+    for (auto& [r, s] : history) {
+        CHECK(s.size() == r.size());
+        CHECK(equalEntries(s, r));
+    }
+
+    // erase all
+    for (auto& [k, v] : ref) {
+        CHECK(m.erase(k) == 1);
+    }
+    CHECK(m.empty());
+    CHECK(m.height() == 0);
+}
+
+TEST_CASE("set") {
+    SortedSet<std::string> s = {"b", "a", "c", "a"};
+    CHECK(s.size() == 3);
+    CHECK(*s.begin() == "a");
+    CHECK(s.insert("d"));
+    CHECK_FALSE(s.insert("a"));
+    CHECK(s.contains("d"));
+    CHECK(*s.lower_bound("bb") == "c");
+
+    std::vector<int> sorted(100);
+    for (int i = 0; i < 100; ++i) sorted[i] = i;
+    SortedSet<int, std::less<int>, 4> is(sorted_unique, sorted.begin(), sorted.end());
+    auto copy = is;
+    for (int i = 0; i < 100; i += 2) {
+        is.erase(i);
+    }
+    CHECK(is.size() == 50);
+    CHECK(*is.begin() == 1);
+    CHECK(copy.size() == 100);
+    CHECK(std::equal(copy.begin(), copy.end(), sorted.begin(), sorted.end()));
+}
+
+TEST_CASE("node map") {
+    PersonData::lifetime_stats stats;
+    doctest::util::lifetime_counter_sentry sentry(stats);
+
+    SortedNodeMap<std::string, PersonData> m;
+    m.insert("alice", Node<PersonData>("Alice", 30));
+    m.insert("bob", Node<PersonData>("Bob", 40));
+    CHECK(m.r("alice").age == 30);
+
+    auto copy = m;
+    auto d = copy.detach("bob");
+    m.modify("bob")->age = 41;
+    CHECK(m.r("bob").age == 41);
+    CHECK(copy.r("bob").age == 40);
+    CHECK(d->age == 40);
+    CHECK(m.r("alice").name == "Alice");
+    CHECK(m.at("alice").sameAs(copy.detach("alice")));
+
+    // only bob was copied
+    CHECK(stats.copies == 1);
+}
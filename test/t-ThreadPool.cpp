@@ -0,0 +1,97 @@
+// Copyright (c) Borislav Stanimirov
+// SPDX-License-Identifier: MIT
+//
+#include <kuzco/ThreadPool.hpp>
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace kuzco;
+
+TEST_CASE("parallelFor") {
+    ThreadPool pool(3);
+    CHECK(pool.numThreads() == 3);
+
+    std::vector<int> data(1000);
+    auto chunks = pool.parallelFor(data.size(), 100, [&](size_t b, size_t e) {
+        for (auto i = b; i < e; ++i) {
+            data[i] = int(i);
+        }
+    });
+    CHECK(chunks == 4); // 3 workers + us
+
+    for (size_t i = 0; i < data.size(); ++i) {
+        CHECK(data[i] == int(i));
+    }
+
+    chunks = pool.parallelFor(10, 100, [&](size_t b, size_t e) {
+        CHECK(b == 0);
+        CHECK(e == 10);
+    });
+    CHECK(chunks == 1);
+
+    CHECK(pool.parallelFor(0, 100, [](size_t, size_t) {}) == 0);
+}
+
+TEST_CASE("parallelFor coverage") {
+    for (unsigned threads = 1; threads <= 5; ++threads) {
+        ThreadPool pool(threads);
+        for (size_t count = 1; count <= 20; ++count) {
+            for (size_t grain = 1; grain <= 4; ++grain) {
+                std::vector<std::atomic<int>> hits(count);
+                std::atomic<size_t> chunks = 0;
+                auto ret = pool.parallelFor(count, grain, [&](size_t b, size_t e) {
+                    CHECK(b < e);
+                    CHECK(e <= count);
+                    for (auto i = b; i < std::min(e, count); ++i) {
+                        ++hits[i];
+                    }
+                    ++chunks;
+                });
+                CHECK(ret == chunks);
+                for (auto& h : hits) {
+                    CHECK(h == 1);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("parallelFor nested") {
+    ThreadPool pool(2);
+    std::atomic<int> sum = 0;
+    pool.parallelFor(8, 1, [&](size_t b, size_t e) {
+        for (auto i = b; i < e; ++i) {
+            pool.parallelFor(10, 1, [&](size_t ib, size_t ie) {
+                sum += int(ie - ib);
+            });
+        }
+    });
+    CHECK(sum == 80);
+}
+
+TEST_CASE("parallelFor exceptions") {
+    ThreadPool pool(2);
+    std::atomic<int> done = 0;
+    CHECK_THROWS_AS(pool.parallelFor(30, 10, [&](size_t b, size_t) {
+        if (b == 10) throw std::runtime_error("bad chunk");
+        ++done;
+    }), std::runtime_error);
+    CHECK(done == 2);
+}
+
+TEST_CASE("post") {
+    std::atomic<int> n = 0;
+    {
+        ThreadPool pool(2);
+        for (int i = 0; i < 100; ++i) {
+            pool.post([&]() { ++n; });
+        }
+    }
+    // pending tasks are completed on destruction
+    CHECK(n == 100);
+}
@@ -7,6 +7,7 @@
 #include <kuzco/StdVector.hpp>
 
 #include <cstring>
+#include <algorithm>
 #include <string>
 
 TEST_SUITE_BEGIN("Kuzco vector");
@@ -206,3 +207,261 @@ TEST_CASE("Compare")
     CHECK(d2 == v2);
     CHECK(d3 == v3);
 }
+
+namespace {
+int allocations = 0;
+
+template <typename T>
+struct CountingAlloc {
+    using value_type = T;
+    CountingAlloc() = default;
+    template <typename U>
+    CountingAlloc(const CountingAlloc<U>&) {}
+    T* allocate(size_t n) {
+        ++allocations;
+        return std::allocator<T>{}.allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        std::allocator<T>{}.deallocate(p, n);
+    }
+    bool operator==(const CountingAlloc&) const { return true; }
+};
+
+using CountedVector = kuzco::Vector<std::vector<int, CountingAlloc<int>>>;
+
+bool equals(const CountedVector& v, std::initializer_list<int> ilist) {
+    return std::equal(v.begin(), v.end(), ilist.begin(), ilist.end());
+}
+}
+
+TEST_CASE("Bulk ops")
+{
+    CountedVector vec;
+    vec.assign({1, 2, 3, 4, 5, 6, 7, 8});
+
+    {
+        auto copy = vec;
+        allocations = 0;
+        auto erased = copy.erase_if([](int i) { return i % 2 == 0; });
+        CHECK(erased == 4);
+        CHECK(allocations == 1);
+        CHECK(equals(copy, {1, 3, 5, 7}));
+        CHECK(vec.size() == 8);
+
+        // nothing erased, nothing copied
+        auto copy2 = vec;
+        CHECK(copy2.erase_if([](int i) { return i > 100; }) == 0);
+        CHECK(copy2 == vec);
+        CHECK(allocations == 1);
+
+        allocations = 0;
+        auto d = copy.data();
+        CHECK(copy.retain([](int i) { return i > 2; }) == 1);
+        CHECK(allocations == 0);
+        CHECK(copy.data() == d);
+        CHECK(equals(copy, {3, 5, 7}));
+    }
+
+    {
+        int more[] = {10, 11, 12};
+        auto copy = vec;
+        allocations = 0;
+        auto i = copy.insert(copy.cbegin() + 2, std::begin(more), std::end(more));
+        CHECK(allocations == 1);
+        CHECK(*i == 10);
+        CHECK(i - copy.cbegin() == 2);
+        CHECK(equals(copy, {1, 2, 10, 11, 12, 3, 4, 5, 6, 7, 8}));
+        CHECK(vec.size() == 8);
+
+        copy.reserve(20);
+        allocations = 0;
+        i = copy.insert(copy.cend(), std::begin(more), std::end(more));
+        CHECK(allocations == 0);
+        CHECK(*i == 10);
+        CHECK(copy.size() == 14);
+
+        auto copy2 = vec;
+        allocations = 0;
+        copy2.append_range(more);
+        CHECK(allocations == 1);
+        CHECK(equals(copy2, {1, 2, 3, 4, 5, 6, 7, 8, 10, 11, 12}));
+
+        auto copy3 = vec;
+        allocations = 0;
+        i = copy3.emplace(copy3.cbegin() + 1, 42);
+        CHECK(allocations == 1);
+        CHECK(*i == 42);
+        CHECK(i - copy3.cbegin() == 1);
+        CHECK(copy3.size() == 9);
+        CHECK(vec[1] == 2);
+    }
+}
+
+TEST_CASE("Insert range of another type")
+{
+    kuzco::StdVector<double> vec;
+    vec.assign({1.5, 2.5});
+
+    std::vector<int> ints = {3, 4, 5};
+    auto copy = vec;
+    auto i = copy.insert(copy.cbegin() + 1, ints.begin(), ints.end());
+    CHECK(*i == 3);
+    CHECK(i - copy.cbegin() == 1);
+    CHECK(copy.size() == 5);
+    CHECK(copy[3] == 5);
+    CHECK(copy[4] == 2.5);
+    CHECK(vec.size() == 2);
+
+    auto copy2 = vec;
+    copy2.append_range(ints);
+    CHECK(copy2.size() == 5);
+    CHECK(copy2[2] == 3);
+    CHECK(vec.size() == 2);
+}
+
+TEST_CASE("Insert own elements")
+{
+    kuzco::StdVector<std::string> vec;
+    vec.assign({"a long string which is allocated", "b"});
+    REQUIRE(vec.unique());
+
+    vec.append_range(vec);
+    REQUIRE(vec.size() == 4);
+    CHECK(vec[2] == "a long string which is allocated");
+    CHECK(vec[3] == "b");
+
+    auto i = vec.insert(vec.cbegin() + 1, vec.cbegin() + 2, vec.cend());
+    CHECK(i - vec.cbegin() == 1);
+    REQUIRE(vec.size() == 6);
+    CHECK(vec[1] == "a long string which is allocated");
+    CHECK(vec[2] == "b");
+    CHECK(vec[5] == "b");
+
+    vec.insert(vec.cend(), vec.crbegin(), vec.crbegin() + 2);
+    REQUIRE(vec.size() == 8);
+    CHECK(vec[6] == "b");
+    CHECK(vec[7] == "a long string which is allocated");
+}
+
+TEST_CASE("CoW rebuilds")
+{
+    CountedVector vec;
+    vec.assign({1, 2, 3, 4});
+
+    {
+        auto copy = vec;
+        allocations = 0;
+        copy.reserve(10);
+        CHECK(allocations == 1);
+        CHECK(copy.capacity() >= 10);
+        CHECK(equals(copy, {1, 2, 3, 4}));
+
+        allocations = 0;
+        auto d = copy.data();
+        copy.resize(8);
+        copy.resize(10, 7);
+        CHECK(allocations == 0);
+        CHECK(copy.data() == d);
+        CHECK(equals(copy, {1, 2, 3, 4, 0, 0, 0, 0, 7, 7}));
+        copy.pop_back();
+        CHECK(copy.data() == d);
+        CHECK(copy.size() == 9);
+    }
+
+    {
+        auto copy = vec;
+        allocations = 0;
+        copy.resize(6, 9);
+        CHECK(allocations == 1);
+        CHECK(equals(copy, {1, 2, 3, 4, 9, 9}));
+
+        auto copy2 = vec;
+        allocations = 0;
+        copy2.resize(2);
+        CHECK(allocations == 1);
+        CHECK(equals(copy2, {1, 2}));
+
+        auto copy3 = vec;
+        allocations = 0;
+        copy3.pop_back();
+        CHECK(allocations == 1);
+        CHECK(equals(copy3, {1, 2, 3}));
+        CHECK(equals(vec, {1, 2, 3, 4}));
+    }
+}
+
+TEST_CASE("Transient")
+{
+    CountedVector vec;
+    vec.assign({1, 2, 3});
+
+    auto snapshot = vec;
+    {
+        allocations = 0;
+        auto t = vec.transient();
+        CHECK(allocations == 1); // shared with the snapshot, so copied once
+        CHECK(t.active());
+        CHECK(vec.empty());
+
+        t->reserve(100);
+        auto d = t->data();
+        allocations = 0;
+        for (int i = 4; i <= 100; ++i) {
+            t->push_back(i);
+        }
+        (*t)[0] = 10;
+        t->erase(t->begin() + 1);
+        CHECK(allocations == 0);
+        CHECK(t->data() == d);
+
+        auto& p = t.persistent();
+        CHECK(&p == &vec);
+        CHECK(!t.active());
+        CHECK(vec.data() == d);
+
+        // again: no-op
+        CHECK(&t.persistent() == &vec);
+        CHECK(vec.data() == d);
+    }
+    CHECK(vec.size() == 99);
+    CHECK(vec[0] == 10);
+    CHECK(vec[1] == 3);
+    CHECK(vec.back() == 100);
+    CHECK(equals(snapshot, {1, 2, 3}));
+
+    // owned storage is moved in without copies
+    auto d = vec.data();
+    {
+        allocations = 0;
+        auto t = vec.transient();
+        t->pop_back();
+        // persisted by the destructor
+    }
+    CHECK(allocations == 0);
+    CHECK(vec.data() == d);
+    CHECK(vec.size() == 98);
+    CHECK(vec.back() == 99);
+
+    // moved transients persist once
+    {
+        auto t = vec.transient();
+        auto t2 = std::move(t);
+        CHECK(!t.active());
+        CHECK(t2.active());
+        CHECK(&t.persistent() == &vec); // no-op
+        t2->clear();
+        t2->push_back(7);
+    }
+    CHECK(equals(vec, {7}));
+    vec.clear();
+
+    // the placeholder is not affected by writes to the vector
+    {
+        CountedVector other;
+        auto t = other.transient();
+        vec.push_back(5);
+        CHECK(other.empty());
+        t->push_back(1);
+    }
+    CHECK(equals(vec, {5}));
+}